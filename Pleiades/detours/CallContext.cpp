@@ -1,28 +1,95 @@
+#include <atomic>
+#include <unordered_map>
 
 #include "CallContext.hpp"
 
-DetourCallContext::DetourCallContext(InitToken&& token) noexcept :
-	m_FuncSig(token.FuncSig),
-	m_PassRet(std::move(token.RetData)),
-	m_PassArgs(std::move(token.ArgsData))
+/// <summary>
+/// Frames of every detour the current thread is in, by context id
+/// </summary>
+struct ThreadFrames
+{
+	std::vector<std::unique_ptr<DetourCallContext::CallFrame>> Frames;
+	// number of frames in use, the rest are kept for the next calls
+	size_t Depth{ };
+};
+
+static thread_local std::unordered_map<uint64_t, ThreadFrames> t_ThreadFrames;
+// frames of the last detour the current thread looked up, calls mostly enter and leave the same detour back to back
+static thread_local std::pair<uint64_t, ThreadFrames*> t_LastFrames;
+
+
+/// <summary>
+/// Get the current thread's frames of a detour
+/// </summary>
+/// <returns>the frames, null if 'create' is false and the thread never entered the detour</returns>
+static ThreadFrames* FindThreadFrames(uint64_t id, bool create)
+{
+	if (t_LastFrames.first == id)
+		return t_LastFrames.second;
+
+	ThreadFrames* frames;
+	if (create)
+		frames = &t_ThreadFrames[id];
+	else
+	{
+		const auto iter = t_ThreadFrames.find(id);
+		if (iter == t_ThreadFrames.end())
+			return nullptr;
+		frames = &iter->second;
+	}
+
+	// nodes of an unordered_map are never moved, the pointer stays valid
+	t_LastFrames = { id, frames };
+	return frames;
+}
+
+
+DetourCallContext::CallFrame::CallFrame(const DetourCallContext& context) :
+	m_PassRet(context.m_RetSize),
+	m_PassArgs(context.m_ArgsInfo, context.m_HasThisPtr)
 {}
 
+DetourCallContext::DetourCallContext(InitToken&& token) :
+	m_FuncSig(token.FuncSig),
+	m_ArgsInfo(std::move(token.ArgsInfo)),
+	m_RetSize(token.RetSize),
+	m_HasThisPtr(token.HasThisPtr)
+{
+	static std::atomic<uint64_t> next_id;
+	m_Id = ++next_id;
+
+	// vector args are moved with aligned instructions, keep every slot aligned
+	constexpr auto align16 = [] (size_t offset) { return (offset + 15) & ~size_t(15); };
+
+	size_t offset = 0;
+	m_ArgOffsets.reserve(m_ArgsInfo.size());
+	for (const auto& [size, is_const] : m_ArgsInfo)
+	{
+		m_ArgOffsets.emplace_back(offset);
+		offset = align16(offset + size);
+	}
+
+	m_RetOffset = offset;
+	m_SavedRetOffset = align16(m_RetOffset + m_RetSize);
+	m_StackPointerOffset = align16(m_SavedRetOffset + m_RetSize);
+}
+
 /// <summary>
 /// https://github.com/asmjit/asmjit/blob/master/src/asmjit/x86/x86emithelper.cpp#L171
 /// </summary>
 static asmjit::Error EmitRegMove(asmjit::x86::Compiler& comp, const asmjit::Operand& dst_, const asmjit::Operand& src_, asmjit::TypeId typeId);
 
 
-void DetourCallContext::ManageArgs(const detour_detail::TypeInfo& typeInfo, asmjit::x86::Compiler& comp, bool load_from_compiler)
+void DetourCallContext::ManageArgs(const detour_detail::TypeInfo& typeInfo, asmjit::x86::Compiler& comp, const asmjit::x86::Mem& frame_data, bool load_from_compiler)
 {
 	using namespace asmjit;
 
 	size_t arg_pos = 0;
 	if (typeInfo.has_this_ptr())
 	{
-		auto& cur = m_PassArgs.m_CurData[arg_pos++];
-		x86::Mem mem(uint32_t(cur.data()), cur.size());
-		typeInfo.this_().id();
+		x86::Mem mem(frame_data.cloneAdjusted(m_ArgOffsets[arg_pos]));
+		mem.setSize(m_ArgsInfo[arg_pos].first);
+		++arg_pos;
 
 		if (load_from_compiler)
 		{
@@ -36,8 +103,8 @@ void DetourCallContext::ManageArgs(const detour_detail::TypeInfo& typeInfo, asmj
 
 	for (size_t offset = 0; auto & arg : typeInfo.args_iterator())
 	{
-		auto& cur = m_PassArgs.m_CurData[arg_pos];
-		x86::Mem mem(uint64_t(cur.data()) + offset);
+		const size_t arg_size = m_ArgsInfo[arg_pos].first;
+		x86::Mem mem(frame_data.cloneAdjusted(m_ArgOffsets[arg_pos] + offset));
 
 		if (load_from_compiler)
 		{
@@ -63,7 +130,7 @@ void DetourCallContext::ManageArgs(const detour_detail::TypeInfo& typeInfo, asmj
 			}
 		}
 
-		if (offset += arg.Size; offset >= cur.size())
+		if (offset += arg.Size; offset >= arg_size)
 		{
 			offset = 0;
 			++arg_pos;
@@ -72,34 +139,12 @@ void DetourCallContext::ManageArgs(const detour_detail::TypeInfo& typeInfo, asmj
 	}
 }
 
-void DetourCallContext::WriteChangedArgs()
-{
-	const size_t size = m_PassArgs.size(), offset{ };
-	for (size_t i = 0; i < size; i++)
-	{
-		if (m_PassArgs.has_changed(i))
-		{
-			const auto& to = m_PassArgs.m_CurData[i], & from = m_PassArgs.m_NewData[i];
-			memcpy(to.data(), from.data(), from.size());
-		};
-	}
-}
-
-void DetourCallContext::WriteChangedReturn()
-{
-	if (!m_PassRet.has_changed() && !m_PassRet.is_void())
-		return;
-
-	auto& to = m_PassRet.m_CurData, & from = m_PassRet.m_NewData;
-	memcpy(to.data(), from.data(), from.size());
-}
-
-void DetourCallContext::ManageReturn(asmjit::x86::Compiler& comp, bool read_from_compiler, const asmjit::BaseReg& reg0, const asmjit::BaseReg& reg1)
+void DetourCallContext::ManageReturn(asmjit::x86::Compiler& comp, const asmjit::x86::Mem& frame_data, bool read_from_compiler, const asmjit::BaseReg& reg0, const asmjit::BaseReg& reg1)
 {
 	using namespace asmjit;
 
-	auto& out_addr = m_PassRet.m_CurData;
-	x86::Mem mem(uint64_t(out_addr.data()), out_addr.size());
+	x86::Mem mem(frame_data.cloneAdjusted(m_RetOffset));
+	mem.setSize(m_RetSize);
 
 	if (read_from_compiler)
 	{
@@ -121,89 +166,133 @@ void DetourCallContext::ManageReturn(asmjit::x86::Compiler& comp, bool read_from
 	}
 }
 
-void DetourCallContext::ManageReturnInMem(asmjit::x86::Compiler& comp, bool read_from_compiler, const asmjit::BaseReg& outreg)
+void DetourCallContext::ManageReturnInMem(asmjit::x86::Compiler& comp, const asmjit::x86::Mem& frame_data, bool read_from_compiler, const asmjit::BaseReg& outreg)
 {
 	using namespace asmjit;
 
+	x86::Gp ret_data = comp.newIntPtr();
+	comp.lea(ret_data, frame_data.cloneAdjusted(m_RetOffset));
+
 	InvokeNode* pFunc;
 	comp.invoke(&pFunc, memcpy, FuncSignatureT<void*, void*, const void*, size_t>());
 
 	if (read_from_compiler)
 	{
-		pFunc->setArg(0, m_PassRet.m_CurData.data());
+		pFunc->setArg(0, ret_data);
 		pFunc->setArg(1, outreg);
 	}
 	else
 	{
 		pFunc->setArg(0, outreg);
-		pFunc->setArg(1, m_PassRet.m_CurData.data());
+		pFunc->setArg(1, ret_data);
 	}
 
-	pFunc->setArg(2, m_PassRet.size());
+	pFunc->setArg(2, m_RetSize);
 }
 
 
-void DetourCallContext::PushArgs()
+auto DetourCallContext::PushFrame(std::byte* frame_data) -> CallFrame&
 {
-	if (m_PassArgs.size())
-	{
-		auto args(std::make_unique<px::PassRet::data_arr>(m_PassArgs.m_SizeInMem));
-		size_t cur_offset = 0;
-		for (auto& arg : m_PassArgs.m_CurData)
-		{
-			memcpy_s(args.get() + cur_offset, m_PassArgs.m_SizeInMem, arg.data(), arg.size());
-			cur_offset += arg.size();
-		}
+	ThreadFrames& frames = *FindThreadFrames(m_Id, true);
+	if (frames.Depth == frames.Frames.size())
+		frames.Frames.emplace_back(std::make_unique<CallFrame>(*this));
+
+	CallFrame& frame = *frames.Frames[frames.Depth++];
+	frame.m_LastResults = { };
+	frame.m_FrameData = frame_data;
+	return frame;
+}
 
-		m_SavedArgs.emplace_back(std::move(args));
-	}
+auto DetourCallContext::TopFrame() noexcept -> CallFrame*
+{
+	const ThreadFrames* frames = FindThreadFrames(m_Id, false);
+	return frames && frames->Depth ? frames->Frames[frames->Depth - 1].get() : nullptr;
+}
+
+void DetourCallContext::PopFrame() noexcept
+{
+	if (ThreadFrames* frames = FindThreadFrames(m_Id, false); frames && frames->Depth)
+		--frames->Depth;
+}
+
+
+void DetourCallContext::LoadArgs(CallFrame& frame, const std::byte* frame_data) const noexcept
+{
+	auto& args = frame.m_PassArgs;
+	for (size_t i = 0; i < args.size(); i++)
+		memcpy(args.m_CurData[i].data(), frame_data + m_ArgOffsets[i], args.m_CurData[i].size());
+}
+
+void DetourCallContext::StoreArgs(const CallFrame& frame, std::byte* frame_data) const noexcept
+{
+	const auto& args = frame.m_PassArgs;
+	for (size_t i = 0; i < args.size(); i++)
+		memcpy(frame_data + m_ArgOffsets[i], args.m_CurData[i].data(), args.m_CurData[i].size());
+}
+
+void DetourCallContext::LoadReturn(CallFrame& frame, const std::byte* frame_data) const noexcept
+{
+	if (m_RetSize)
+		memcpy(frame.m_PassRet.m_CurData.data(), frame_data + m_RetOffset, m_RetSize);
+}
+
+void DetourCallContext::StoreReturn(const CallFrame& frame, std::byte* frame_data) const noexcept
+{
+	if (m_RetSize)
+		memcpy(frame_data + m_RetOffset, frame.m_PassRet.m_CurData.data(), m_RetSize);
 }
 
-void DetourCallContext::PopArgs()
+
+void DetourCallContext::WriteChangedArgs(CallFrame& frame)
 {
-	if (m_PassArgs.size())
+	auto& args = frame.m_PassArgs;
+	const size_t size = args.size();
+	for (size_t i = 0; i < size; i++)
 	{
-		auto& args = m_SavedArgs.back();
-		size_t cur_offset = 0;
-		for (auto& arg : m_PassArgs.m_CurData)
+		if (args.has_changed(i))
 		{
-			memcpy_s(arg.data(), arg.size(), args.get() + cur_offset, m_PassArgs.m_SizeInMem);
-			cur_offset += arg.size();
-		}
-
-		m_SavedArgs.pop_back();
+			const auto& to = args.m_CurData[i], & from = args.m_NewData[i];
+			memcpy(to.data(), from.data(), from.size());
+		};
 	}
 }
 
-void DetourCallContext::PushReturn()
+void DetourCallContext::WriteChangedReturn(CallFrame& frame)
 {
-	auto& ret_p = m_PassRet.m_CurData;
+	auto& ret = frame.m_PassRet;
+	if (!ret.has_changed() && !ret.is_void())
+		return;
+
+	auto& to = ret.m_CurData, & from = ret.m_NewData;
+	memcpy(to.data(), from.data(), from.size());
+}
+
+void DetourCallContext::SaveReturn(CallFrame& frame) const noexcept
+{
+	auto& ret_p = frame.m_PassRet.m_CurData;
 	if (!ret_p.is_void())
-	{
-		const size_t size = ret_p.size();
-		auto ret(std::make_unique<px::PassRet::data_arr>(size));
-		memcpy_s(ret.get(), size, ret_p.data(), size);
-		m_SavedRets.emplace_back(std::move(ret));
-	}
+		memcpy(frame.m_FrameData + m_SavedRetOffset, ret_p.data(), ret_p.size());
 }
 
-void DetourCallContext::PopReturn()
+void DetourCallContext::RestoreReturn(CallFrame& frame) const noexcept
 {
-	auto& ret_p = m_PassRet.m_CurData;
+	auto& ret_p = frame.m_PassRet.m_CurData;
 	if (!ret_p.is_void())
-	{
-		const size_t size = ret_p.size();
-		auto& ret = m_SavedRets.back();
-		memcpy_s(ret_p.data(), size, ret.get(), size);
-		m_SavedRets.pop_back();
-	}
+		memcpy(ret_p.data(), frame.m_FrameData + m_SavedRetOffset, ret_p.size());
+}
+
+void* DetourCallContext::GetStackPointer(const CallFrame& frame) const noexcept
+{
+	void* stack_ptr;
+	memcpy(&stack_ptr, frame.m_FrameData + m_StackPointerOffset, sizeof(void*));
+	return stack_ptr;
 }
 
-void DetourCallContext::ResetState()
+void DetourCallContext::ResetState(CallFrame& frame)
 {
-	m_PassRet.m_Changed = false;
-	for (size_t i = 0; i < m_PassArgs.size(); i++)
-		m_PassArgs.m_ArgInfo[i].Changed = false;
+	frame.m_PassRet.m_Changed = false;
+	for (size_t i = 0; i < frame.m_PassArgs.size(); i++)
+		frame.m_PassArgs.m_ArgInfo[i].Changed = false;
 }
 
 
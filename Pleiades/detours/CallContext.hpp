@@ -1,8 +1,10 @@
 #pragma once
 
-#include <stack>
+#include <memory>
+#include <vector>
 #include <asmjit/asmjit.h>
 #include <px/interfaces/HookArgs.hpp>
+#include <px/interfaces/HooksManager.hpp>
 
 #include "SigBuilder.hpp"
 
@@ -12,73 +14,137 @@ public:
 	struct InitToken
 	{
 		asmjit::FuncSignatureBuilder FuncSig;
-		px::PassRet	RetData;
-		px::PassArgs ArgsData;
+		size_t RetSize;
+		// size and constness of each arg, including the |this| pointer
+		std::vector<std::pair<size_t, bool>> ArgsInfo;
+		bool HasThisPtr;
 	};
 
-	DetourCallContext(InitToken&& token) noexcept;
-
 	/// <summary>
-	/// Read/Write args from/to compiler in detoured function
+	/// State of a single call to the detoured function
+	/// every thread entering the detour, and every recursive call on the same thread, gets its own frame
 	/// </summary>
-	void ManageArgs(const detour_detail::TypeInfo& typeInfo, asmjit::x86::Compiler& comp, bool read_from_compiler);
+	struct CallFrame
+	{
+		explicit CallFrame(const DetourCallContext& context);
 
-	/// <summary>
-	/// Check for any changed args and write them to 'm_PassArgs.m_CurData'
-	/// </summary>
-	void WriteChangedArgs();
+		px::PassRet	m_PassRet;
+		px::PassArgs m_PassArgs;
+
+		px::MHookRes m_LastResults;
+		// stub's frame data of the call, holds the args, the return value, the saved return value and the stack pointer
+		std::byte* m_FrameData{ };
+	};
+
+	DetourCallContext(InitToken&& token);
 
 	/// <summary>
-	/// Check for if we changed the return and write them to 'PassRet.m_CurData'
+	/// Read/Write args from/to compiler in detoured function
 	/// </summary>
-	void WriteChangedReturn();
+	/// <param name="frame_data">stub's stack memory of 'frame_data_size()' bytes, args are stored at 'arg_offset()'</param>
+	void ManageArgs(const detour_detail::TypeInfo& typeInfo, asmjit::x86::Compiler& comp, const asmjit::x86::Mem& frame_data, bool read_from_compiler);
 
 	/// <summary>
 	/// (Return in register)
 	/// Read/Write return from/to compiler in the detoured function
 	/// </summary>
-	void ManageReturn(asmjit::x86::Compiler& comp, bool read_from_compiler, const asmjit::BaseReg& reg0, const asmjit::BaseReg& reg1);
+	void ManageReturn(asmjit::x86::Compiler& comp, const asmjit::x86::Mem& frame_data, bool read_from_compiler, const asmjit::BaseReg& reg0, const asmjit::BaseReg& reg1);
 
 	/// <summary>
 	/// (Return in stack)
 	/// Read/Write return from/to compiler in the detoured function
 	/// </summary>
-	void ManageReturnInMem(asmjit::x86::Compiler& comp, bool read_from_compiler, const asmjit::BaseReg& outreg);
+	void ManageReturnInMem(asmjit::x86::Compiler& comp, const asmjit::x86::Mem& frame_data, bool read_from_compiler, const asmjit::BaseReg& outreg);
 
 	/// <summary>
-	/// Save current argss to 'm_PassArgs'
+	/// Get a frame for a new call on the current thread, frames are allocated once per thread and per call depth
 	/// </summary>
-	void PushArgs();
-	
+	/// <param name="frame_data">stub's stack memory of the call, see 'frame_data_size()'</param>
+	[[nodiscard]] CallFrame& PushFrame(std::byte* frame_data);
+
 	/// <summary>
-	/// load args from 'm_PassArgs' and pop it
+	/// Get the current thread's innermost frame
 	/// </summary>
-	void PopArgs();
+	/// <returns>the frame, null if the current thread isn't inside the detour</returns>
+	[[nodiscard]] CallFrame* TopFrame() noexcept;
 
 	/// <summary>
-	/// Save current return value to 'm_SavedRets'
+	/// Release the current thread's innermost frame
 	/// </summary>
-	void PushReturn();
-	
+	void PopFrame() noexcept;
+
+	/// <summary>
+	/// Copy args from the stub's frame data to 'frame'
+	/// </summary>
+	void LoadArgs(CallFrame& frame, const std::byte* frame_data) const noexcept;
+
 	/// <summary>
-	/// Load current return value from 'm_SavedRets' and pop it
+	/// Copy args from 'frame' to the stub's frame data
 	/// </summary>
-	void PopReturn();
+	void StoreArgs(const CallFrame& frame, std::byte* frame_data) const noexcept;
+
+	/// <summary>
+	/// Copy the return value from the stub's frame data to 'frame'
+	/// </summary>
+	void LoadReturn(CallFrame& frame, const std::byte* frame_data) const noexcept;
+
+	/// <summary>
+	/// Copy the return value from 'frame' to the stub's frame data
+	/// </summary>
+	void StoreReturn(const CallFrame& frame, std::byte* frame_data) const noexcept;
+
+	/// <summary>
+	/// Check for any changed args and write them to 'm_PassArgs.m_CurData'
+	/// </summary>
+	static void WriteChangedArgs(CallFrame& frame);
+
+	/// <summary>
+	/// Check for if we changed the return and write them to 'PassRet.m_CurData'
+	/// </summary>
+	static void WriteChangedReturn(CallFrame& frame);
+
+	/// <summary>
+	/// Save current return value to the frame data, at 'saved_ret_offset()'
+	/// </summary>
+	void SaveReturn(CallFrame& frame) const noexcept;
+
+	/// <summary>
+	/// Load current return value from the frame data, at 'saved_ret_offset()'
+	/// </summary>
+	void RestoreReturn(CallFrame& frame) const noexcept;
+
+	/// <summary>
+	/// Get the caller's stack pointer stored by the stub in the frame data
+	/// </summary>
+	[[nodiscard]] void* GetStackPointer(const CallFrame& frame) const noexcept;
 
 	/// <summary>
 	/// Set 'PassRet.m_Changed' and 'PassArgs.m_ArgInfo[].m_Changed' to false
 	/// </summary>
-	void ResetState();
+	static void ResetState(CallFrame& frame);
+
+	/// <summary>
+	/// Size of the stub's frame data, a stack allocation aligned to 16 bytes
+	/// </summary>
+	[[nodiscard]] size_t frame_data_size() const noexcept { return m_StackPointerOffset + sizeof(void*); }
+
+	[[nodiscard]] size_t arg_offset(size_t pos) const noexcept { return m_ArgOffsets[pos]; }
+	[[nodiscard]] size_t ret_offset() const noexcept { return m_RetOffset; }
+	[[nodiscard]] size_t saved_ret_offset() const noexcept { return m_SavedRetOffset; }
+	[[nodiscard]] size_t stack_pointer_offset() const noexcept { return m_StackPointerOffset; }
 
 public:
 	asmjit::FuncSignatureBuilder	m_FuncSig;
 
-	px::PassRet	m_PassRet;
-	px::PassArgs m_PassArgs;
-
 private:
-	std::vector<
-		std::unique_ptr<px::PassArgs::data_arr>
-	> m_SavedRets,
-	  m_SavedArgs;
+	std::vector<std::pair<size_t, bool>> m_ArgsInfo;
+	std::vector<size_t> m_ArgOffsets;
+	size_t m_RetSize;
+	size_t m_RetOffset{ };
+	size_t m_SavedRetOffset{ };
+	size_t m_StackPointerOffset{ };
+	bool m_HasThisPtr;
+
+	// key of the context in each thread's frames, never reused unlike the context's address
+	uint64_t m_Id;
 };
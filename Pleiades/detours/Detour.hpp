@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <vector>
 #include <px/defines.hpp>
 
 #define WIN32_LEAN_AND_MEAN
@@ -8,9 +10,73 @@
 
 namespace detour_detail
 {
+	class Detour;
+
+	/// <summary>
+	/// Attach and detach detours of the current thread in a single transaction
+	/// while a batch is open, 'Detour::attach' and 'Detour::detach' are queued and applied together on 'Commit'
+	/// threads are suspended once for the whole batch instead of once per detour
+	/// </summary>
+	class DetourBatch
+	{
+	public:
+		struct Result
+		{
+			const Detour* Target;
+			bool Attach;
+			LONG Error;
+		};
+
+		/// <summary>
+		/// Open a batch, batches can be nested, only the outermost one is committed
+		/// </summary>
+		static void Begin() noexcept
+		{
+			++s_Depth;
+		}
+
+		[[nodiscard]] static bool IsActive() noexcept
+		{
+			return s_Depth != 0;
+		}
+
+		/// <summary>
+		/// Close the current batch, and apply every queued operation if it's the outermost one
+		/// operations rejected by detours are dropped and the rest is still applied
+		/// </summary>
+		/// <returns>every failed operation</returns>
+		static std::vector<Result> Commit();
+
+	private:
+		friend class Detour;
+
+		struct Operation
+		{
+			Detour* Target;
+			bool Attach;
+		};
+
+		static void Queue(Detour* target, bool attach)
+		{
+			// an attach followed by a detach of the same detour cancel each other
+			// this way a detour released before the batch is committed is never referenced afterward
+			auto iter = std::find_if(
+				s_Operations.begin(), s_Operations.end(),
+				[target] (const Operation& op) { return op.Target == target; }
+			);
+			if (iter != s_Operations.end() && iter->Attach != attach)
+				s_Operations.erase(iter);
+			else s_Operations.emplace_back(target, attach);
+		}
+
+		static inline thread_local size_t s_Depth{ };
+		static inline thread_local std::vector<Operation> s_Operations;
+	};
+
 
 	class Detour
 	{
+		friend class DetourBatch;
 	public:
 		using address_type = void*;
 		static constexpr LONG ERROR_SET_OR_UNSET_TOO_LATE = 0x4860139;
@@ -29,6 +95,9 @@ namespace detour_detail
 				this->m_Callback = callback;
 				this->m_ActualFunc = addr;
 
+				if (DetourBatch::IsActive())
+					return queue(true);
+
 				DetourTransactionBegin();
 				DetourUpdateThread(GetCurrentThread());
 				DetourAttach(&m_ActualFunc, m_Callback);
@@ -46,6 +115,9 @@ namespace detour_detail
 
 			if (!m_IsSet)
 			{
+				if (DetourBatch::IsActive())
+					return queue(true);
+
 				DetourTransactionBegin();
 				DetourUpdateThread(GetCurrentThread());
 				DetourAttach(&m_ActualFunc, m_Callback);
@@ -63,6 +135,9 @@ namespace detour_detail
 
 			if (m_IsSet)
 			{
+				if (DetourBatch::IsActive())
+					return queue(false);
+
 				DetourTransactionBegin();
 				DetourUpdateThread(GetCurrentThread());
 				DetourDetach(&m_ActualFunc, m_Callback);
@@ -73,6 +148,18 @@ namespace detour_detail
 			return err;
 		}
 
+		/// <summary>
+		/// Set the function and the callback without patching the function, the callback is reached some other way, eg: through a vtable's slot
+		/// </summary>
+		void bind(address_type addr, address_type callback) noexcept
+		{
+			if (!m_IsSet)
+			{
+				this->m_Callback = callback;
+				this->m_ActualFunc = addr;
+			}
+		}
+
 		[[nodiscard]] bool is_set() const noexcept { return m_IsSet; }
 
 		[[nodiscard]] void* original_function() const noexcept { return m_ActualFunc; }
@@ -97,8 +184,84 @@ namespace detour_detail
 		}
 
 	private:
+		/// <summary>
+		/// Queue the operation in the current batch, the detour is considered set/unset until the batch is committed
+		/// </summary>
+		LONG queue(bool attach) noexcept
+		{
+			try
+			{
+				DetourBatch::Queue(this, attach);
+			}
+			catch (const std::bad_alloc&)
+			{
+				return ERROR_NOT_ENOUGH_MEMORY;
+			}
+
+			m_IsSet = attach;
+			return ERROR_SUCCESS;
+		}
+
 		address_type m_Callback{ };
 		address_type m_ActualFunc{ };
 		bool  m_IsSet = false;
 	};
+
+
+	inline auto DetourBatch::Commit() -> std::vector<Result>
+	{
+		std::vector<Result> failed;
+		if (!s_Depth || --s_Depth)
+			return failed;
+
+		std::vector<Operation> operations = std::move(s_Operations);
+		s_Operations.clear();
+
+		// a single rejected operation aborts the whole transaction, and every operation after it fails with the same error
+		// so drop the first rejected operation and retry until detours accepts all of them
+		while (!operations.empty())
+		{
+			DetourTransactionBegin();
+			DetourUpdateThread(GetCurrentThread());
+
+			auto rejected = operations.end();
+			LONG err = ERROR_SUCCESS;
+			for (auto iter = operations.begin(); iter != operations.end(); iter++)
+			{
+				Detour* detour = iter->Target;
+				err = iter->Attach ?
+					DetourAttach(&detour->m_ActualFunc, detour->m_Callback) :
+					DetourDetach(&detour->m_ActualFunc, detour->m_Callback);
+
+				if (err != ERROR_SUCCESS)
+				{
+					rejected = iter;
+					break;
+				}
+			}
+
+			if (rejected == operations.end())
+			{
+				err = DetourTransactionCommit();
+				if (err == ERROR_SUCCESS)
+					break;
+
+				// failed to apply the transaction itself, every operation failed
+				for (const Operation& op : operations)
+				{
+					op.Target->m_IsSet = !op.Attach;
+					failed.emplace_back(op.Target, op.Attach, err);
+				}
+				break;
+			}
+
+			DetourTransactionAbort();
+
+			rejected->Target->m_IsSet = !rejected->Attach;
+			failed.emplace_back(rejected->Target, rejected->Attach, err);
+			operations.erase(rejected);
+		}
+
+		return failed;
+	}
 }
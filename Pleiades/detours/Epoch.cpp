@@ -0,0 +1,169 @@
+#include <atomic>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Epoch.hpp"
+
+namespace detour_detail
+{
+	struct ThreadRecord
+	{
+		// epoch the thread entered at, 0 if the thread isn't reading
+		std::atomic<uint64_t> Epoch;
+		std::atomic<bool> InUse;
+		// number of nested guards, only touched by the owning thread
+		uint32_t Depth{ };
+	};
+
+	struct RetiredObject
+	{
+		void* Ptr;
+		void(*Deleter)(void*);
+		uint64_t Epoch;
+	};
+
+	static std::atomic<uint64_t> s_GlobalEpoch{ 1 };
+
+	static std::mutex s_Lock;
+	// records are never freed, records of exited threads are reused by new threads
+	static std::list<ThreadRecord> s_Records;
+	static std::vector<RetiredObject> s_Retired;
+
+
+	/// <summary>
+	/// Owns the current thread's record, and releases it once the thread exits
+	/// </summary>
+	class ThreadRecordHandle
+	{
+	public:
+		ThreadRecordHandle()
+		{
+			std::scoped_lock lock(s_Lock);
+			for (ThreadRecord& record : s_Records)
+			{
+				if (!record.InUse.load(std::memory_order_relaxed))
+				{
+					m_Record = &record;
+					break;
+				}
+			}
+
+			if (!m_Record)
+				m_Record = &s_Records.emplace_back();
+
+			m_Record->Epoch.store(0, std::memory_order_relaxed);
+			m_Record->InUse.store(true, std::memory_order_relaxed);
+			m_Record->Depth = 0;
+		}
+
+		~ThreadRecordHandle()
+		{
+			std::scoped_lock lock(s_Lock);
+			m_Record->Epoch.store(0, std::memory_order_relaxed);
+			m_Record->InUse.store(false, std::memory_order_relaxed);
+		}
+
+		ThreadRecord* operator->() const noexcept { return m_Record; }
+
+	private:
+		ThreadRecord* m_Record{ };
+	};
+
+	static thread_local ThreadRecordHandle t_Record;
+
+
+	void Epoch::Enter() noexcept
+	{
+		ThreadRecord* record = t_Record.operator->();
+		if (!record->Depth++)
+			record->Epoch.store(s_GlobalEpoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+	}
+
+	void Epoch::Leave() noexcept
+	{
+		ThreadRecord* record = t_Record.operator->();
+		if (!--record->Depth)
+			record->Epoch.store(0, std::memory_order_release);
+	}
+
+	void Epoch::Retire(void* ptr, void(*deleter)(void*))
+	{
+		{
+			std::scoped_lock lock(s_Lock);
+			// readers that entered before this point may still hold 'ptr', readers entering after can't see it anymore
+			s_Retired.emplace_back(ptr, deleter, s_GlobalEpoch.fetch_add(1, std::memory_order_seq_cst));
+		}
+
+		Reclaim();
+	}
+
+	bool Epoch::Synchronize(std::chrono::steady_clock::time_point deadline)
+	{
+		// readers entering after this point get a newer epoch
+		const uint64_t epoch = s_GlobalEpoch.fetch_add(1, std::memory_order_seq_cst);
+		const ThreadRecord* self = t_Record.operator->();
+
+		using namespace std::chrono_literals;
+		while (true)
+		{
+			bool busy = false;
+			{
+				std::scoped_lock lock(s_Lock);
+				for (const ThreadRecord& record : s_Records)
+				{
+					if (&record == self)
+						continue;
+
+					if (const uint64_t record_epoch = record.Epoch.load(std::memory_order_seq_cst); record_epoch && record_epoch <= epoch)
+					{
+						busy = true;
+						break;
+					}
+				}
+			}
+
+			if (!busy)
+				break;
+
+			if (std::chrono::steady_clock::now() >= deadline)
+				return false;
+			std::this_thread::sleep_for(1ms);
+		}
+
+		Reclaim();
+		return true;
+	}
+
+	void Epoch::Reclaim()
+	{
+		std::vector<RetiredObject> reclaimed;
+		{
+			std::scoped_lock lock(s_Lock);
+
+			uint64_t oldest = std::numeric_limits<uint64_t>::max();
+			for (const ThreadRecord& record : s_Records)
+			{
+				if (const uint64_t epoch = record.Epoch.load(std::memory_order_seq_cst); epoch && epoch < oldest)
+					oldest = epoch;
+			}
+
+			std::erase_if(
+				s_Retired,
+				[oldest, &reclaimed] (const RetiredObject& obj)
+				{
+					if (obj.Epoch >= oldest)
+						return false;
+					reclaimed.emplace_back(obj);
+					return true;
+				}
+			);
+		}
+
+		// deleters may retire objects themselves, call them outside of the lock
+		for (const RetiredObject& obj : reclaimed)
+			obj.Deleter(obj.Ptr);
+	}
+}
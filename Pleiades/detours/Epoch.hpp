@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace detour_detail
+{
+	/// <summary>
+	/// Epoch based reclamation for data read without locks, eg: hooks' callback lists
+	/// readers stay inside an 'EpochGuard' while they use the data, writers publish a new copy then 'Retire' the old one
+	/// a retired object is deleted once every thread that could still be reading it left its guard
+	/// </summary>
+	class Epoch
+	{
+	public:
+		/// <summary>
+		/// Mark the current thread as reading, guards can be nested
+		/// </summary>
+		static void Enter() noexcept;
+
+		/// <summary>
+		/// Leave the current thread's innermost guard
+		/// </summary>
+		static void Leave() noexcept;
+
+		/// <summary>
+		/// Delete an object once no thread can be reading it anymore, must be called after the object was unpublished
+		/// </summary>
+		template<typename _Ty>
+		static void Retire(const _Ty* ptr)
+		{
+			if (ptr)
+				Retire(const_cast<_Ty*>(ptr), [] (void* obj) { delete static_cast<_Ty*>(obj); });
+		}
+
+		/// <summary>
+		/// Wait until every other thread left the guards it entered before the call
+		/// once it returns, no thread is using data unpublished before the call, eg: a removed callback
+		/// </summary>
+		/// <returns>false if a thread is still inside its guard at 'deadline'</returns>
+		static bool Synchronize(std::chrono::steady_clock::time_point deadline);
+
+	private:
+		static void Retire(void* ptr, void(*deleter)(void*));
+
+		/// <summary>
+		/// Delete every retired object that no thread can be reading anymore
+		/// </summary>
+		static void Reclaim();
+	};
+
+	class EpochGuard
+	{
+	public:
+		EpochGuard() noexcept { Epoch::Enter(); }
+		~EpochGuard() noexcept { Epoch::Leave(); }
+
+		EpochGuard(const EpochGuard&) = delete;
+		EpochGuard& operator=(const EpochGuard&) = delete;
+	};
+}
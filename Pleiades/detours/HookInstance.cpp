@@ -1,56 +1,358 @@
+#include <thread>
 #include <nlohmann/json.hpp>
 
 #include "HookInstance.hpp"
 #include "SigBuilder.hpp"
+#include "Epoch.hpp"
+#include "HooksManager.hpp"
 
 #include "library/Manager.hpp"
 #include "logs/Logger.hpp"
 
-HookInstance::HookInstance(px::IntPtr original_function, const nlohmann::json& data, std::string& out_err) :
-	m_AddressInMemory(original_function)
+HookInstance::HookInstance(px::IntPtr original_function, const nlohmann::json& data, std::string& out_err, void** vtable_slot) :
+	m_AddressInMemory(original_function),
+	m_DetourInfo(std::make_unique<nlohmann::json>(data))
 {
-	detour_detail::SigBuilder sig(data, out_err);
-	if (out_err.empty())
+	const SharedStub* shared_stub = px::detour_manager.GetSharedStub(data, out_err);
+	if (!shared_stub)
+		return;
+
+	m_CallContext = shared_stub->Context;
+	m_BaseDispatch = shared_stub->Stub.Code;
+	m_StatsIndex = detour_detail::HookStats::Register(std::format("{}", original_function.get()));
+
+	// the thunk starts by jumping to its entry, set it before the function is detoured
+	m_DispatchFunction.store(m_BaseDispatch, std::memory_order_relaxed);
+	m_EntryFunction.store(m_BaseDispatch, std::memory_order_release);
+
+	const StubCode callback = AllocThunk(out_err);
+	if (!callback.Code)
+		return;
+
+	if (vtable_slot)
 	{
-		void* callback = AllocCallbackHandler(sig, out_err);
-		if (!callback)
-			return;
+		// the stub still calls the original function through the detour
+		m_Detour.bind(original_function.get(), callback.Code);
+		m_VTableSlot = vtable_slot;
+		std::atomic_ref(*m_VTableSlot).store(callback.Code, std::memory_order_release);
+	}
+	else if (const LONG res = m_Detour.attach(original_function.get(), callback.Code); res)
+	{
+		px::lib_manager.GetRuntime()->release(callback.Code);
+		std::format_to(std::back_inserter(out_err), "Failed to detour the function (Code: {})", res);
+		return;
+	}
+
+	m_Stubs.emplace_back(callback);
+}
+
+HookInstance::~HookInstance() noexcept
+{
+	this->ClearCallbacks();
+	detour_detail::HookStats::Unregister(m_StatsIndex);
+}
+
+void HookInstance::ClearCallbacks() noexcept
+{
+	std::lock_guard lock(m_CallbacksLock);
+	PublishCallbacks(false, nullptr);
+	PublishCallbacks(true, nullptr);
+
+	m_CallbackIds.clear();
+
+	// the first stub has no inline callbacks
+	m_InlineCallbacks.clear();
+	m_CallbackFlags.fetch_and(static_cast<uint8_t>(~HasInlineCallbacks), std::memory_order_release);
+	m_DispatchFunction.store(m_BaseDispatch, std::memory_order_release);
+
+	m_NativeCallback = nullptr;
+	UpdateEntry();
+}
+
+bool HookInstance::CheckSignature(const asmjit::FuncSignature& signature, std::string& out_err) const
+{
+	using namespace asmjit;
+
+	const FuncSignature& detour_sig = m_CallContext->m_FuncSig;
+	// both signatures are deabstracted the same way 'SigBuilder' does it for ints
+	const auto deabstract = [] (TypeId type)
+	{
+		return TypeUtils::deabstract(type, TypeUtils::deabstractDeltaOfSize(sizeof(void*)));
+	};
+
+	// callconvs are all the same in x64, and the native callback is always called with the host's
+	if constexpr (sizeof(void*) == 4)
+	{
+		// |this| is passed in ecx, see 'TypedHook'
+		if (detour_sig.callConvId() == CallConvId::kThisCall)
+		{
+			out_err = "'ThisCall' detours can't have native nor inline callbacks on x86, declare the detour as 'FastCall' with |this| and a dummy argument for edx first.";
+			return false;
+		}
 
-		if (const LONG res = m_Detour.attach(original_function.get(), callback); res)
+		if (detour_sig.callConvId() != signature.callConvId())
 		{
-			if (callback)
-				px::lib_manager.GetRuntime()->release(callback);
+			out_err = "Callback's calling convention doesn't match the detour's calling convention.";
+			return false;
+		}
+	}
+
+	if (detour_sig.hasVarArgs())
+	{
+		out_err = "Variadic functions can't have native callbacks.";
+		return false;
+	}
 
-			std::format_to(std::back_inserter(out_err), "Failed to detour the function (Code: {})", res);
+	if (deabstract(detour_sig.ret()) != deabstract(signature.ret()))
+	{
+		out_err = "Callback's return type doesn't match the detour's return type.";
+		return false;
+	}
+
+	if (detour_sig.argCount() != signature.argCount())
+	{
+		std::format_to(
+			std::back_inserter(out_err),
+			"Callback has {} argument(s), the detour has {}.",
+			signature.argCount(),
+			detour_sig.argCount()
+		);
+		return false;
+	}
+
+	for (uint32_t i = 0; i < detour_sig.argCount(); i++)
+	{
+		if (deabstract(detour_sig.arg(i)) != deabstract(signature.arg(i)))
+		{
+			std::format_to(std::back_inserter(out_err), "Callback's argument #{} doesn't match the detour's argument.", i);
+			return false;
 		}
 	}
+
+	return true;
 }
 
-void HookInstance::ClearCallbacks() noexcept
+bool HookInstance::SetNativeCallback(void* callback, const asmjit::FuncSignature& signature, std::string& out_err)
+{
+	if (!CheckSignature(signature, out_err))
+		return false;
+
+	std::lock_guard lock(m_CallbacksLock);
+	if (m_NativeCallback)
+	{
+		out_err = "Detour already has a native callback.";
+		return false;
+	}
+
+	const StubCode entry = AllocNativeEntry(callback, out_err);
+	if (!entry.Code)
+		return false;
+
+	m_Stubs.emplace_back(entry);
+	m_NativeEntry = entry;
+	m_NativeCallback = callback;
+	UpdateEntry();
+	return true;
+}
+
+void HookInstance::ClearNativeCallback() noexcept
+{
+	std::lock_guard lock(m_CallbacksLock);
+	m_NativeCallback = nullptr;
+	UpdateEntry();
+}
+
+void HookInstance::UpdateEntry() noexcept
+{
+	m_EntryFunction.store(
+		m_NativeCallback ? m_NativeEntry.Code : m_DispatchFunction.load(std::memory_order_relaxed),
+		std::memory_order_release
+	);
+}
+
+
+px::IHookInstance::HookID HookInstance::AddInlineCallback(px::HookOrder order, void* callback, const asmjit::FuncSignature& signature, std::string& out_err)
+{
+	using namespace asmjit;
+
+	if (!CheckSignature(signature, out_err))
+		return InvalidId;
+
+	std::lock_guard lock(m_CallbacksLock);
+	if (m_InlineCallbacks.size() >= MaxInlineCallbacks)
+	{
+		std::format_to(std::back_inserter(out_err), "Detour already has {} inline callbacks.", MaxInlineCallbacks);
+		return InvalidId;
+	}
+
+	const IHookInstance::HookID id = m_CallbackIds.insert(order, CallbackKind::Inline);
+	if (id == InvalidId)
+	{
+		out_err = "Detour has too many callbacks.";
+		return InvalidId;
+	}
+
+	FuncSignatureBuilder inline_sig(signature.callConvId());
+	inline_sig.setRetT<uint32_t>();
+	for (uint32_t i = 0; i < signature.argCount(); i++)
+		inline_sig.addArg(signature.arg(i));
+
+	auto pos = std::upper_bound(
+		m_InlineCallbacks.begin(), m_InlineCallbacks.end(), order,
+		[] (px::HookOrder order, const InlineHookInfo& o) { return order < o.Order; }
+	);
+	pos = m_InlineCallbacks.emplace(pos, callback, inline_sig, order, id);
+
+	if (!RebuildStub(out_err))
+	{
+		m_InlineCallbacks.erase(pos);
+		m_CallbackIds.erase(id);
+		return InvalidId;
+	}
+
+	return id;
+}
+
+void HookInstance::RemoveInlineCallback(HookID id)
+{
+	std::lock_guard lock(m_CallbacksLock);
+
+	const CallbackSlot* slot = m_CallbackIds.find(id);
+	if (!slot || slot->Kind != CallbackKind::Inline)
+		return;
+
+	const auto iter = std::find_if(
+		m_InlineCallbacks.begin(), m_InlineCallbacks.end(),
+		[id] (const InlineHookInfo& o) { return o.Id == id; }
+	);
+	m_InlineCallbacks.erase(iter);
+	m_CallbackIds.erase(id);
+
+	if (std::string err; !RebuildStub(err))
+	{
+		// fall back to the first stub, a removed callback must never run again
+		m_InlineCallbacks.clear();
+		RebuildStub(err);
+
+		PX_LOG_ERROR(
+			PX_MESSAGE("Failed to recompile the detour's stub, inline callbacks were cleared."),
+			PX_LOGARG("Error", err)
+		);
+	}
+}
+
+bool HookInstance::RebuildStub(std::string& out_err)
+{
+	void* dispatch = m_BaseDispatch;
+	if (!m_InlineCallbacks.empty())
+	{
+		detour_detail::SigBuilder sig(*m_DetourInfo, out_err);
+		if (!out_err.empty())
+			return false;
+
+		auto calls_in_flight = std::make_unique<std::atomic<uint32_t>>();
+		const StubCode stub = AllocCallbackHandler(sig, m_CallContext, m_InlineCallbacks, calls_in_flight.get(), out_err);
+		if (!stub.Code)
+			return false;
+
+		m_Stubs.emplace_back(stub);
+		m_InlineStubs.emplace_back(stub, std::move(calls_in_flight));
+		dispatch = stub.Code;
+	}
+
+	m_DispatchFunction.store(dispatch, std::memory_order_release);
+	if (m_InlineCallbacks.empty())
+		m_CallbackFlags.fetch_and(static_cast<uint8_t>(~HasInlineCallbacks), std::memory_order_release);
+	else
+		m_CallbackFlags.fetch_or(HasInlineCallbacks, std::memory_order_release);
+
+	UpdateEntry();
+	return true;
+}
+
+void HookInstance::CollectRetiredStubs(std::vector<StubCode>& stubs, std::vector<const std::atomic<uint32_t>*>& calls_in_flight)
 {
 	std::lock_guard lock(m_CallbacksLock);
-	m_PreCallbacks.clear();
-	m_PostCallbacks.clear();
+
+	if (m_NativeEntry.Code && !m_NativeCallback)
+	{
+		stubs.push_back(m_NativeEntry);
+		calls_in_flight.push_back(&m_NativeCallsInFlight);
+	}
+
+	const void* dispatch = m_DispatchFunction.load(std::memory_order_relaxed);
+	for (const InlineStub& inline_stub : m_InlineStubs)
+	{
+		if (inline_stub.Stub.Code == dispatch)
+			continue;
+
+		stubs.push_back(inline_stub.Stub);
+		calls_in_flight.push_back(inline_stub.CallsInFlight.get());
+	}
+}
+
+void HookInstance::ReleaseStubs() noexcept
+{
+	for (const StubCode& stub : m_Stubs)
+		px::lib_manager.GetRuntime()->release(stub.Code);
+	m_Stubs.clear();
+}
+
+bool HookInstance::WaitForCalls(std::chrono::steady_clock::time_point deadline) const
+{
+	using namespace std::chrono_literals;
+	// a native callback may still call the dispatch thunk, wait for it as well
+	while (GetCallsInFlight() || GetNativeCallsInFlight())
+	{
+		if (std::chrono::steady_clock::now() >= deadline)
+			return false;
+		std::this_thread::sleep_for(1ms);
+	}
+	return true;
+}
+
+void HookInstance::PublishCallbacks(bool post, const CallbackList* callbacks) noexcept
+{
+	auto& list = post ? m_PostCallbacks : m_PreCallbacks;
+	const uint8_t flag = post ? HasPostCallbacks : HasPreCallbacks;
+
+	// publish the list before the stub can see the flag
+	if (callbacks)
+	{
+		const CallbackList* old_list = list.exchange(callbacks, std::memory_order_acq_rel);
+		m_CallbackFlags.fetch_or(flag, std::memory_order_release);
+		detour_detail::Epoch::Retire(old_list);
+	}
+	else
+	{
+		m_CallbackFlags.fetch_and(static_cast<uint8_t>(~flag), std::memory_order_release);
+		// threads still running the old list keep it alive until they leave their guard
+		detour_detail::Epoch::Retire(list.exchange(nullptr, std::memory_order_acq_rel));
+	}
 }
 
 void HookInstance::Activate()
 {
 	void* callback = m_Detour.callback_function();
 	assert(!m_Detour.is_set() && callback);
-	if (callback)
-	{
-		m_Detour.attach();
-	}
+	if (!callback)
+		return;
+
+	if (m_VTableSlot)
+		std::atomic_ref(*m_VTableSlot).store(callback, std::memory_order_release);
+	else m_Detour.attach();
 }
 
 void HookInstance::Deactivate()
 {
 	void* callback = m_Detour.callback_function();
-	assert(m_Detour.is_set() && callback);
+	assert((m_VTableSlot || m_Detour.is_set()) && callback);
 	if (callback)
 	{
 		this->ClearCallbacks();
-		m_Detour.detach();
+		if (m_VTableSlot)
+			std::atomic_ref(*m_VTableSlot).store(m_Detour.original_function(), std::memory_order_release);
+		else m_Detour.detach();
 	}
 	
 }
@@ -60,120 +362,129 @@ void* HookInstance::GetRuntimeCallback()
 	return m_Detour.callback_function();
 }
 
-void* HookInstance::AllocCallbackHandler(detour_detail::SigBuilder& sigbuilder, std::string& out_err)
+StubCode HookInstance::AllocThunk(std::string& out_err)
 {
 	using namespace asmjit;
 
 	CodeHolder code;
 	code.init(px::lib_manager.GetRuntime()->environment());
 
-	x86::Compiler comp(&code);
-	comp.mov(x86::Mem(uint64_t(this) + offsetof(HookInstance, m_StackPointer)), x86::esp);
+	x86::Assembler assembler(&code);
+	const x86::Gp& instance = detour_detail::StubCompiler::InstanceRegister(assembler.is32Bit());
+	const Label L_Dispatch = assembler.newLabel();
 
-	detour_detail::TypeInfo typeInfo;
-	m_CallContext = sigbuilder.load_args(comp, typeInfo);
+	assembler.mov(instance, reinterpret_cast<uintptr_t>(this));
+	assembler.jmp(x86::ptr(instance, offsetof(HookInstance, m_EntryFunction), assembler.registerSize()));
 
-	x86::Gp should_call_func = comp.newInt8();
-	const Label L_PostCode = comp.newLabel();
+	assembler.bind(L_Dispatch);
+	assembler.mov(instance, reinterpret_cast<uintptr_t>(this));
+	assembler.jmp(x86::ptr(instance, offsetof(HookInstance, m_DispatchFunction), assembler.registerSize()));
 
-	DataInfo info{
-		.typeInfo = typeInfo,
-		.Compiler = comp
-	};
+	void* fn;
+	if (const auto err = px::lib_manager.GetRuntime()->add(&fn, &code))
+	{
+		std::format_to(std::back_inserter(out_err), "Failed to add the thunk to JIT runtime (Code: {})", err);
+		return { };
+	}
 
-	if (!ValidateRegisters(info, out_err))
-		return nullptr;
+	m_DispatchThunk = static_cast<std::byte*>(fn) + code.labelOffsetFromBase(L_Dispatch);
+	return { fn, code.codeSize() };
+}
+
+StubCode HookInstance::AllocNativeEntry(void* callback, std::string& out_err)
+{
+	using namespace asmjit;
 
-	this->InvokeCallbacks(info, false, should_call_func);
-	comp.cmp(should_call_func, 1);
+	detour_detail::SigBuilder sigbuilder(*m_DetourInfo, out_err);
+	if (!out_err.empty())
+		return { };
 
-	comp.jnz(L_PostCode);
+	CodeHolder code;
+	code.init(px::lib_manager.GetRuntime()->environment());
 
-	this->InvokeOriginal(info);
+	x86::Compiler comp(&code);
 
-	this->ReadReturn(info);
+	FuncNode* pFunc = sigbuilder.add_func(comp);
+	detour_detail::TypeInfo typeInfo;
+	static_cast<void>(sigbuilder.load_args(comp, pFunc, typeInfo));
 
-	comp.bind(L_PostCode);
+	const x86::Gp counter = comp.newIntPtr();
+	comp.mov(counter, reinterpret_cast<uintptr_t>(&m_NativeCallsInFlight));
+	comp.lock().inc(x86::dword_ptr(counter));
 
-	this->InvokeCallbacks(info, true, should_call_func);
+	InvokeNode* pCall;
+	comp.invoke(&pCall, reinterpret_cast<uintptr_t>(callback), m_CallContext->m_FuncSig);
+	detour_detail::StubCompiler::SetCallArgs(typeInfo, pCall);
 
-	this->WriteReturn(info);
+	// a return value in memory is written by the callback, which returns the pointer it was passed
+	const BaseReg ret0 = typeInfo.has_ret() ? typeInfo.ret() : BaseReg{ };
+	const BaseReg ret1 = typeInfo.has_regx2() ? typeInfo.ret(true) : BaseReg{ };
+	if (ret0.isValid())
+		pCall->setRet(0, ret0);
+	if (ret1.isValid())
+		pCall->setRet(1, ret1);
+
+	comp.lock().dec(x86::dword_ptr(counter));
+
+	if (ret0.isValid())
+		comp.addRet(ret0, ret1.isValid() ? ret1 : Operand{ });
 
 	comp.endFunc();
 	if (const auto err = comp.finalize())
 	{
 		std::format_to(std::back_inserter(out_err), "Failed to finalize the x86::Compiler (Code: {})", err);
-		return nullptr;
+		return { };
 	}
 
 	void* fn;
 	if (const auto err = px::lib_manager.GetRuntime()->add(&fn, &code))
 	{
-		std::format_to(std::back_inserter(out_err), "Failed to add the function to JIT runtime (Code: {})", err);
-		return nullptr;
+		std::format_to(std::back_inserter(out_err), "Failed to add the native entry to JIT runtime (Code: {})", err);
+		return { };
 	}
 
-	return fn;
+	return { fn, code.codeSize() };
 }
 
-bool HookInstance::ValidateRegisters(DataInfo info, std::string& out_err)
+StubCode HookInstance::AllocCallbackHandler(
+	detour_detail::SigBuilder& sigbuilder,
+	std::shared_ptr<DetourCallContext>& context,
+	std::span<const InlineHookInfo> inline_callbacks,
+	std::atomic<uint32_t>* inline_calls,
+	std::string& out_err
+)
 {
-	const auto& comp = info.Compiler;
-	const auto& typeInfo = info.typeInfo;
-
-	if (typeInfo.has_ret())
-	{
-		if (!comp.isVirtRegValid(typeInfo.ret()))
+	const detour_detail::StubCompiler compiler(
+		*px::lib_manager.GetRuntime(),
 		{
-			out_err = "Invalid return value register id";
-			return false;
+			.Flags = offsetof(HookInstance, m_CallbackFlags),
+			.ActualFunc = offsetof(HookInstance, m_Detour) + detour_detail::Detour::offset_to_m_ActualFunc(),
+			.CallsInFlight = offsetof(HookInstance, m_CallsInFlight),
+			.StatsIndex = offsetof(HookInstance, m_StatsIndex),
+			.Handler = &HookInstance::InvokeHandler
 		}
+	);
 
-		if (typeInfo.has_regx2())
-		{
-			if (!comp.isVirtRegValid(typeInfo.ret(true)))
-			{
-				out_err = "Invalid return value register id (2nd register)";
-				return false;
-			}
-		}
-	}
-
-	if (typeInfo.has_this_ptr())
-	{
-		if (!comp.isVirtRegValid(typeInfo.this_()))
-		{
-			out_err = "Invalid |this| pointer register id";
-			return false;
-		}
-	}
-
-	for (auto& arg : typeInfo.args_iterator())
-	{
-		if (!comp.isVirtRegValid(arg.Reg) || (arg.ExtraReg.isValid() && !comp.isVirtRegValid(arg.ExtraReg)))
-		{
-			out_err = "Invalid arg register id";
-			return false;
-		}
-	}
-	return true;
+	return compiler.Compile(sigbuilder, context, inline_callbacks, inline_calls, out_err);
 }
 
-bool HookInstance::RunHandler(bool is_post)
+uint8_t HookInstance::RunHandler(bool is_post, std::byte* frame_data)
 {
-	m_CallContext->ResetState();
 	using px::MHookRes;
 	using px::HookRes;
 
-	const auto handle_callbacks = [is_post, this] ()
+	const auto handle_callbacks = [is_post, this] (DetourCallContext::CallFrame& frame)
 	{
-		std::lock_guard lock(m_CallbacksLock);
+		detour_detail::EpochGuard guard;
 
 		MHookRes highest;
-		auto& sets = is_post ? m_PostCallbacks : m_PreCallbacks;
-		for (auto& hook : sets)
+		const CallbackList* callbacks = (is_post ? m_PostCallbacks : m_PreCallbacks).load(std::memory_order_acquire);
+		if (!callbacks)
+			return highest;
+
+		for (auto& hook : *callbacks)
 		{
-			MHookRes cur = hook.Callback(&m_CallContext->m_PassRet, &m_CallContext->m_PassArgs);
+			MHookRes cur = hook.Callback(&frame.m_PassRet, &frame.m_PassArgs);
 			if (!highest.test(cur))
 			{
 				highest |= cur;
@@ -187,34 +498,43 @@ bool HookInstance::RunHandler(bool is_post)
 	// 2
 	if (is_post)
 	{
-		const MHookRes last = m_LastResults.top();
+		DetourCallContext::CallFrame& frame = *m_CallContext->TopFrame();
+		DetourCallContext::ResetState(frame);
+
+		const MHookRes last = frame.m_LastResults;
 
+		// args are still the ones passed to the original function, only the return value was written since
+		m_CallContext->LoadReturn(frame, frame_data);
 		if (last.test(HookRes::ChangedReturn))
-			m_CallContext->PopReturn();
-		m_CallContext->PopArgs();
+			m_CallContext->RestoreReturn(frame);
 
 		// call post hooks
 		if (!last.test(HookRes::SkipPost))
 		{
-			const MHookRes res = handle_callbacks();
+			const MHookRes res = handle_callbacks(frame);
 
 			// did we change any return value?
 			if (!res.test(HookRes::Ignored) && res.test(HookRes::ChangedReturn))
 			{
 				// was 'HookRes::IgnorePostReturn' flag set? if not then change return value
 				if (!last.test(HookRes::IgnorePostReturn) || !last.test(HookRes::ChangedReturn))
-					m_CallContext->WriteChangedReturn();
+					DetourCallContext::WriteChangedReturn(frame);
 			}
 		}
 
-		m_LastResults.pop();
-		return true;
+		m_CallContext->StoreReturn(frame, frame_data);
+		m_CallContext->PopFrame();
+		return RunPost;
 	}
 	// 1 
 	else
 	{
-		const MHookRes res = handle_callbacks();
-		m_LastResults.push(res);
+		DetourCallContext::CallFrame& frame = m_CallContext->PushFrame(frame_data);
+		DetourCallContext::ResetState(frame);
+		m_CallContext->LoadArgs(frame, frame_data);
+
+		const MHookRes res = handle_callbacks(frame);
+		frame.m_LastResults = res;
 		bool do_call = true;
 
 		// check if we should ignore anything
@@ -222,151 +542,83 @@ bool HookInstance::RunHandler(bool is_post)
 		{
 			// check if we changed any params
 			if (res.test(HookRes::ChangedParams))
-				m_CallContext->WriteChangedArgs();
+				DetourCallContext::WriteChangedArgs(frame);
 
 			// check if we changed any return value
 			if (res.test(HookRes::ChangedReturn))
 			{
-				m_CallContext->WriteChangedReturn();
-				m_CallContext->PushReturn();
+				DetourCallContext::WriteChangedReturn(frame);
+				m_CallContext->SaveReturn(frame);
 			}
 			do_call = !res.test(HookRes::DontCall);
 		}
 
-		m_CallContext->PushArgs();
-
-		return do_call;
-	}
-}
-
-
-void HookInstance::InvokeCallbacks(DataInfo info, bool post, const asmjit::x86::Gp& ret)
-{
-	using namespace asmjit;
-	const auto handler_fn = &HookInstance::RunHandler;
-
-	// we don't want to reload args two times, we will just do once it in pre hooks
-	if (!post)
-		m_CallContext->ManageArgs(info.typeInfo, info.Compiler, true);
-
-	InvokeNode* pFunc;
-	info.Compiler.invoke(&pFunc, std::bit_cast<void*>(handler_fn), FuncSignatureT<bool, HookInstance*, bool>(CallConvId::kThisCall));
-
-	pFunc->setArg(0, this);
-	pFunc->setArg(1, post);
-	pFunc->setRet(0, ret);
+		m_CallContext->StoreArgs(frame, frame_data);
+		m_CallContext->StoreReturn(frame, frame_data);
 
-	if (!post)
-		m_CallContext->ManageArgs(info.typeInfo, info.Compiler, false);
-}
-
-
-void HookInstance::InvokeOriginal(DataInfo info)
-{
-	using namespace asmjit;
-
-	InvokeNode* pFunc;
-	info.Compiler.invoke(&pFunc, x86::Mem(uint64_t(this) + offsetof(HookInstance, m_Detour) + detour_detail::Detour::offset_to_m_ActualFunc()), m_CallContext->m_FuncSig);
-
-	{
-		size_t arg_pos = 0;
-		// first check if it's thiscall, then set it as first arg
-		if (info.typeInfo.has_this_ptr())
-		{
-			pFunc->setArg(arg_pos++, info.typeInfo.this_());
-		}
-		// second check if it's return on the stack, then set it as (first/second) arg
-		if (info.typeInfo.has_ret_mem())
+		// post hooks must still run to return the changed return value or skip the call,
+		// otherwise there is nothing left to do for this call once the original function returns
+		const bool has_post = !res.test(HookRes::SkipPost) && m_PostCallbacks.load(std::memory_order_acquire);
+		if (do_call && !res.test(HookRes::ChangedReturn) && !has_post)
 		{
-			pFunc->setArg(arg_pos++, info.typeInfo.ret_mem());
+			m_CallContext->PopFrame();
+			return CallOriginal;
 		}
-		// third set rest of args, and keep checking if it's a int64_t type to set second param on 'setArg'
-		for (auto& arg : info.typeInfo.args_iterator())
-		{
-			pFunc->setArg(arg_pos, arg.Reg);
-			if (arg.ExtraReg.isValid())
-				pFunc->setArg(arg_pos, 1, arg.ExtraReg);
-			++arg_pos;
-		}
-	}
 
-	// if it contains a return, grab it
-	if (info.typeInfo.has_ret())
-	{
-		const BaseReg& ret0 = info.typeInfo.ret();
-		pFunc->setRet(0, ret0);
-
-		const BaseReg& ret1 = info.typeInfo.has_regx2() ? info.typeInfo.ret(true) : BaseReg{ };
-		if (ret1.isValid())
-			pFunc->setRet(1, ret1);
+		return do_call ? CallOriginal | RunPost : RunPost;
 	}
 }
 
 
-void HookInstance::ReadReturn(DataInfo info)
+px::IHookInstance::HookID HookInstance::AddCallback(bool post, px::HookOrder order, const CallbackType& callback)
 {
-	using namespace asmjit;
-
-	if (info.typeInfo.has_ret_mem())
-	{
-		m_CallContext->ManageReturnInMem(info.Compiler, true, info.typeInfo.ret_mem());
-	}
-	else if (info.typeInfo.has_ret())
-	{
-		const BaseReg& 
-			ret0 = info.typeInfo.ret(),
-			ret1 = info.typeInfo.has_regx2() ? info.typeInfo.ret(true) : BaseReg{ };
+	std::lock_guard lock(m_CallbacksLock);
 
-		m_CallContext->ManageReturn(info.Compiler, true, ret0, ret1);
-	}
-}
+	const IHookInstance::HookID id = m_CallbackIds.insert(order, post ? CallbackKind::Post : CallbackKind::Pre);
+	if (id == InvalidId)
+		return InvalidId;
 
-void HookInstance::WriteReturn(DataInfo info)
-{
-	using namespace asmjit;
+	const CallbackList* cur_list = (post ? m_PostCallbacks : m_PreCallbacks).load(std::memory_order_relaxed);
+	auto new_list = cur_list ? std::make_unique<CallbackList>(*cur_list) : std::make_unique<CallbackList>();
 
-	if (info.typeInfo.has_ret_mem())
-	{
-		const BaseReg ret = info.typeInfo.ret_mem();
-		m_CallContext->ManageReturnInMem(info.Compiler, false, ret);
-	}
-	else if (info.typeInfo.has_ret())
-	{
-		BaseReg
-			ret0 = info.typeInfo.ret(),
-			ret1 = info.typeInfo.ret(true);
+	// insert after every callback of the same order, same as the old multiset did
+	auto pos = std::upper_bound(
+		new_list->begin(), new_list->end(), order,
+		[] (px::HookOrder order, const HookInfo& o) { return order < o.Order; }
+	);
+	new_list->emplace(pos, callback, order, id);
 
-		m_CallContext->ManageReturn(info.Compiler, false, ret0, ret1);
-		info.Compiler.addRet(ret0, info.typeInfo.has_regx2() ? ret1 : Operand{ });
-	}
+	PublishCallbacks(post, new_list.release());
+	return id;
 }
 
-
-px::IHookInstance::HookID HookInstance::AddCallback(bool post, px::HookOrder order, const CallbackType& callback)
+void HookInstance::RemoveCallback(bool post, HookID id)
 {
-	auto& sets = post ? m_PostCallbacks : m_PreCallbacks;
+	std::lock_guard lock(m_CallbacksLock);
 
-	IHookInstance::HookID id = 0;
-	for (const auto& entry : sets)
-	{
-		if (id == entry.Id)
-			id = entry.Id + 1;
-	}
-	sets.emplace(callback, order, id);
+	const CallbackSlot* slot = m_CallbackIds.find(id);
+	if (!slot || slot->Kind != (post ? CallbackKind::Post : CallbackKind::Pre))
+		return;
 
-	return id;
-}
+	// the list is sorted by order, only look through the callbacks with the same order
+	const CallbackList* cur_list = (post ? m_PostCallbacks : m_PreCallbacks).load(std::memory_order_relaxed);
+	auto new_list = std::make_unique<CallbackList>(*cur_list);
 
-void HookInstance::RemoveCallback(bool post, HookID id)
-{
-	auto& sets = post ? m_PostCallbacks : m_PreCallbacks;
-	std::erase_if(sets, [id] (const HookInfo& o) { return o == id; });
+	auto iter = std::lower_bound(
+		new_list->begin(), new_list->end(), slot->Order,
+		[] (const HookInfo& o, px::HookOrder order) { return o.Order < order; }
+	);
+	new_list->erase(std::find(iter, new_list->end(), id));
+	m_CallbackIds.erase(id);
+
+	PublishCallbacks(post, new_list->empty() ? nullptr : new_list.release());
 }
 
 
 px::MHookRes HookInstance::GetLastResults() noexcept
 {
-	return this->m_LastResults.size() ? this->m_LastResults.top() : px::MHookRes{ };
+	const DetourCallContext::CallFrame* frame = m_CallContext->TopFrame();
+	return frame ? frame->m_LastResults : px::MHookRes{ };
 }
 
 void* HookInstance::GetFunction() noexcept
@@ -376,5 +628,6 @@ void* HookInstance::GetFunction() noexcept
 
 void* HookInstance::GetStackPointer() noexcept
 {
-	return m_StackPointer;
+	const DetourCallContext::CallFrame* frame = m_CallContext->TopFrame();
+	return frame ? m_CallContext->GetStackPointer(*frame) : nullptr;
 }
@@ -1,7 +1,10 @@
 #pragma once
 
-#include <set>
+#include <atomic>
+#include <chrono>
 #include <mutex>
+#include <span>
+#include <vector>
 #include <nlohmann/json_fwd.hpp>
 
 #include <px/interfaces/HooksManager.hpp>
@@ -9,6 +12,9 @@
 
 #include "Detour.hpp"
 #include "CallContext.hpp"
+#include "HookStats.hpp"
+#include "StubCompiler.hpp"
+#include "library/SlotMap.hpp"
 
 
 struct HookInfo
@@ -21,11 +27,23 @@ struct HookInfo
 	bool operator==(const px::IHookInstance::HookID& o) const noexcept { return Id == o; }
 };
 
+/// <summary>
+/// Stub shared by every hook with the same signature, the hook's thunk passes the hook instance in 'detour_detail::StubCompiler::InstanceRegister()'
+/// </summary>
+struct SharedStub
+{
+	std::shared_ptr<DetourCallContext> Context;
+	StubCode Stub;
+};
+
 class HookInstance : public px::IHookInstance
 {
 public:
-	HookInstance(px::IntPtr original_function, const nlohmann::json& data, std::string& out_err);
-	~HookInstance() noexcept {}
+	/// <summary>
+	/// Detour 'original_function', or if 'vtable_slot' is set, point that slot to the hook instead, see 'VTableHook'
+	/// </summary>
+	HookInstance(px::IntPtr original_function, const nlohmann::json& data, std::string& out_err, void** vtable_slot = nullptr);
+	~HookInstance() noexcept;
 
 	void ClearCallbacks() noexcept;
 
@@ -34,6 +52,85 @@ public:
 
 	void* GetRuntimeCallback();
 
+	[[nodiscard]] const detour_detail::Detour& GetDetour() const noexcept { return m_Detour; }
+
+	/// <summary>
+	/// Set a callback the stub jumps to with the function's native args, instead of running the hook's callbacks
+	/// the callback calls 'GetDispatchFunction()' to run the rest of the callbacks and the original function
+	/// the callback is called through the hook's native entry, which counts the calls running it
+	/// </summary>
+	/// <param name="signature">callback's signature, must match the detour's signature</param>
+	[[nodiscard]] bool SetNativeCallback(void* callback, const asmjit::FuncSignature& signature, std::string& out_err);
+
+	void ClearNativeCallback() noexcept;
+
+	/// <summary>
+	/// Get the stub's entry after the native callback, calling it runs the callbacks then the original function
+	/// </summary>
+	[[nodiscard]] void* GetDispatchFunction() const noexcept { return m_DispatchThunk; }
+
+	/// <summary>
+	/// Add a callback compiled directly into the stub, the stub is regenerated with every inline callback in 'HookOrder'
+	/// </summary>
+	/// <param name="signature">detour's signature, the callback itself returns 'InlineHookRes' bits</param>
+	/// <returns>id of the callback, 'InvalidId' if the signatures doesn't match or the stub failed to compile</returns>
+	[[nodiscard]] HookID AddInlineCallback(px::HookOrder order, void* callback, const asmjit::FuncSignature& signature, std::string& out_err);
+
+	void RemoveInlineCallback(HookID id);
+
+	/// <summary>
+	/// Release every stub allocated for the hook, the hook must be detached and no thread may be running them
+	/// </summary>
+	void ReleaseStubs() noexcept;
+
+	/// <summary>
+	/// Every stub allocated for the hook, including the thunk
+	/// </summary>
+	[[nodiscard]] std::span<const StubCode> GetStubs() const noexcept { return m_Stubs; }
+
+	/// <summary>
+	/// Number of calls that went past the stub's bypass and didn't return yet
+	/// </summary>
+	[[nodiscard]] uint32_t GetCallsInFlight() const noexcept { return m_CallsInFlight.load(std::memory_order_acquire); }
+
+	/// <summary>
+	/// Wait until every call inside the hook's stubs returned, the hook must be detached so no new call can enter
+	/// </summary>
+	/// <returns>false if calls are still in flight at 'deadline'</returns>
+	[[nodiscard]] bool WaitForCalls(std::chrono::steady_clock::time_point deadline) const;
+
+	/// <summary>
+	/// Number of calls inside the native callback, counted by its entry, see 'SetNativeCallback'
+	/// </summary>
+	[[nodiscard]] uint32_t GetNativeCallsInFlight() const noexcept { return m_NativeCallsInFlight.load(std::memory_order_acquire); }
+
+	/// <summary>
+	/// Append the stubs that called callbacks removed since, the native entry once its callback was cleared and the stubs replaced by 'RebuildStub'
+	/// and the counters of calls inside those callbacks, a thread may still be running them until both are empty
+	/// </summary>
+	void CollectRetiredStubs(std::vector<StubCode>& stubs, std::vector<const std::atomic<uint32_t>*>& calls_in_flight);
+
+	/// <summary>
+	/// Index of the hook's counters, see 'detour_detail::HookStats'
+	/// </summary>
+	[[nodiscard]] uint32_t GetStatsIndex() const noexcept { return m_StatsIndex; }
+
+	// inline callbacks are for small and stable sets of callbacks, the rest goes through 'AddCallback'
+	static constexpr size_t MaxInlineCallbacks = 8;
+
+	/// <summary>
+	/// Compile a stub calling 'inline_callbacks' then the handler, see 'detour_detail::StubCompiler'
+	/// </summary>
+	/// <param name="context">context of the stub's signature, created by the stub if it's null</param>
+	/// <param name="inline_calls">incremented while the stub runs its inline callbacks, only used if it has any</param>
+	[[nodiscard]] static StubCode AllocCallbackHandler(
+		detour_detail::SigBuilder& sigbuilder,
+		std::shared_ptr<DetourCallContext>& context,
+		std::span<const InlineHookInfo> inline_callbacks,
+		std::atomic<uint32_t>* inline_calls,
+		std::string& out_err
+	);
+
 public:
 	// Inherited via IHookInstance
 	HookID AddCallback(bool post, px::HookOrder order, const CallbackType& callback) override;
@@ -50,31 +147,120 @@ public:
 	px::IntPtr m_AddressInMemory;
 
 private:
-	struct DataInfo
+	// see 'detour_detail::StubCompiler'
+	using enum detour_detail::CallbackFlags;
+	using enum detour_detail::HandlerFlags;
+
+	/// <summary>
+	/// Allocate the hook's thunk, its entry loads the instance then jumps to 'm_EntryFunction'
+	/// and its dispatch entry, at 'm_DispatchThunk', loads the instance then jumps to 'm_DispatchFunction'
+	/// </summary>
+	[[nodiscard]] StubCode AllocThunk(std::string& out_err);
+
+	/// <summary>
+	/// Compile the native callback's entry, it increments 'm_NativeCallsInFlight', calls the callback with the args it was called with
+	/// then decrements it before returning the callback's return value
+	/// </summary>
+	[[nodiscard]] StubCode AllocNativeEntry(void* callback, std::string& out_err);
+
+	/// <summary>
+	/// Compile a new stub for the current inline callbacks and use it as the dispatch function, 'm_CallbacksLock' must be held
+	/// </summary>
+	[[nodiscard]] bool RebuildStub(std::string& out_err);
+
+	/// <summary>
+	/// Point the stub's entry to the native callback's entry or to the dispatch function, 'm_CallbacksLock' must be held
+	/// </summary>
+	void UpdateEntry() noexcept;
+
+	/// <summary>
+	/// Check that a callback's signature matches the detour's signature
+	/// </summary>
+	[[nodiscard]] bool CheckSignature(const asmjit::FuncSignature& signature, std::string& out_err) const;
+
+	[[nodiscard]] uint8_t RunHandler(bool is_post, std::byte* frame_data);
+
+	/// <summary>
+	/// Entry of 'RunHandler' called by the stub, a plain function so the call doesn't depend on the ABI of member function pointers
+	/// </summary>
+	[[nodiscard]] static uint8_t InvokeHandler(void* instance, bool is_post, std::byte* frame_data)
 	{
-		const detour_detail::TypeInfo& typeInfo;
-		asmjit::x86::Compiler& Compiler;
-	};
+		return static_cast<HookInstance*>(instance)->RunHandler(is_post, frame_data);
+	}
+
+	using CallbackList = std::vector<HookInfo>;
+
+	/// <summary>
+	/// Publish a new callback list and retire the old one, 'm_CallbacksLock' must be held
+	/// </summary>
+	void PublishCallbacks(bool post, const CallbackList* callbacks) noexcept;
 
-	[[nodiscard]] void* AllocCallbackHandler(detour_detail::SigBuilder& sigbuilder, std::string& out_err);
+	// shared by every hook with the same signature
+	std::shared_ptr<DetourCallContext> m_CallContext;
 
-	[[nodiscard]] bool ValidateRegisters(DataInfo comp, std::string& out_err);
-	[[nodiscard]] bool RunHandler(bool is_post);
+	// immutable lists sorted by 'HookInfo::Order', read without locks by 'RunHandler' inside an 'EpochGuard'
+	// writers copy the current list, modify it, then swap it, see 'detour_detail::Epoch'
+	std::atomic<const CallbackList*>
+		m_PreCallbacks{ },
+		m_PostCallbacks{ };
+	// 'CallbackFlags', read by the stub before anything else
+	std::atomic<uint8_t> m_CallbackFlags{ };
+	// incremented by the stub past its bypass, decremented right before it returns
+	std::atomic<uint32_t> m_CallsInFlight{ };
+	// incremented by the native entry before calling the native callback, decremented once it returned
+	std::atomic<uint32_t> m_NativeCallsInFlight{ };
+	// read by the stub when the stats are enabled
+	uint32_t m_StatsIndex{ detour_detail::HookStats::InvalidIndex };
 
-	void InvokeCallbacks(DataInfo info, bool post, const asmjit::x86::Gp& ret);
-	void InvokeOriginal(DataInfo info);
+	// the thunk jumps to 'm_EntryFunction', either the native callback's entry or 'm_DispatchFunction'
+	std::atomic<void*> m_EntryFunction{ };
+	// either the shared stub, or the hook's own stub if it has inline callbacks
+	std::atomic<void*> m_DispatchFunction{ };
+	// stub shared with every hook of the same signature, compiled without inline callbacks
+	void* m_BaseDispatch{ };
+	void* m_DispatchThunk{ };
+	void* m_NativeCallback{ };
+	// also kept in 'm_Stubs'
+	StubCode m_NativeEntry;
 
-	void ReadReturn(DataInfo info);
-	void WriteReturn(DataInfo info);
+	// sorted by 'InlineHookInfo::Order', compiled into the stub of 'm_DispatchFunction'
+	std::vector<InlineHookInfo> m_InlineCallbacks;
+
+	struct InlineStub
+	{
+		StubCode Stub;
+		// calls inside the stub's inline callbacks, the stub only holds its address
+		std::unique_ptr<std::atomic<uint32_t>> CallsInFlight;
+	};
+	// every stub compiled with inline callbacks, also kept in 'm_Stubs'
+	std::vector<InlineStub> m_InlineStubs;
+	// the hook's own code, the first one is the thunk, the detour's callback
+	// replaced stubs are kept alive, threads may still be running them
+	std::vector<StubCode> m_Stubs;
+	// detour's entry, to recompile the stub
+	std::unique_ptr<nlohmann::json> m_DetourInfo;
+
+	enum class CallbackKind : uint8_t
+	{
+		Pre,
+		Post,
+		Inline
+	};
+
+	struct CallbackSlot
+	{
+		px::HookOrder Order;
+		CallbackKind Kind;
+	};
 
-	std::unique_ptr<DetourCallContext> m_CallContext;
-	std::multiset<HookInfo>
-		m_PreCallbacks,
-		m_PostCallbacks;
+	// id of every callback, pre, post and inline callbacks share the same ids, 'm_CallbacksLock' must be held
+	library_detail::SlotMap<CallbackSlot> m_CallbackIds;
 
-	void* m_StackPointer{ };
+	// serialize writers
 	std::mutex m_CallbacksLock;
 
-	std::stack<px::MHookRes>	m_LastResults;
+	// bound but never attached if the hook is reached through a vtable's slot
 	detour_detail::Detour m_Detour;
+	// slot pointing to the thunk while the hook is active, null for detoured functions
+	void** m_VTableSlot{ };
 };
@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <bit>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include "HookStats.hpp"
+
+namespace detour_detail
+{
+	/// <summary>
+	/// A hook's counters for a single thread, only written by the owning thread
+	/// counters are atomics so 'Collect' can read them, but they are written with plain loads and stores
+	/// </summary>
+	struct alignas(std::hardware_destructive_interference_size) HookCounters
+	{
+		std::atomic<uint64_t> Hits;
+		std::atomic<uint64_t> Skips;
+		std::atomic<int64_t> Times[3];
+		std::atomic<uint32_t> Histogram[HookStats::BucketCount];
+	};
+
+	static constexpr uint32_t ChunkSize = 64;
+	static constexpr uint32_t ChunkCount = HookStats::MaxHooks / ChunkSize;
+
+	struct ThreadSlab
+	{
+		// allocated by the owning thread when it first calls a hook of the chunk, never freed
+		std::atomic<HookCounters*> Chunks[ChunkCount];
+		std::atomic<bool> InUse;
+	};
+
+	static std::mutex s_Lock;
+	// slabs are never freed, slabs of exited threads are reused by new threads so their counts are kept
+	static std::list<ThreadSlab> s_Slabs;
+	// by hook index, empty once the hook is unregistered
+	static std::vector<std::optional<std::string>> s_Names;
+	// indices of unregistered hooks, reused by 'Register'
+	static std::vector<uint32_t> s_FreeIndices;
+
+
+	/// <summary>
+	/// Owns the current thread's slab, and releases it once the thread exits
+	/// </summary>
+	class ThreadSlabHandle
+	{
+	public:
+		ThreadSlabHandle()
+		{
+			std::scoped_lock lock(s_Lock);
+			for (ThreadSlab& slab : s_Slabs)
+			{
+				if (!slab.InUse.load(std::memory_order_relaxed))
+				{
+					m_Slab = &slab;
+					break;
+				}
+			}
+
+			if (!m_Slab)
+				m_Slab = &s_Slabs.emplace_back();
+			m_Slab->InUse.store(true, std::memory_order_relaxed);
+		}
+
+		~ThreadSlabHandle()
+		{
+			std::scoped_lock lock(s_Lock);
+			m_Slab->InUse.store(false, std::memory_order_relaxed);
+		}
+
+		/// <summary>
+		/// Get the current thread's counters of a hook
+		/// </summary>
+		/// <returns>the counters, null if they couldn't be allocated</returns>
+		HookCounters* Get(uint32_t index) noexcept
+		{
+			std::atomic<HookCounters*>& chunk = m_Slab->Chunks[index / ChunkSize];
+			HookCounters* counters = chunk.load(std::memory_order_relaxed);
+			if (!counters)
+			{
+				counters = new (std::nothrow) HookCounters[ChunkSize]{ };
+				if (!counters)
+					return nullptr;
+				chunk.store(counters, std::memory_order_release);
+			}
+			return &counters[index % ChunkSize];
+		}
+
+	private:
+		ThreadSlab* m_Slab{ };
+	};
+
+	static thread_local ThreadSlabHandle t_Slab;
+
+
+	template<typename _Ty, typename _ValTy>
+	static void Increment(std::atomic<_Ty>& counter, _ValTy value) noexcept
+	{
+		// only the owning thread writes, no need for a locked add
+		counter.store(counter.load(std::memory_order_relaxed) + static_cast<_Ty>(value), std::memory_order_relaxed);
+	}
+
+	static void ResetCounters(HookCounters& counters) noexcept
+	{
+		counters.Hits.store(0, std::memory_order_relaxed);
+		counters.Skips.store(0, std::memory_order_relaxed);
+		for (auto& time : counters.Times)
+			time.store(0, std::memory_order_relaxed);
+		for (auto& bucket : counters.Histogram)
+			bucket.store(0, std::memory_order_relaxed);
+	}
+
+
+	uint32_t HookStats::BucketOf(uint64_t ns) noexcept
+	{
+		if (ns < SubBuckets)
+			return static_cast<uint32_t>(ns);
+
+		const uint32_t exponent = static_cast<uint32_t>(std::bit_width(ns)) - 1;
+		const uint32_t sub_bucket = static_cast<uint32_t>(ns >> (exponent - SubBucketBits)) & (SubBuckets - 1);
+		return std::min(((exponent - SubBucketBits + 1) << SubBucketBits) + sub_bucket, BucketCount - 1);
+	}
+
+	uint64_t HookStats::BucketLowerBound(uint32_t bucket) noexcept
+	{
+		if (bucket < SubBuckets)
+			return bucket;
+
+		const uint32_t exponent = (bucket >> SubBucketBits) + SubBucketBits - 1;
+		const uint64_t sub_bucket = bucket & (SubBuckets - 1);
+		return (SubBuckets + sub_bucket) << (exponent - SubBucketBits);
+	}
+
+	auto HookStats::Snapshot::Percentile(double ratio) const noexcept -> std::chrono::nanoseconds
+	{
+		uint64_t total = 0;
+		for (uint64_t count : Histogram)
+			total += count;
+		if (!total)
+			return { };
+
+		const uint64_t target = std::max<uint64_t>(static_cast<uint64_t>(ratio * total), 1);
+		uint64_t seen = 0;
+		for (uint32_t i = 0; i < BucketCount; i++)
+		{
+			seen += Histogram[i];
+			if (seen >= target)
+				return std::chrono::nanoseconds(BucketLowerBound(i));
+		}
+		return std::chrono::nanoseconds(BucketLowerBound(BucketCount - 1));
+	}
+
+
+	uint32_t HookStats::Register(std::string name)
+	{
+		std::scoped_lock lock(s_Lock);
+		if (!s_FreeIndices.empty())
+		{
+			const uint32_t index = s_FreeIndices.back();
+			s_FreeIndices.pop_back();
+			s_Names[index] = std::move(name);
+			return index;
+		}
+
+		if (s_Names.size() >= MaxHooks)
+			return InvalidIndex;
+
+		s_Names.emplace_back(std::move(name));
+		return static_cast<uint32_t>(s_Names.size() - 1);
+	}
+
+	void HookStats::Unregister(uint32_t index) noexcept
+	{
+		std::scoped_lock lock(s_Lock);
+		if (index >= s_Names.size() || !s_Names[index])
+			return;
+
+		// the next hook of the index starts from zero, the hook's calls are over so no thread is writing them
+		for (ThreadSlab& slab : s_Slabs)
+		{
+			if (HookCounters* chunk = slab.Chunks[index / ChunkSize].load(std::memory_order_acquire))
+				ResetCounters(chunk[index % ChunkSize]);
+		}
+
+		s_Names[index].reset();
+		s_FreeIndices.push_back(index);
+	}
+
+	void HookStats::SetName(uint32_t index, std::string name)
+	{
+		std::scoped_lock lock(s_Lock);
+		if (index < s_Names.size() && s_Names[index])
+			s_Names[index] = std::move(name);
+	}
+
+	auto HookStats::Collect() -> std::vector<Snapshot>
+	{
+		std::scoped_lock lock(s_Lock);
+
+		std::vector<Snapshot> snapshots(s_Names.size());
+		for (const ThreadSlab& slab : s_Slabs)
+		{
+			for (uint32_t i = 0; i < snapshots.size(); i++)
+			{
+				if (!s_Names[i])
+					continue;
+
+				const HookCounters* chunk = slab.Chunks[i / ChunkSize].load(std::memory_order_acquire);
+				if (!chunk)
+				{
+					// skip the rest of the chunk, 'i' isn't its first index if unregistered hooks were skipped
+					i = (i / ChunkSize + 1) * ChunkSize - 1;
+					continue;
+				}
+
+				const HookCounters& counters = chunk[i % ChunkSize];
+				Snapshot& snapshot = snapshots[i];
+
+				snapshot.Hits += counters.Hits.load(std::memory_order_relaxed);
+				snapshot.Skips += counters.Skips.load(std::memory_order_relaxed);
+				snapshot.PreTime += std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::duration(counters.Times[static_cast<uint32_t>(Time::Pre)].load(std::memory_order_relaxed)));
+				snapshot.PostTime += std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::duration(counters.Times[static_cast<uint32_t>(Time::Post)].load(std::memory_order_relaxed)));
+				snapshot.OriginalTime += std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::duration(counters.Times[static_cast<uint32_t>(Time::Original)].load(std::memory_order_relaxed)));
+				for (uint32_t bucket = 0; bucket < BucketCount; bucket++)
+					snapshot.Histogram[bucket] += counters.Histogram[bucket].load(std::memory_order_relaxed);
+			}
+		}
+
+		for (uint32_t i = 0; i < snapshots.size(); i++)
+		{
+			if (s_Names[i])
+				snapshots[i].Name = *s_Names[i];
+		}
+
+		std::erase_if(snapshots, [] (const Snapshot& snapshot) { return !snapshot.Hits; });
+		return snapshots;
+	}
+
+	void HookStats::Reset() noexcept
+	{
+		std::scoped_lock lock(s_Lock);
+		for (ThreadSlab& slab : s_Slabs)
+		{
+			for (std::atomic<HookCounters*>& chunk : slab.Chunks)
+			{
+				HookCounters* counters = chunk.load(std::memory_order_acquire);
+				if (!counters)
+					continue;
+
+				for (uint32_t i = 0; i < ChunkSize; i++)
+					ResetCounters(counters[i]);
+			}
+		}
+	}
+
+
+	void HookStats::Enter(CallData* data) noexcept
+	{
+		data->Active = 1;
+		data->Enter = data->Mark = clock_type::now().time_since_epoch().count();
+	}
+
+	void HookStats::Record(uint32_t index, CallData* data, Time time) noexcept
+	{
+		const clock_type::rep now = clock_type::now().time_since_epoch().count();
+		if (time == Time::Original)
+			data->CalledOriginal = 1;
+
+		if (index != InvalidIndex)
+		{
+			if (HookCounters* counters = t_Slab.Get(index))
+				Increment(counters->Times[static_cast<uint32_t>(time)], now - data->Mark);
+		}
+		data->Mark = now;
+	}
+
+	void HookStats::Leave(uint32_t index, CallData* data) noexcept
+	{
+		if (index == InvalidIndex)
+			return;
+
+		HookCounters* counters = t_Slab.Get(index);
+		if (!counters)
+			return;
+
+		const auto latency = clock_type::now() - clock_type::time_point(clock_type::duration(data->Enter));
+
+		Increment(counters->Hits, 1);
+		if (!data->CalledOriginal)
+			Increment(counters->Skips, 1);
+		Increment(counters->Histogram[BucketOf(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count())], 1);
+	}
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace detour_detail
+{
+	/// <summary>
+	/// Call statistics of every hook, collected by the hooks' stubs while enabled
+	/// each thread counts in its own slab, without locks nor shared cache lines, and the slabs are only summed up by 'Collect'
+	/// while disabled, the stubs only check a flag on entry and skip everything else
+	/// </summary>
+	class HookStats
+	{
+	public:
+		using clock_type = std::chrono::steady_clock;
+
+		// latencies are bucketed by powers of two, each split in 'SubBuckets' linear buckets, eg: [8ns, 10ns), [10ns, 12ns)...
+		static constexpr uint32_t SubBucketBits = 2;
+		static constexpr uint32_t SubBuckets = 1 << SubBucketBits;
+		// up to ~68s, longer calls are counted in the last bucket
+		static constexpr uint32_t BucketCount = (36 - SubBucketBits + 1) * SubBuckets;
+
+		// hooks past this index aren't counted
+		static constexpr uint32_t MaxHooks = 4096;
+		static constexpr uint32_t InvalidIndex = ~0u;
+
+		enum class Time : uint32_t
+		{
+			// inline and pre callbacks
+			Pre,
+			Post,
+			Original
+		};
+
+		/// <summary>
+		/// Stack memory of a single call in the stub
+		/// </summary>
+		struct CallData
+		{
+			// set if the stats are collected for the call, checked by the stub before calling anything
+			uint8_t Active;
+			// set once the original function was called, the call was skipped otherwise
+			uint8_t CalledOriginal;
+			clock_type::rep Enter;
+			clock_type::rep Mark;
+		};
+
+		/// <summary>
+		/// Sum of every thread's counters of a hook
+		/// </summary>
+		struct Snapshot
+		{
+			std::string Name;
+			uint64_t Hits{ };
+			uint64_t Skips{ };
+			std::chrono::nanoseconds PreTime{ }, PostTime{ }, OriginalTime{ };
+			// calls' latency, from the stub's entry to its return
+			std::array<uint64_t, BucketCount> Histogram{ };
+
+			/// <summary>
+			/// Latency below which 'ratio' of the calls are, the lower bound of the bucket it falls in
+			/// </summary>
+			[[nodiscard]] std::chrono::nanoseconds Percentile(double ratio) const noexcept;
+		};
+
+		[[nodiscard]] static bool IsEnabled() noexcept { return s_Enabled.load(std::memory_order_relaxed); }
+
+		static void Enable(bool enable) noexcept { s_Enabled.store(enable, std::memory_order_relaxed); }
+
+		/// <summary>
+		/// Flag checked by the stubs on entry
+		/// </summary>
+		[[nodiscard]] static const void* GetEnabledFlag() noexcept { return &s_Enabled; }
+
+		/// <summary>
+		/// Allocate a hook's counters, reusing the index of an unregistered hook if any
+		/// </summary>
+		/// <returns>index of the hook's counters, 'InvalidIndex' if there is already 'MaxHooks' hooks</returns>
+		[[nodiscard]] static uint32_t Register(std::string name);
+
+		/// <summary>
+		/// Free a hook's counters, every thread's counters of the index are reset, no call to the hook may be in flight
+		/// </summary>
+		static void Unregister(uint32_t index) noexcept;
+
+		static void SetName(uint32_t index, std::string name);
+
+		/// <summary>
+		/// Sum up every thread's counters, for every registered hook that was called at least once
+		/// </summary>
+		[[nodiscard]] static std::vector<Snapshot> Collect();
+
+		/// <summary>
+		/// Reset every counter, calls in flight may still be counted afterward
+		/// </summary>
+		static void Reset() noexcept;
+
+		[[nodiscard]] static uint32_t BucketOf(uint64_t ns) noexcept;
+		[[nodiscard]] static uint64_t BucketLowerBound(uint32_t bucket) noexcept;
+
+	public:
+		// called by the stubs, see 'StubCompiler::EmitStats'
+		static void Enter(CallData* data) noexcept;
+		static void Record(uint32_t index, CallData* data, Time time) noexcept;
+		static void Leave(uint32_t index, CallData* data) noexcept;
+
+	private:
+		static inline std::atomic<bool> s_Enabled{ };
+	};
+}
@@ -1,7 +1,15 @@
 #include "HooksManager.hpp"
 
+#include <algorithm>
+#include <format>
+#include <thread>
+#include <TlHelp32.h>
+
 #include <px/interfaces/PluginSys.hpp>
 
+#include "SigBuilder.hpp"
+#include "Epoch.hpp"
+
 #include "library/Manager.hpp"
 #include "plugins/GameData.hpp"
 #include "Logs/Logger.hpp"
@@ -29,71 +37,305 @@ px::IHookInstance* DetoursManager::LoadHook(
 
 	if (!lookupKey && !pAddr)
 	{
-		enum class SecType
-		{
-			Virtual, Address, Signature
-		};
+		pAddr = ResolveAddress(pData, res, pThis);
+		lookupKey = pAddr;
+	}
+
+	if (!pAddr)
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Failed to get address of detour."),
+			PX_LOGARG("Detour", hookName)
+		);
+		return nullptr;
+	}
 
-		const auto get_addr_from_cfg = [&pData] (SecType sec_type, nlohmann::json& cfg, void* pThis = nullptr) -> px::IntPtr
+	auto& hookInst = m_ActiveHooks[lookupKey];
+
+	if (hookInst)
+	{
+		auto pInst = static_cast<HookInstance*>(hookInst.get());
+		if (!pInst->RefCount++)
 		{
-			const char* sec_name =
-				sec_type == SecType::Virtual ? "virtual" :
-				sec_type == SecType::Address ? "address" :
-				sec_type == SecType::Signature ? "name" : nullptr;
+			if (detour_detail::DetourBatch::IsActive())
+				m_BatchNames.emplace(&pInst->GetDetour(), hookName);
+			pInst->Activate();
+		}
+		return pInst;
+	}
+
+	try
+	{
+		std::string err;
+		hookInst = std::make_unique<HookInstance>(pAddr, res, err);
+		if (!err.empty())
+			throw std::runtime_error(err);
+
+		HookInstance* pInst = static_cast<HookInstance*>(hookInst.get());
+		detour_detail::HookStats::SetName(pInst->GetStatsIndex(), hookName);
+		if (detour_detail::DetourBatch::IsActive())
+			m_BatchNames.emplace(&pInst->GetDetour(), hookName);
+	}
+	catch (const std::exception& ex)
+	{
+		hookInst = nullptr;
+		PX_LOG_ERROR(
+			PX_MESSAGE("Exception reported while loading hook."),
+			PX_LOGARG("Detour", hookName),
+			PX_LOGARG("Exception", ex.what())
+		);
+	}
+
+	return hookInst.get();
+}
+
+px::IntPtr DetoursManager::ResolveAddress(GameData* pData, nlohmann::json& res, px::IntPtr pThis)
+{
+	px::IntPtr pAddr{ };
+
+	enum class SecType
+	{
+		Virtual, Address, Signature
+	};
 
-			auto& info = cfg[sec_name];
-			if (info.is_array())
+	const auto get_addr_from_cfg = [&pData] (SecType sec_type, nlohmann::json& cfg, void* pThis = nullptr) -> px::IntPtr
+	{
+		const char* sec_name =
+			sec_type == SecType::Virtual ? "virtual" :
+			sec_type == SecType::Address ? "address" :
+			sec_type == SecType::Signature ? "name" : nullptr;
+
+		auto& info = cfg[sec_name];
+		if (info.is_array())
+		{
+			// "sec_name": [ "Main", "Class", "Subclass", "Sub-subclass", "FuncName" ]
+			switch (sec_type)
 			{
-				// "sec_name": [ "Main", "Class", "Subclass", "Sub-subclass", "FuncName" ]
-				switch (sec_type)
-				{
-				case SecType::Virtual:
-					return pData->ReadVirtual(info, { }, pThis);
+			case SecType::Virtual:
+				return pData->ReadVirtual(info, { }, pThis);
 
-				case SecType::Address:
-					return pData->ReadAddress(info, { });
+			case SecType::Address:
+				return pData->ReadAddress(info, { });
 
-				case SecType::Signature:
-					return pData->ReadSignature(info, { });
+			case SecType::Signature:
+				return pData->ReadSignature(info, { });
 
-				default: break;
-				}
+			default: break;
 			}
-			else if (info.is_string())
+		}
+		else if (info.is_string())
+		{
+			// "sec_name": "Main::Class::FuncName"
+			switch (sec_type)
 			{
-				// "sec_name": "Main::Class::FuncName"
-				switch (sec_type)
-				{
-				case SecType::Virtual:
-					return pData->ReadVirtual({ }, info, pThis);
+			case SecType::Virtual:
+				return pData->ReadVirtual({ }, info, pThis);
 
-				case SecType::Address:
-					return pData->ReadAddress({ }, info);
+			case SecType::Address:
+				return pData->ReadAddress({ }, info);
 
-				case SecType::Signature:
-					return pData->ReadSignature({ }, info);
+			case SecType::Signature:
+				return pData->ReadSignature({ }, info);
 
-				default: break;
-				}
+			default: break;
 			}
+		}
 
-			return nullptr;
-		};
+		return nullptr;
+	};
 
-		if (auto& sig_sec = res["Signature"], &sig_name = sig_sec["name"];
-			sig_name.empty())
-		{
-			if (pThis)
-				pAddr = get_addr_from_cfg(SecType::Virtual, sig_sec, pThis);
+	if (auto& sig_sec = res["Signature"], &sig_name = sig_sec["name"];
+		sig_name.empty())
+	{
+		if (pThis)
+			pAddr = get_addr_from_cfg(SecType::Virtual, sig_sec, pThis);
 
-			if (!pAddr)
-				pAddr = get_addr_from_cfg(SecType::Address, sig_sec);
-		}
-		else
-			pAddr = get_addr_from_cfg(SecType::Signature, sig_sec);
-		lookupKey = pAddr;
+		if (!pAddr)
+			pAddr = get_addr_from_cfg(SecType::Address, sig_sec);
 	}
+	else
+		pAddr = get_addr_from_cfg(SecType::Signature, sig_sec);
 
+	return pAddr;
+}
+
+void DetoursManager::ReleaseHook(px::IHookInstance*& hookInst)
+{
+	if (hookInst)
+	{
+		HookInstance* pInst = static_cast<HookInstance*>(hookInst);
+		hookInst = nullptr;
+
+		if (!--pInst->RefCount)
+			pInst->Deactivate();
+	}
+}
+
+void DetoursManager::BeginBatch() noexcept
+{
+	detour_detail::DetourBatch::Begin();
+}
+
+size_t DetoursManager::CommitBatch()
+{
+	const auto failed = detour_detail::DetourBatch::Commit();
+
+	// mid hooks attached in the batch have their trampolines now
+	if (!detour_detail::DetourBatch::IsActive())
+	{
+		for (auto& hook : m_MidHooks)
+			hook.second->UpdateResume();
+	}
+
+	for (auto& res : failed)
+	{
+		auto name = m_BatchNames.find(res.Target);
+		PX_LOG_ERROR(
+			PX_MESSAGE(res.Attach ? "Failed to attach detour." : "Failed to detach detour."),
+			PX_LOGARG("Detour", name != m_BatchNames.end() ? name->second : std::format("{}", res.Target->original_function())),
+			PX_LOGARG("Code", res.Error)
+		);
+	}
+
+	if (!detour_detail::DetourBatch::IsActive())
+		m_BatchNames.clear();
+
+	return failed.size();
+}
+
+const SharedStub* DetoursManager::GetSharedStub(const nlohmann::json& detour_info, std::string& out_err)
+{
+	// only the keys read by 'SigBuilder', objects' keys are sorted so the same signature always dumps the same
+	nlohmann::json signature = nlohmann::json::object();
+	for (const char* key : { "callConv", "return", "Arguments", "va index", "mutable", "Flags" })
+	{
+		if (const auto iter = detour_info.find(key); iter != detour_info.end())
+			signature[key] = *iter;
+	}
+
+	std::string key = signature.dump();
+	if (const auto iter = m_SharedStubs.find(key); iter != m_SharedStubs.end())
+		return &iter->second;
+
+	detour_detail::SigBuilder sig(detour_info, out_err);
+	if (!out_err.empty())
+		return nullptr;
+
+	SharedStub stub;
+	stub.Stub = HookInstance::AllocCallbackHandler(sig, stub.Context, { }, nullptr, out_err);
+	if (!stub.Stub.Code)
+		return nullptr;
+
+	return &m_SharedStubs.emplace(std::move(key), std::move(stub)).first->second;
+}
+
+HookInstance* DetoursManager::LoadNativeHook(
+	const std::vector<std::string>& keys,
+	const char* hookName,
+	px::IntPtr pThis,
+	px::IGameData* pPlugin,
+	void* callback,
+	const asmjit::FuncSignature& signature
+)
+{
+	px::IHookInstance* hookInst = LoadHook(keys, hookName, pThis, pPlugin, nullptr, nullptr);
+	if (!hookInst)
+		return nullptr;
+
+	HookInstance* pInst = static_cast<HookInstance*>(hookInst);
+	if (std::string err; !pInst->SetNativeCallback(callback, signature, err))
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Failed to set native callback of detour."),
+			PX_LOGARG("Detour", hookName),
+			PX_LOGARG("Error", err)
+		);
+		ReleaseHook(hookInst);
+		return nullptr;
+	}
+
+	return pInst;
+}
+
+void DetoursManager::ReleaseNativeHook(HookInstance*& hookInst)
+{
+	if (hookInst)
+	{
+		hookInst->ClearNativeCallback();
+
+		px::IHookInstance* pInst = hookInst;
+		hookInst = nullptr;
+		ReleaseHook(pInst);
+	}
+}
+
+HookInstance* DetoursManager::LoadInlineHook(
+	const std::vector<std::string>& keys,
+	const char* hookName,
+	px::IntPtr pThis,
+	px::IGameData* pPlugin,
+	px::HookOrder order,
+	void* callback,
+	const asmjit::FuncSignature& signature,
+	px::IHookInstance::HookID& id
+)
+{
+	px::IHookInstance* hookInst = LoadHook(keys, hookName, pThis, pPlugin, nullptr, nullptr);
+	if (!hookInst)
+		return nullptr;
+
+	HookInstance* pInst = static_cast<HookInstance*>(hookInst);
+	std::string err;
+	id = pInst->AddInlineCallback(order, callback, signature, err);
+	if (id == px::IHookInstance::InvalidId)
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Failed to add inline callback to detour."),
+			PX_LOGARG("Detour", hookName),
+			PX_LOGARG("Error", err)
+		);
+		ReleaseHook(hookInst);
+		return nullptr;
+	}
+
+	return pInst;
+}
+
+void DetoursManager::ReleaseInlineHook(HookInstance*& hookInst, px::IHookInstance::HookID id)
+{
+	if (hookInst)
+	{
+		hookInst->RemoveInlineCallback(id);
+
+		px::IHookInstance* pInst = hookInst;
+		hookInst = nullptr;
+		ReleaseHook(pInst);
+	}
+}
+
+MidHookInstance* DetoursManager::LoadMidHook(
+	const std::vector<std::string>& keys,
+	const char* hookName,
+	px::IntPtr pThis,
+	px::IGameData* gamedata,
+	px::HookOrder order,
+	const MidHookInstance::CallbackType& callback,
+	px::IHookInstance::HookID& id
+)
+{
+	GameData* pData{ static_cast<GameData*>(gamedata) };
+	auto res = pData->ReadDetour(keys, hookName);
+
+	if (res.empty())
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Tried loading an non-existing detour."),
+			PX_LOGARG("Detour", hookName)
+		);
+		return nullptr;
+	}
+
+	px::IntPtr pAddr = ResolveAddress(pData, res, pThis);
 	if (!pAddr)
 	{
 		PX_LOG_ERROR(
@@ -103,69 +345,444 @@ px::IHookInstance* DetoursManager::LoadHook(
 		return nullptr;
 	}
 
-	auto& hookInst = m_ActiveHooks[lookupKey];
+	if (const auto offset = res.find("Offset"); offset != res.end() && offset->is_number_integer())
+		pAddr = pAddr + offset->get<ptrdiff_t>();
 
-	if (hookInst)
+	auto& hookInst = m_MidHooks[pAddr];
+	MidHookInstance* pInst = hookInst.get();
+	std::string err;
+
+	if (pInst)
 	{
-		auto pInst = static_cast<HookInstance*>(hookInst.get());
+		// the stub only saves the registers of the first entry
+		if (!pInst->ExposesRegisters(res, err))
+		{
+			PX_LOG_ERROR(
+				PX_MESSAGE("Mid hook doesn't expose the registers of the entry."),
+				PX_LOGARG("Detour", hookName),
+				PX_LOGARG("Error", err)
+			);
+			return nullptr;
+		}
+
 		if (!pInst->RefCount++)
+		{
+			if (detour_detail::DetourBatch::IsActive())
+				m_BatchNames.emplace(&pInst->GetDetour(), hookName);
 			pInst->Activate();
-		return pInst;
+		}
+	}
+	else
+	{
+		try
+		{
+			hookInst = std::make_unique<MidHookInstance>(pAddr, res, err);
+			if (!err.empty())
+				throw std::runtime_error(err);
+
+			pInst = hookInst.get();
+			if (detour_detail::DetourBatch::IsActive())
+				m_BatchNames.emplace(&pInst->GetDetour(), hookName);
+		}
+		catch (const std::exception& ex)
+		{
+			m_MidHooks.erase(pAddr);
+			PX_LOG_ERROR(
+				PX_MESSAGE("Exception reported while loading hook."),
+				PX_LOGARG("Detour", hookName),
+				PX_LOGARG("Exception", ex.what())
+			);
+			return nullptr;
+		}
 	}
 
+	id = pInst->AddCallback(order, callback);
+	if (id == px::IHookInstance::InvalidId)
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Failed to add callback to mid hook."),
+			PX_LOGARG("Detour", hookName)
+		);
+		ReleaseMidHook(pInst, px::IHookInstance::InvalidId);
+		return nullptr;
+	}
+
+	return pInst;
+}
+
+void DetoursManager::ReleaseMidHook(MidHookInstance*& hookInst, px::IHookInstance::HookID id)
+{
+	if (hookInst)
+	{
+		MidHookInstance* pInst = hookInst;
+		hookInst = nullptr;
+
+		pInst->RemoveCallback(id);
+		if (!--pInst->RefCount)
+			pInst->Deactivate();
+	}
+}
+
+HookInstance* DetoursManager::LoadVTableHook(
+	const std::vector<std::string>& keys,
+	const char* hookName,
+	px::IntPtr pThis,
+	px::IGameData* gamedata
+)
+{
+	GameData* pData{ static_cast<GameData*>(gamedata) };
+	auto res = pData->ReadDetour(keys, hookName);
+
+	if (res.empty())
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Tried loading an non-existing detour."),
+			PX_LOGARG("Detour", hookName)
+		);
+		return nullptr;
+	}
+
+	VirtualHandle handle;
+	if (auto& info = res["Signature"]["virtual"]; info.is_array())
+		handle = pData->ReadVirtualHandle(info, { });
+	else if (info.is_string())
+		handle = pData->ReadVirtualHandle({ }, info);
+
+	if (!pThis || !handle)
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Failed to get virtual function of detour."),
+			PX_LOGARG("Detour", hookName)
+		);
+		return nullptr;
+	}
+
+	auto& object = m_HookedObjects[pThis.get()];
+	// objects are tracked by address, the object may have been constructed again or replaced by another one since it was hooked
+	if (object.VTable)
+	{
+		void** vtable = pThis.read<void**>();
+		if (vtable == object.VTable->GetOriginal())
+		{
+			// same class, the constructor reset the vtable pointer
+			object.VTable->Swap(pThis);
+		}
+		else if (vtable != object.VTable->GetTable())
+		{
+			PX_LOG_ERROR(
+				PX_MESSAGE("Object's vtable changed since it was hooked, its other hooks must be released first."),
+				PX_LOGARG("Detour", hookName)
+			);
+			return nullptr;
+		}
+	}
+
+	std::string err;
+	HookInstance* pInst{ };
+
 	try
 	{
-		std::string err;
-		hookInst = std::make_unique<HookInstance>(pAddr, res, err);
-		if (!err.empty())
+		if (!object.VTable)
+		{
+			// objects of the same class share the same copy
+			void** vtable = pThis.read<void**>();
+			auto& vtable_hook = m_VTables[vtable];
+			if (!vtable_hook)
+			{
+				vtable_hook = std::make_unique<VTableHook>(vtable, err);
+				if (!err.empty())
+				{
+					m_VTables.erase(vtable);
+					throw std::runtime_error(err);
+				}
+			}
+			object.VTable = vtable_hook.get();
+		}
+
+		pInst = object.VTable->LoadSlot(handle.Index, res, err);
+		if (!pInst)
 			throw std::runtime_error(err);
+		detour_detail::HookStats::SetName(pInst->GetStatsIndex(), std::format("{} (VTable)", hookName));
 	}
 	catch (const std::exception& ex)
 	{
-		hookInst = nullptr;
+		if (!object.RefCount)
+			m_HookedObjects.erase(pThis.get());
+
 		PX_LOG_ERROR(
 			PX_MESSAGE("Exception reported while loading hook."),
 			PX_LOGARG("Detour", hookName),
 			PX_LOGARG("Exception", ex.what())
 		);
+		return nullptr;
 	}
 
-	return hookInst.get();
+	if (!object.RefCount++)
+	{
+		object.VTable->Swap(pThis);
+		++object.VTable->ObjectCount;
+	}
+	return pInst;
 }
 
-void DetoursManager::ReleaseHook(px::IHookInstance*& hookInst)
+void DetoursManager::ReleaseVTableHook(HookInstance*& hookInst, px::IntPtr pThis)
 {
 	if (hookInst)
 	{
-		HookInstance* pInst = static_cast<HookInstance*>(hookInst);
+		HookInstance* pInst = hookInst;
 		hookInst = nullptr;
 
 		if (!--pInst->RefCount)
 			pInst->Deactivate();
+
+		auto object = m_HookedObjects.find(pThis.get());
+		if (object != m_HookedObjects.end() && !--object->second.RefCount)
+		{
+			object->second.VTable->Restore(pThis);
+			--object->second.VTable->ObjectCount;
+			m_HookedObjects.erase(object);
+		}
 	}
 }
 
-void DetoursManager::SleepToReleaseHooks()
+void DetoursManager::ReleaseAllHooks()
 {
 	// Deactivate all the of the active hooks
+	BeginBatch();
 	for (auto& hook : m_ActiveHooks)
 	{
 		HookInstance* pInst = static_cast<HookInstance*>(hook.second.get());
 		if (pInst->RefCount)
 			pInst->Deactivate();
 	}
+	for (auto& hook : m_MidHooks)
+	{
+		if (hook.second->RefCount)
+			hook.second->Deactivate();
+	}
+	CommitBatch();
+
+	// vtable hooks aren't detoured, their slots are restored right away
+	for (auto& vtable : m_VTables)
+		vtable.second->DeactivateAll();
+
+	// no thread can enter the hooks anymore, wait for the calls that already did to return
+	const auto deadline = std::chrono::steady_clock::now() + ReleaseTimeout;
+	bool idle = true;
+
+	std::vector<StubCode> stubs;
+	for (auto& hook : m_ActiveHooks)
+	{
+		HookInstance* pInst = static_cast<HookInstance*>(hook.second.get());
+		if (pInst->GetDetour().is_set() || !pInst->WaitForCalls(deadline))
+		{
+			PX_LOG_ERROR(
+				PX_MESSAGE("Detour is still in use."),
+				PX_LOGARG("Function", std::format("{}", pInst->GetDetour().original_function())),
+				PX_LOGARG("Attached", pInst->GetDetour().is_set()),
+				PX_LOGARG("Calls", pInst->GetCallsInFlight())
+			);
+			idle = false;
+		}
+
+		auto hook_stubs = pInst->GetStubs();
+		stubs.insert(stubs.end(), hook_stubs.begin(), hook_stubs.end());
+	}
+
+	for (auto& hook : m_MidHooks)
+	{
+		MidHookInstance* pInst = hook.second.get();
+		if (pInst->GetDetour().is_set() || !pInst->WaitForCalls(deadline))
+		{
+			PX_LOG_ERROR(
+				PX_MESSAGE("Mid hook is still in use."),
+				PX_LOGARG("Address", std::format("{}", hook.first.get())),
+				PX_LOGARG("Attached", pInst->GetDetour().is_set()),
+				PX_LOGARG("Calls", pInst->GetCallsInFlight())
+			);
+			idle = false;
+		}
+
+		stubs.emplace_back(pInst->GetStub());
+	}
+
+	for (auto& vtable : m_VTables)
+	{
+		if (!vtable.second->WaitForCalls(deadline))
+		{
+			PX_LOG_ERROR(
+				PX_MESSAGE("VTable hook is still in use."),
+				PX_LOGARG("VTable", std::format("{}", static_cast<void*>(vtable.first)))
+			);
+			idle = false;
+		}
+
+		vtable.second->GetStubs(stubs);
+	}
+
+	for (auto& stub : m_SharedStubs)
+		stubs.emplace_back(stub.second.Stub);
+
+	// the stubs' entry and exit aren't counted, wait for the threads running them
+	if (idle && !WaitForThreadsToLeave(stubs, deadline))
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Threads are still running the detours' stubs.")
+		);
+		idle = false;
+	}
+
+	if (!idle)
+	{
+		// releasing the stubs or the hooks would crash the threads still using them, leak them instead
+		PX_LOG_ERROR(
+			PX_MESSAGE("Timed out waiting for detours to be released, their memory will be leaked."),
+			PX_LOGARG("Hooks", m_ActiveHooks.size() + m_MidHooks.size() + m_VTables.size())
+		);
+
+		for (auto& hook : m_ActiveHooks)
+			static_cast<void>(hook.second.release());
+		m_ActiveHooks.clear();
+		for (auto& hook : m_MidHooks)
+			static_cast<void>(hook.second.release());
+		m_MidHooks.clear();
+		for (auto& vtable : m_VTables)
+			static_cast<void>(vtable.second.release());
+		m_VTables.clear();
+		m_HookedObjects.clear();
+		m_SharedStubs.clear();
+		return;
+	}
 
-	// Sleep for a short time in case there is a function that hasnt finished its execution
-	using namespace std::chrono_literals;
-	std::this_thread::sleep_for(10us);
-	
 	// Release all of the active hooks from JIT
 	for (auto& hook : m_ActiveHooks)
 	{
 		HookInstance* pInst = static_cast<HookInstance*>(hook.second.get());
-		px::lib_manager.GetRuntime()->release(pInst->GetRuntimeCallback());
+		pInst->ReleaseStubs();
 	}
+	for (auto& hook : m_MidHooks)
+		hook.second->ReleaseStub();
+	for (auto& vtable : m_VTables)
+		vtable.second->ReleaseStubs();
+
+	for (auto& stub : m_SharedStubs)
+		px::lib_manager.GetRuntime()->release(stub.second.Stub.Code);
+	m_SharedStubs.clear();
 
 	// Free all of the hook pointers
 	m_ActiveHooks.clear();
+	m_MidHooks.clear();
+
+	// objects still hooked keep pointing to their vtable's copy, which now calls the original functions
+	for (auto& vtable : m_VTables)
+	{
+		if (vtable.second->ObjectCount)
+			static_cast<void>(vtable.second.release());
+	}
+	m_VTables.clear();
+	m_HookedObjects.clear();
+}
+
+bool DetoursManager::WaitForCallbacks()
+{
+	const auto deadline = std::chrono::steady_clock::now() + ReleaseTimeout;
+
+	// pre, post and mid hook callbacks are called inside an epoch guard
+	if (!detour_detail::Epoch::Synchronize(deadline))
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Timed out waiting for removed callbacks to return.")
+		);
+		return false;
+	}
+
+	// native and inline callbacks are called by code that counts the calls inside them
+	std::vector<StubCode> stubs;
+	std::vector<const std::atomic<uint32_t>*> calls_in_flight;
+	for (auto& hook : m_ActiveHooks)
+		static_cast<HookInstance*>(hook.second.get())->CollectRetiredStubs(stubs, calls_in_flight);
+
+	if (stubs.empty())
+		return true;
+
+	// a thread may have jumped to a stub without incrementing its count yet
+	bool idle = WaitForThreadsToLeave(stubs, deadline);
+	for (const std::atomic<uint32_t>* calls : calls_in_flight)
+	{
+		if (!idle)
+			break;
+
+		using namespace std::chrono_literals;
+		while (calls->load(std::memory_order_acquire))
+		{
+			if (std::chrono::steady_clock::now() >= deadline)
+			{
+				idle = false;
+				break;
+			}
+			std::this_thread::sleep_for(1ms);
+		}
+	}
+
+	if (!idle)
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Timed out waiting for removed native and inline callbacks to return.")
+		);
+	}
+	return idle;
+}
+
+bool DetoursManager::WaitForThreadsToLeave(std::span<const StubCode> stubs, std::chrono::steady_clock::time_point deadline)
+{
+	const DWORD process_id = GetCurrentProcessId(), thread_id = GetCurrentThreadId();
+
+	// suspend each thread of the process and check where it is, like detours does for the threads it updates
+	const auto is_running_stubs = [&stubs, process_id, thread_id] () -> bool
+	{
+		HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+		if (snapshot == INVALID_HANDLE_VALUE)
+			return true;
+
+		bool running = false;
+		THREADENTRY32 entry{ .dwSize = sizeof(THREADENTRY32) };
+		for (BOOL has_entry = Thread32First(snapshot, &entry); has_entry && !running; has_entry = Thread32Next(snapshot, &entry))
+		{
+			if (entry.th32OwnerProcessID != process_id || entry.th32ThreadID == thread_id)
+				continue;
+
+			HANDLE thread = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT, FALSE, entry.th32ThreadID);
+			if (!thread)
+				continue;
+
+			if (SuspendThread(thread) != static_cast<DWORD>(-1))
+			{
+				CONTEXT context{ .ContextFlags = CONTEXT_CONTROL };
+				if (GetThreadContext(thread, &context))
+				{
+#ifdef _WIN64
+					const uintptr_t ip = context.Rip;
+#else
+					const uintptr_t ip = context.Eip;
+#endif
+					running = std::ranges::any_of(stubs, [ip] (const StubCode& stub) { return stub.Contains(ip); });
+				}
+				ResumeThread(thread);
+			}
+
+			CloseHandle(thread);
+		}
+
+		CloseHandle(snapshot);
+		return running;
+	};
+
+	using namespace std::chrono_literals;
+	while (is_running_stubs())
+	{
+		if (std::chrono::steady_clock::now() >= deadline)
+			return false;
+		std::this_thread::sleep_for(1ms);
+	}
+	return true;
 }
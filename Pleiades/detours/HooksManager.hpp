@@ -1,6 +1,11 @@
 #pragma once
 
+#include <unordered_map>
 #include "HookInstance.hpp"
+#include "MidHook.hpp"
+#include "VTableHook.hpp"
+
+class GameData;
 
 class DetoursManager : public px::IDetoursManager
 {
@@ -17,13 +22,366 @@ public:
 
 	void ReleaseHook(px::IHookInstance*& hookInst) override;
 
-	void SleepToReleaseHooks();
+	/// <summary>
+	/// Detach every hook, wait for the calls inside them to return, then release them
+	/// if calls are still in flight after 'ReleaseTimeout', the hooks and their stubs are leaked instead
+	/// </summary>
+	void ReleaseAllHooks();
+
+	/// <summary>
+	/// Wait until no thread is running a callback removed before the call, eg: before unloading the plugin that added it
+	/// callbacks added with 'AddCallback', mid hook callbacks, native callbacks and inline callbacks are tracked
+	/// </summary>
+	/// <returns>false if a callback is still running after 'ReleaseTimeout'</returns>
+	bool WaitForCallbacks();
+
+	static constexpr std::chrono::milliseconds ReleaseTimeout{ 5000 };
+
+	/// <summary>
+	/// Open a batch on the current thread, hooks loaded, activated or deactivated until 'CommitBatch' are applied in a single transaction
+	/// batches can be nested, only the outermost 'CommitBatch' applies them
+	/// plugins can't open one yet, 'px::IDetoursManager' is declared in the px SDK and doesn't have a batch entry point
+	/// </summary>
+	void BeginBatch() noexcept;
+
+	/// <summary>
+	/// Apply every hook of the current batch, hooks that failed to apply are logged and left as they were
+	/// </summary>
+	/// <returns>number of hooks that failed to apply</returns>
+	size_t CommitBatch();
+
+	/// <summary>
+	/// Get the stub shared by every detour with the same signature, compile it if it doesn't exists
+	/// </summary>
+	/// <returns>the stub, null if the signature is invalid or the stub failed to compile</returns>
+	const SharedStub* GetSharedStub(const nlohmann::json& detour_info, std::string& out_err);
+
+	/// <summary>
+	/// Load a hook and set its native callback, see 'HookInstance::SetNativeCallback'
+	/// </summary>
+	/// <returns>the hook, null if it failed to load or the callback's signature doesn't match the detour's signature</returns>
+	HookInstance* LoadNativeHook(
+		const std::vector<std::string>& keys,
+		const char* hookName,
+		px::IntPtr pThis,
+		px::IGameData* pPlugin,
+		void* callback,
+		const asmjit::FuncSignature& signature
+	);
+
+	/// <summary>
+	/// Clear a hook's native callback and release it
+	/// </summary>
+	void ReleaseNativeHook(HookInstance*& hookInst);
+
+	/// <summary>
+	/// Load a hook and add an inline callback to it, see 'HookInstance::AddInlineCallback'
+	/// </summary>
+	/// <returns>the hook, null if it failed to load or the callback couldn't be added</returns>
+	HookInstance* LoadInlineHook(
+		const std::vector<std::string>& keys,
+		const char* hookName,
+		px::IntPtr pThis,
+		px::IGameData* pPlugin,
+		px::HookOrder order,
+		void* callback,
+		const asmjit::FuncSignature& signature,
+		px::IHookInstance::HookID& id
+	);
+
+	/// <summary>
+	/// Remove a hook's inline callback and release it
+	/// </summary>
+	void ReleaseInlineHook(HookInstance*& hookInst, px::IHookInstance::HookID id);
+
+	/// <summary>
+	/// Load a mid function hook and add a callback to it, see 'MidHookInstance'
+	/// the hook's address is read like a detour's address, then moved by the entry's "Offset"
+	/// hooks at the same address are shared, every entry must expose a subset of the registers of the first one
+	/// </summary>
+	/// <returns>the hook, null if it failed to load or the callback couldn't be added</returns>
+	MidHookInstance* LoadMidHook(
+		const std::vector<std::string>& keys,
+		const char* hookName,
+		px::IntPtr pThis,
+		px::IGameData* pPlugin,
+		px::HookOrder order,
+		const MidHookInstance::CallbackType& callback,
+		px::IHookInstance::HookID& id
+	);
+
+	/// <summary>
+	/// Remove a mid function hook's callback and release it
+	/// </summary>
+	void ReleaseMidHook(MidHookInstance*& hookInst, px::IHookInstance::HookID id);
+
+	/// <summary>
+	/// Hook a virtual function of a single object by swapping its vtable pointer, instead of detouring the function, see 'VTableHook'
+	/// the detour's entry must have a "virtual" signature, every hooked object of the same class shares the hook
+	/// </summary>
+	/// <returns>the hook, null if it failed to load</returns>
+	HookInstance* LoadVTableHook(
+		const std::vector<std::string>& keys,
+		const char* hookName,
+		px::IntPtr pThis,
+		px::IGameData* pPlugin
+	);
+
+	/// <summary>
+	/// Release a hook loaded with 'LoadVTableHook', the object's vtable pointer is restored once it has no other hook
+	/// </summary>
+	void ReleaseVTableHook(HookInstance*& hookInst, px::IntPtr pThis);
 
 private:
+	/// <summary>
+	/// Read the address of a detour's entry, from its "Signature" section
+	/// </summary>
+	static px::IntPtr ResolveAddress(GameData* pData, nlohmann::json& res, px::IntPtr pThis);
+
+	/// <summary>
+	/// Wait until no thread other than the current one is executing any of 'stubs'
+	/// </summary>
+	static bool WaitForThreadsToLeave(std::span<const StubCode> stubs, std::chrono::steady_clock::time_point deadline);
+
 	std::map<px::IntPtr, std::unique_ptr<px::IHookInstance>> m_ActiveHooks;
 	std::map<px::IntPtr, std::unique_ptr<px::IHookInstance>> m_FreeHooks;
+	std::map<px::IntPtr, std::unique_ptr<MidHookInstance>> m_MidHooks;
+
+	// by original vtable
+	std::map<void**, std::unique_ptr<VTableHook>> m_VTables;
+
+	struct HookedObject
+	{
+		VTableHook* VTable;
+		// number of hooks loaded for the object
+		size_t RefCount;
+	};
+	std::unordered_map<void*, HookedObject> m_HookedObjects;
+
+	// by canonical signature, the signature's keys of the detour's entry dumped as json
+	std::unordered_map<std::string, SharedStub> m_SharedStubs;
+
+	// names of the hooks loaded in the current batch, to report the ones that failed
+	std::unordered_map<const detour_detail::Detour*, std::string> m_BatchNames;
 };
 
 PX_NAMESPACE_BEGIN();
 inline DetoursManager detour_manager;
-PX_NAMESPACE_END();
\ No newline at end of file
+PX_NAMESPACE_END();
+
+
+/// <summary>
+/// Scoped 'DetoursManager::BeginBatch' and 'DetoursManager::CommitBatch'
+/// hooks loaded in the batch aren't attached until it's committed, their 'GetFunction' isn't valid before then
+/// so only open one around code that doesn't call the functions it hooks, never around a plugin's code
+/// </summary>
+class DetoursBatch
+{
+public:
+	DetoursBatch() noexcept { px::detour_manager.BeginBatch(); }
+	~DetoursBatch() { px::detour_manager.CommitBatch(); }
+
+	DetoursBatch(const DetoursBatch&) = delete;
+	DetoursBatch& operator=(const DetoursBatch&) = delete;
+};
+
+
+namespace detour_detail
+{
+	template<asmjit::CallConvId _CallConv, typename _RetTy, typename... _Args>
+	struct native_function;
+
+	template<typename _RetTy, typename... _Args>
+	struct native_function<asmjit::CallConvId::kCDecl, _RetTy, _Args...> { using type = _RetTy(__cdecl*)(_Args...); };
+
+	template<typename _RetTy, typename... _Args>
+	struct native_function<asmjit::CallConvId::kStdCall, _RetTy, _Args...> { using type = _RetTy(__stdcall*)(_Args...); };
+
+	template<typename _RetTy, typename... _Args>
+	struct native_function<asmjit::CallConvId::kFastCall, _RetTy, _Args...> { using type = _RetTy(__fastcall*)(_Args...); };
+
+	template<typename _RetTy, typename... _Args>
+	struct native_function<asmjit::CallConvId::kVectorCall, _RetTy, _Args...> { using type = _RetTy(__vectorcall*)(_Args...); };
+}
+
+/// <summary>
+/// Hook called by the detour's stub directly with the function's native args, without 'std::function' nor 'px::PassArgs'
+/// the C++ signature is checked against the detour's json entry when the hook is loaded
+/// a detour has at most one typed hook, it runs before any other callback and decides if they run by calling 'call_next()'
+/// 
+/// on x86, |this| pointer of 'ThisCall' detours is passed in ecx, which a free function can't receive, and those detours are rejected
+/// declare them with 'FastCall' instead, and add |this| then a dummy argument for edx before the function's args, in the json entry as well:
+/// "callConv": "FastCall", "Arguments": [ { "type": "I32" }, { "type": "I32" }, ...the function's args ]
+/// TypedHook<int(void* pThis, int edx, float dmg), asmjit::CallConvId::kFastCall>, the dummy argument is passed back as it is to 'call_next'
+/// </summary>
+/// <example>
+/// TypedHook<int(void*, float), asmjit::CallConvId::kCDecl> hook;
+/// hook.attach({ }, "CBaseEntity::TakeDamage", gamedata, [] (void* pThis, float dmg) { return hook.call_next(pThis, dmg * 2.f); });
+/// </example>
+template<typename _FnTy, asmjit::CallConvId _CallConv = asmjit::CallConvId::kCDecl>
+class TypedHook;
+
+template<typename _RetTy, typename... _Args, asmjit::CallConvId _CallConv>
+class TypedHook<_RetTy(_Args...), _CallConv>
+{
+public:
+	using function_type = typename detour_detail::native_function<_CallConv, _RetTy, _Args...>::type;
+
+	TypedHook() = default;
+
+	TypedHook(const TypedHook&) = delete; TypedHook& operator=(const TypedHook&) = delete;
+	TypedHook(TypedHook&&) = delete; TypedHook& operator=(TypedHook&&) = delete;
+
+	~TypedHook()
+	{
+		detach();
+	}
+
+	/// <summary>
+	/// Load the detour and set 'callback' as its native callback
+	/// </summary>
+	/// <returns>true if the hook was loaded and the signatures matches</returns>
+	bool attach(const std::vector<std::string>& keys, const char* hook_name, px::IGameData* gamedata, function_type callback, px::IntPtr pThis = nullptr)
+	{
+		detach();
+		m_Hook = px::detour_manager.LoadNativeHook(
+			keys, hook_name, pThis, gamedata,
+			std::bit_cast<void*>(callback),
+			asmjit::FuncSignatureT<_RetTy, _Args...>(_CallConv)
+		);
+
+		return m_Hook != nullptr;
+	}
+
+	void detach()
+	{
+		if (m_Hook)
+			px::detour_manager.ReleaseNativeHook(m_Hook);
+	}
+
+	/// <summary>
+	/// Run the detour's other callbacks then the original function
+	/// </summary>
+	_RetTy call_next(_Args... args) const
+	{
+		return std::bit_cast<function_type>(m_Hook->GetDispatchFunction())(args...);
+	}
+
+	[[nodiscard]] bool is_set() const noexcept
+	{
+		return m_Hook != nullptr;
+	}
+
+private:
+	HookInstance* m_Hook{ };
+};
+
+
+/// <summary>
+/// Callback compiled directly into the detour's stub, the stub calls every inline callback in 'HookOrder'
+/// then goes through the generic handler only if the detour has any other callback
+/// callbacks get the function's native args by value and return 'InlineHookRes' bits
+/// meant for small and stable sets of callbacks, adding or removing one recompiles the stub
+/// </summary>
+/// <example>
+/// InlineHook<void(void*, int)> hook;
+/// hook.attach({ }, "CBaseEntity::Think", gamedata, px::HookOrder::Any, [] (void* pThis, int tick) { return InlineHookRes(); });
+/// </example>
+template<typename _FnTy, asmjit::CallConvId _CallConv = asmjit::CallConvId::kCDecl>
+class InlineHook;
+
+template<typename _RetTy, typename... _Args, asmjit::CallConvId _CallConv>
+class InlineHook<_RetTy(_Args...), _CallConv>
+{
+public:
+	using function_type = typename detour_detail::native_function<_CallConv, uint32_t, _Args...>::type;
+
+	InlineHook() = default;
+
+	InlineHook(const InlineHook&) = delete; InlineHook& operator=(const InlineHook&) = delete;
+	InlineHook(InlineHook&&) = delete; InlineHook& operator=(InlineHook&&) = delete;
+
+	~InlineHook()
+	{
+		detach();
+	}
+
+	/// <summary>
+	/// Load the detour and add 'callback' to its inline callbacks
+	/// </summary>
+	/// <returns>true if the hook was loaded and the signatures matches</returns>
+	bool attach(const std::vector<std::string>& keys, const char* hook_name, px::IGameData* gamedata, px::HookOrder order, function_type callback, px::IntPtr pThis = nullptr)
+	{
+		detach();
+		m_Hook = px::detour_manager.LoadInlineHook(
+			keys, hook_name, pThis, gamedata, order,
+			std::bit_cast<void*>(callback),
+			asmjit::FuncSignatureT<_RetTy, _Args...>(_CallConv),
+			m_Id
+		);
+		return m_Hook != nullptr;
+	}
+
+	void detach()
+	{
+		if (m_Hook)
+			px::detour_manager.ReleaseInlineHook(m_Hook, m_Id);
+	}
+
+	[[nodiscard]] bool is_set() const noexcept
+	{
+		return m_Hook != nullptr;
+	}
+
+private:
+	HookInstance* m_Hook{ };
+	px::IHookInstance::HookID m_Id{ px::IHookInstance::InvalidId };
+};
+
+
+/// <summary>
+/// Callback called in the middle of a function with its registers, see 'MidHookInstance'
+/// </summary>
+/// <example>
+/// MidHook hook;
+/// hook.attach({ }, "CBaseEntity::Think::Loop", gamedata, px::HookOrder::Any, [] (MidHookContext& ctx) { ctx.gp(asmjit::x86::eax) = 0; });
+/// </example>
+class MidHook
+{
+public:
+	MidHook() = default;
+
+	MidHook(const MidHook&) = delete; MidHook& operator=(const MidHook&) = delete;
+	MidHook(MidHook&&) = delete; MidHook& operator=(MidHook&&) = delete;
+
+	~MidHook()
+	{
+		detach();
+	}
+
+	/// <summary>
+	/// Load the hook and add 'callback' to it
+	/// </summary>
+	/// <returns>true if the hook was loaded and exposes the registers of the entry</returns>
+	bool attach(const std::vector<std::string>& keys, const char* hook_name, px::IGameData* gamedata, px::HookOrder order, const MidHookInstance::CallbackType& callback, px::IntPtr pThis = nullptr)
+	{
+		detach();
+		m_Hook = px::detour_manager.LoadMidHook(keys, hook_name, pThis, gamedata, order, callback, m_Id);
+		return m_Hook != nullptr;
+	}
+
+	void detach()
+	{
+		if (m_Hook)
+			px::detour_manager.ReleaseMidHook(m_Hook, m_Id);
+	}
+
+	[[nodiscard]] bool is_set() const noexcept
+	{
+		return m_Hook != nullptr;
+	}
+
+private:
+	MidHookInstance* m_Hook{ };
+	px::IHookInstance::HookID m_Id{ px::IHookInstance::InvalidId };
+};
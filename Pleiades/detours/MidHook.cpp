@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <format>
+#include <span>
+#include <thread>
+#include <intrin.h>
+#include <nlohmann/json.hpp>
+
+#include "MidHook.hpp"
+#include "Epoch.hpp"
+
+#include "library/Manager.hpp"
+#include "logs/Logger.hpp"
+
+MidHookInstance::MidHookInstance(px::IntPtr address, const nlohmann::json& data, std::string& out_err)
+{
+	if (!ReadRegisters(data, px::lib_manager.GetRuntime()->environment().is32Bit(), m_GpExposed, m_XmmExposed, out_err))
+		return;
+
+	m_Stub = AllocStub(out_err);
+	if (!m_Stub.Code)
+		return;
+
+	if (const LONG res = m_Detour.attach(address.get(), m_Stub.Code); res)
+	{
+		ReleaseStub();
+		std::format_to(std::back_inserter(out_err), "Failed to detour the function (Code: {})", res);
+	}
+	else if (!detour_detail::DetourBatch::IsActive())
+		UpdateResume();
+}
+
+MidHookInstance::~MidHookInstance() noexcept
+{
+	this->ClearCallbacks();
+}
+
+bool MidHookInstance::ReadRegisters(const nlohmann::json& data, bool is_32bit, uint16_t& gp_mask, uint16_t& xmm_mask, std::string& out_err)
+{
+	static constexpr const char* gp_names_32[]{ "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi" };
+	static constexpr const char* gp_names_64[]{
+		"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+		"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+	};
+	const std::span<const char* const> gp_names = is_32bit ? std::span<const char* const>(gp_names_32) : std::span<const char* const>(gp_names_64);
+	const uint32_t xmm_count = is_32bit ? 8 : 16;
+
+	// the stack pointer is always read, but never written back
+	gp_mask = 1u << asmjit::x86::Gp::kIdSp;
+	xmm_mask = 0;
+
+	const auto registers = data.find("Registers");
+	if (registers == data.end() || !registers->is_array())
+		return true;
+
+	for (const auto& reg : *registers)
+	{
+		if (!reg.is_string())
+			continue;
+		const std::string& name = reg.get_ref<const std::string&>();
+
+		// the flags are always saved
+		if (name == "flags")
+			continue;
+
+		if (const auto iter = std::ranges::find(gp_names, name); iter != gp_names.end())
+		{
+			gp_mask |= 1u << (iter - gp_names.begin());
+			continue;
+		}
+
+		uint32_t xmm_id;
+		if (name.starts_with("xmm") && std::from_chars(name.data() + 3, name.data() + name.size(), xmm_id).ec == std::errc{ } && xmm_id < xmm_count)
+		{
+			xmm_mask |= 1u << xmm_id;
+			continue;
+		}
+
+		std::format_to(std::back_inserter(out_err), "Unknown register '{}'.", name);
+		return false;
+	}
+
+	return true;
+}
+
+bool MidHookInstance::ExposesRegisters(const nlohmann::json& data, std::string& out_err) const
+{
+	uint16_t gp_mask, xmm_mask;
+	if (!ReadRegisters(data, px::lib_manager.GetRuntime()->environment().is32Bit(), gp_mask, xmm_mask, out_err))
+		return false;
+
+	if ((gp_mask & ~m_GpExposed) || (xmm_mask & ~m_XmmExposed))
+	{
+		out_err = "The hook was already loaded without some of the registers.";
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Size of the area 'xsave' writes for the features the os enabled, 0 if it isn't supported and 'fxsave' is used instead
+/// </summary>
+static uint32_t GetXSaveSize() noexcept
+{
+	static const uint32_t xsave_size = []
+	{
+		int regs[4]{ };
+		__cpuid(regs, 0);
+		if (regs[0] < 0xD)
+			return 0u;
+
+		// OSXSAVE
+		__cpuid(regs, 1);
+		if (!(regs[2] & (1 << 27)))
+			return 0u;
+
+		__cpuidex(regs, 0xD, 0);
+		return static_cast<uint32_t>(regs[1]);
+	}();
+
+	return xsave_size;
+}
+
+StubCode MidHookInstance::AllocStub(std::string& out_err)
+{
+	using namespace asmjit;
+
+	CodeHolder code;
+	code.init(px::lib_manager.GetRuntime()->environment());
+
+	x86::Assembler assembler(&code);
+	const bool is_32bit = assembler.is32Bit();
+	const uint32_t ptr_size = assembler.registerSize();
+	const uint32_t reg_count = is_32bit ? 8 : 16;
+
+	const auto gp = [is_32bit] (uint32_t id) { return is_32bit ? x86::gpd(id) : x86::gpq(id); };
+
+	CallConv call_conv;
+	if (const auto err = call_conv.init(CallConvId::kCDecl, code.environment()))
+	{
+		std::format_to(std::back_inserter(out_err), "Failed to initialize the calling convention (Code: {})", err);
+		return { };
+	}
+
+	// the callbacks may clobber every register the calling convention doesn't preserve
+	// the vector and x87 registers are saved whole by 'xsave', including the upper bits of ymm and zmm registers
+	const uint32_t all_regs = (1u << reg_count) - 1;
+	const uint32_t save_gp = (m_GpExposed | (all_regs & ~call_conv.preservedRegs(RegGroup::kGp))) & all_regs;
+	const uint32_t xsave_size = GetXSaveSize();
+
+	// 'anchor' holds the stack pointer of the hooked code, it's preserved by the callbacks
+	// 'scratch' is saved before it's used, and restored last
+	const x86::Gp anchor = gp(x86::Gp::kIdBx), scratch = gp(x86::Gp::kIdAx);
+	const x86::Gp sp = assembler.zsp();
+
+	// windows' calling conventions have no red zone, the hooked code doesn't keep anything below the stack pointer
+	is_32bit ? assembler.pushfd() : assembler.pushfq();
+	assembler.cld();
+	assembler.push(anchor);
+	assembler.mov(anchor, sp);
+
+	// the hooked code's stack may not be aligned at all, the extended state must be aligned to 64 bytes
+	const uint32_t spill_size = call_conv.spillZoneSize();
+	const uint32_t state_offset = static_cast<uint32_t>(Support::alignUp(spill_size + sizeof(MidHookContext), 64));
+	const uint32_t frame_size = static_cast<uint32_t>(Support::alignUp(state_offset + (xsave_size ? xsave_size : 512), 64));
+	assembler.and_(sp, -64);
+	assembler.sub(sp, frame_size);
+
+	const auto context = [&sp, spill_size] (size_t offset, uint32_t size)
+	{
+		return x86::ptr(sp, static_cast<int32_t>(spill_size + offset), size);
+	};
+	const auto gp_slot = [&context, ptr_size] (uint32_t id) { return context(offsetof(MidHookContext, Gp) + id * ptr_size, ptr_size); };
+	const auto xmm_slot = [&context] (uint32_t id) { return context(offsetof(MidHookContext, Xmm) + id * 16, 16); };
+
+	for (uint32_t id = 0; id < reg_count; id++)
+	{
+		if ((save_gp & (1u << id)) && id != x86::Gp::kIdSp && id != x86::Gp::kIdBx)
+			assembler.mov(gp_slot(id), gp(id));
+	}
+
+	if (m_GpExposed & (1u << x86::Gp::kIdBx))
+	{
+		assembler.mov(scratch, x86::ptr(anchor));
+		assembler.mov(gp_slot(x86::Gp::kIdBx), scratch);
+	}
+
+	assembler.mov(scratch, x86::ptr(anchor, ptr_size));
+	assembler.mov(context(offsetof(MidHookContext, Flags), ptr_size), scratch);
+	assembler.lea(scratch, x86::ptr(anchor, 2 * ptr_size));
+	assembler.mov(gp_slot(x86::Gp::kIdSp), scratch);
+
+	const x86::Mem state = x86::ptr(sp, static_cast<int32_t>(state_offset));
+	if (xsave_size)
+	{
+		// 'xsave' only writes the header's bits of the features it saves, 'xrstor' faults if any other bit is set
+		for (uint32_t offset = 512; offset < 576; offset += ptr_size)
+			assembler.mov(x86::ptr(sp, static_cast<int32_t>(state_offset + offset), ptr_size), 0);
+
+		// every feature the os enabled, eax and edx were saved above
+		assembler.mov(x86::eax, -1);
+		assembler.mov(x86::edx, -1);
+		is_32bit ? assembler.xsave(state, x86::edx, x86::eax) : assembler.xsave64(state, x86::edx, x86::eax);
+	}
+	else is_32bit ? assembler.fxsave(state) : assembler.fxsave64(state);
+
+	for (uint32_t id = 0; id < reg_count; id++)
+	{
+		if (m_XmmExposed & (1u << id))
+			assembler.movups(xmm_slot(id), x86::xmm(id));
+	}
+
+	assembler.mov(context(offsetof(MidHookContext, GpExposed), 2), m_GpExposed);
+	assembler.mov(context(offsetof(MidHookContext, XmmExposed), 2), m_XmmExposed);
+
+	assembler.mov(scratch, reinterpret_cast<uintptr_t>(&m_CallsInFlight));
+	assembler.lock().inc(x86::dword_ptr(scratch));
+
+	// RunCallbacks(this, &context)
+	if (is_32bit)
+	{
+		assembler.lea(scratch, context(0, 0));
+		assembler.push(scratch);
+		assembler.push(Imm(reinterpret_cast<uintptr_t>(this)));
+		assembler.call(Imm(reinterpret_cast<uintptr_t>(&RunCallbacks)));
+		assembler.add(sp, 2 * ptr_size);
+	}
+	else
+	{
+		const uint8_t* arg_order = call_conv.passedOrder(RegGroup::kGp);
+		assembler.mov(x86::gpq(arg_order[0]), reinterpret_cast<uintptr_t>(this));
+		assembler.lea(x86::gpq(arg_order[1]), context(0, 0));
+		assembler.mov(scratch, reinterpret_cast<uintptr_t>(&RunCallbacks));
+		assembler.call(scratch);
+	}
+
+	if (xsave_size)
+	{
+		assembler.mov(x86::eax, -1);
+		assembler.mov(x86::edx, -1);
+		is_32bit ? assembler.xrstor(state, x86::edx, x86::eax) : assembler.xrstor64(state, x86::edx, x86::eax);
+	}
+	else is_32bit ? assembler.fxrstor(state) : assembler.fxrstor64(state);
+
+	// only the low bits of the exposed registers are written back, the rest is restored as it was
+	for (uint32_t id = 0; id < reg_count; id++)
+	{
+		if (m_XmmExposed & (1u << id))
+			assembler.movups(x86::xmm(id), xmm_slot(id));
+	}
+
+	// write back the registers saved above the frame
+	if (m_GpExposed & (1u << x86::Gp::kIdBx))
+	{
+		assembler.mov(scratch, gp_slot(x86::Gp::kIdBx));
+		assembler.mov(x86::ptr(anchor), scratch);
+	}
+	assembler.mov(scratch, context(offsetof(MidHookContext, Flags), ptr_size));
+	assembler.mov(x86::ptr(anchor, ptr_size), scratch);
+
+	assembler.mov(scratch, reinterpret_cast<uintptr_t>(&m_CallsInFlight));
+	assembler.lock().dec(x86::dword_ptr(scratch));
+
+	for (uint32_t id = 0; id < reg_count; id++)
+	{
+		if ((save_gp & (1u << id)) && id != x86::Gp::kIdSp && id != x86::Gp::kIdBx)
+			assembler.mov(gp(id), gp_slot(id));
+	}
+
+	assembler.mov(sp, anchor);
+	assembler.pop(anchor);
+	is_32bit ? assembler.popfd() : assembler.popfq();
+
+	// resume at the relocated instructions, every register is already restored
+	const uintptr_t trampoline = reinterpret_cast<uintptr_t>(&m_Detour) + detour_detail::Detour::offset_to_m_ActualFunc();
+	const Label
+		L_Resume = assembler.newLabel(),
+		L_ReadTrampoline = assembler.newLabel();
+	if (is_32bit)
+		assembler.jmp(x86::dword_ptr_abs(trampoline));
+	else
+	{
+		// the detour's field may be out of reach of a rip relative jump, jump through a copy stored in the stub instead, see 'UpdateResume'
+		assembler.jmp(x86::ptr(L_Resume));
+
+		// the copy points here while the trampoline may change, read it when the jump is taken and return to it
+		assembler.bind(L_ReadTrampoline);
+		assembler.push(scratch);
+		assembler.push(scratch);
+		assembler.mov(scratch, trampoline);
+		assembler.mov(scratch, x86::ptr(scratch));
+		assembler.mov(x86::ptr(sp, ptr_size), scratch);
+		assembler.pop(scratch);
+		assembler.ret();
+
+		assembler.align(AlignMode::kData, sizeof(void*));
+		assembler.bind(L_Resume);
+		assembler.embedLabel(L_ReadTrampoline);
+	}
+
+	void* fn;
+	if (const auto err = px::lib_manager.GetRuntime()->add(&fn, &code))
+	{
+		std::format_to(std::back_inserter(out_err), "Failed to add the stub to JIT runtime (Code: {})", err);
+		return { };
+	}
+
+	if (!is_32bit)
+	{
+		m_ResumeSlot = reinterpret_cast<void**>(static_cast<uint8_t*>(fn) + code.labelOffsetFromBase(L_Resume));
+		m_ReadTrampoline = static_cast<uint8_t*>(fn) + code.labelOffsetFromBase(L_ReadTrampoline);
+	}
+
+	return { fn, code.codeSize() };
+}
+
+void MidHookInstance::UpdateResume() noexcept
+{
+	SetResume(m_Detour.is_set() ? m_Detour.original_function() : m_ReadTrampoline);
+}
+
+void MidHookInstance::SetResume(void* resume) noexcept
+{
+	if (!m_ResumeSlot)
+		return;
+
+	// stubs share their pages, a page must not be made read only again while another slot is written
+	static std::mutex protect_lock;
+	std::scoped_lock lock(protect_lock);
+
+	std::atomic_ref slot(*m_ResumeSlot);
+	if (slot.load(std::memory_order_relaxed) == resume)
+		return;
+
+	DWORD old_protect;
+	if (!VirtualProtect(m_ResumeSlot, sizeof(void*), PAGE_EXECUTE_READWRITE, &old_protect))
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Failed to update the mid hook's resume address."),
+			PX_LOGARG("Error", GetLastError())
+		);
+		return;
+	}
+
+	// the slot is aligned, threads jumping through it read either the old or the new address
+	slot.store(resume, std::memory_order_release);
+	VirtualProtect(m_ResumeSlot, sizeof(void*), old_protect, &old_protect);
+}
+
+void MidHookInstance::RunCallbacks(MidHookInstance* instance, MidHookContext* context)
+{
+	detour_detail::EpochGuard guard;
+
+	const CallbackList* callbacks = instance->m_Callbacks.load(std::memory_order_acquire);
+	if (!callbacks)
+		return;
+
+	for (const CallbackInfo& info : *callbacks)
+		info.Callback(*context);
+}
+
+void MidHookInstance::ReleaseStub() noexcept
+{
+	if (m_Stub.Code)
+		px::lib_manager.GetRuntime()->release(m_Stub.Code);
+	m_Stub = { };
+}
+
+bool MidHookInstance::WaitForCalls(std::chrono::steady_clock::time_point deadline) const
+{
+	using namespace std::chrono_literals;
+	while (GetCallsInFlight())
+	{
+		if (std::chrono::steady_clock::now() >= deadline)
+			return false;
+		std::this_thread::sleep_for(1ms);
+	}
+	return true;
+}
+
+void MidHookInstance::Activate()
+{
+	assert(!m_Detour.is_set() && m_Stub.Code);
+	if (m_Stub.Code)
+	{
+		m_Detour.attach();
+		// the trampoline isn't allocated until the batch is committed, see 'DetoursManager::CommitBatch'
+		if (!detour_detail::DetourBatch::IsActive())
+			UpdateResume();
+	}
+}
+
+void MidHookInstance::Deactivate()
+{
+	assert(m_Detour.is_set() && m_Stub.Code);
+	if (m_Stub.Code)
+	{
+		this->ClearCallbacks();
+		// the trampoline is freed once the detour is detached
+		SetResume(m_ReadTrampoline);
+		m_Detour.detach();
+	}
+}
+
+
+auto MidHookInstance::AddCallback(px::HookOrder order, const CallbackType& callback) -> HookID
+{
+	std::lock_guard lock(m_CallbacksLock);
+
+	const HookID id = m_CallbackIds.insert(order);
+	if (id == px::IHookInstance::InvalidId)
+		return px::IHookInstance::InvalidId;
+
+	const CallbackList* cur_list = m_Callbacks.load(std::memory_order_relaxed);
+	auto new_list = cur_list ? std::make_unique<CallbackList>(*cur_list) : std::make_unique<CallbackList>();
+
+	auto pos = std::upper_bound(
+		new_list->begin(), new_list->end(), order,
+		[] (px::HookOrder order, const CallbackInfo& o) { return order < o.Order; }
+	);
+	new_list->emplace(pos, callback, order, id);
+
+	PublishCallbacks(new_list.release());
+	return id;
+}
+
+void MidHookInstance::RemoveCallback(HookID id)
+{
+	std::lock_guard lock(m_CallbacksLock);
+
+	const px::HookOrder* order = m_CallbackIds.find(id);
+	if (!order)
+		return;
+
+	auto new_list = std::make_unique<CallbackList>(*m_Callbacks.load(std::memory_order_relaxed));
+	auto iter = std::lower_bound(
+		new_list->begin(), new_list->end(), *order,
+		[] (const CallbackInfo& o, px::HookOrder order) { return o.Order < order; }
+	);
+	new_list->erase(std::find(iter, new_list->end(), id));
+	m_CallbackIds.erase(id);
+
+	PublishCallbacks(new_list->empty() ? nullptr : new_list.release());
+}
+
+void MidHookInstance::ClearCallbacks() noexcept
+{
+	std::lock_guard lock(m_CallbacksLock);
+	m_CallbackIds.clear();
+	PublishCallbacks(nullptr);
+}
+
+void MidHookInstance::PublishCallbacks(const CallbackList* callbacks) noexcept
+{
+	// threads still running the old list keep it alive until they leave their guard
+	detour_detail::Epoch::Retire(m_Callbacks.exchange(callbacks, std::memory_order_acq_rel));
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <nlohmann/json_fwd.hpp>
+
+#include <px/interfaces/HooksManager.hpp>
+#include <px/intptr.hpp>
+
+#include "Detour.hpp"
+#include "HookInstance.hpp"
+#include "library/SlotMap.hpp"
+
+
+/// <summary>
+/// Registers at a mid function hook, only the registers exposed by the hook's entry are valid
+/// modifying a register writes it back when the stub resumes the function, except for the stack pointer
+/// xmm registers are exposed by their low 128 bits, the upper bits of ymm and zmm registers and the x87 state are preserved but can't be read
+/// </summary>
+struct MidHookContext
+{
+	// by register id: ax, cx, dx, bx, sp, bp, si, di, then r8 to r15 on x64
+	uintptr_t Gp[16];
+	uintptr_t Flags;
+	alignas(16) uint8_t Xmm[16][16];
+
+	// a bit for each register id, set if the register is exposed
+	uint16_t GpExposed;
+	uint16_t XmmExposed;
+
+	[[nodiscard]] bool is_exposed(asmjit::x86::Gp reg) const noexcept { return GpExposed & (1u << reg.id()); }
+	[[nodiscard]] bool is_exposed(asmjit::x86::Xmm reg) const noexcept { return XmmExposed & (1u << reg.id()); }
+
+	[[nodiscard]] uintptr_t& gp(asmjit::x86::Gp reg) noexcept { return Gp[reg.id()]; }
+
+	template<typename _Ty>
+		requires (sizeof(_Ty) <= 16)
+	[[nodiscard]] _Ty& xmm(asmjit::x86::Xmm reg) noexcept { return *reinterpret_cast<_Ty*>(&Xmm[reg.id()][0]); }
+};
+
+
+/// <summary>
+/// Hook in the middle of a function, eg: a single basic block
+/// the function is detoured at the hook's address, msdetour relocates the instructions it overwrites to its trampoline
+/// the stub saves the exposed registers, calls the callbacks with them, writes them back then resumes at the trampoline
+///
+/// the hook's address must be at the start of an instruction, and at least 5 bytes must be left before the end of the basic block
+///
+/// eg:
+/// "MyMidHook": {
+///		"Signature": { "name": "MyFunction" },
+///		"Offset": 32,
+///		"Registers": [ "eax", "ecx", "xmm0" ]
+/// }
+/// </summary>
+class MidHookInstance
+{
+public:
+	using CallbackType = std::function<void(MidHookContext&)>;
+	using HookID = px::IHookInstance::HookID;
+
+	MidHookInstance(px::IntPtr address, const nlohmann::json& data, std::string& out_err);
+	~MidHookInstance() noexcept;
+
+	MidHookInstance(const MidHookInstance&) = delete;
+	MidHookInstance& operator=(const MidHookInstance&) = delete;
+
+	/// <summary>
+	/// Add a callback called with the hook's registers, callbacks are called in 'HookOrder'
+	/// </summary>
+	/// <returns>id of the callback, 'px::IHookInstance::InvalidId' if the hook has too many callbacks</returns>
+	[[nodiscard]] HookID AddCallback(px::HookOrder order, const CallbackType& callback);
+
+	void RemoveCallback(HookID id);
+
+	void ClearCallbacks() noexcept;
+
+	void Activate();
+	void Deactivate();
+
+	/// <summary>
+	/// Check that every register of a hook's entry is exposed by this hook
+	/// </summary>
+	[[nodiscard]] bool ExposesRegisters(const nlohmann::json& data, std::string& out_err) const;
+
+	[[nodiscard]] const detour_detail::Detour& GetDetour() const noexcept { return m_Detour; }
+
+	[[nodiscard]] const StubCode& GetStub() const noexcept { return m_Stub; }
+
+	[[nodiscard]] uint32_t GetCallsInFlight() const noexcept { return m_CallsInFlight.load(std::memory_order_acquire); }
+
+	/// <summary>
+	/// Wait until every call inside the hook's stub returned, see 'HookInstance::WaitForCalls'
+	/// </summary>
+	[[nodiscard]] bool WaitForCalls(std::chrono::steady_clock::time_point deadline) const;
+
+	/// <summary>
+	/// Release the hook's stub, the hook must be detached and no thread may be running it
+	/// </summary>
+	void ReleaseStub() noexcept;
+
+	/// <summary>
+	/// Point the x64 stub's resume address to the detour's trampoline if it's attached, must be called once the detour's batch is committed
+	/// </summary>
+	void UpdateResume() noexcept;
+
+	size_t RefCount{ 1 };
+
+private:
+	struct CallbackInfo
+	{
+		CallbackType	Callback;
+		px::HookOrder	Order;
+		HookID			Id;
+
+		bool operator==(const HookID& o) const noexcept { return Id == o; }
+	};
+	using CallbackList = std::vector<CallbackInfo>;
+
+	/// <summary>
+	/// Read the registers to expose from the hook's entry
+	/// </summary>
+	[[nodiscard]] static bool ReadRegisters(const nlohmann::json& data, bool is_32bit, uint16_t& gp_mask, uint16_t& xmm_mask, std::string& out_err);
+
+	/// <summary>
+	/// Assemble the hook's stub, it saves the exposed registers and the ones the callbacks may clobber, calls 'RunCallbacks' then restores them
+	/// </summary>
+	[[nodiscard]] StubCode AllocStub(std::string& out_err);
+
+	/// <summary>
+	/// Write the address the x64 stub jumps through once the registers are restored
+	/// </summary>
+	void SetResume(void* resume) noexcept;
+
+	/// <summary>
+	/// Called by the stub, with a calling convention the stub can emit on every target
+	/// </summary>
+	static void RunCallbacks(MidHookInstance* instance, MidHookContext* context);
+
+	/// <summary>
+	/// Publish a new callback list and retire the old one, 'm_CallbacksLock' must be held
+	/// </summary>
+	void PublishCallbacks(const CallbackList* callbacks) noexcept;
+
+	// immutable list sorted by 'CallbackInfo::Order', read without locks by 'RunCallbacks' inside an 'EpochGuard'
+	std::atomic<const CallbackList*> m_Callbacks{ };
+	// incremented by the stub once the registers are saved, decremented right before they are restored
+	std::atomic<uint32_t> m_CallsInFlight{ };
+
+	uint16_t m_GpExposed{ };
+	uint16_t m_XmmExposed{ };
+
+	StubCode m_Stub;
+	// x64 only, in the stub, either the trampoline or 'm_ReadTrampoline' which reads it at each call while it may change
+	void** m_ResumeSlot{ };
+	void* m_ReadTrampoline{ };
+
+	// order of every callback, 'm_CallbacksLock' must be held
+	library_detail::SlotMap<px::HookOrder> m_CallbackIds;
+	// serialize writers
+	std::mutex m_CallbacksLock;
+
+	detour_detail::Detour m_Detour;
+};
@@ -11,7 +11,7 @@ namespace detour_detail
 		// return value = the value to be inserted in funcsig
 		// &type = the value to be inserted with 'x86::Compiler::_newReg()' in the future
 		//
-		// the function will be used later on for resolving 'm_RetTypes' and 'm_ArgTypes'
+		// the function will be used later on for resolving 'm_RetType' and 'm_ArgTypes'
 		const auto resolve_type =
 			[] (TypeId& type) -> TypeId
 		{
@@ -86,25 +86,26 @@ namespace detour_detail
 		// Read return types
 		{
 			// support for faster type access instead of it being registered in 'Pleiades.JITTypes.json'
-			m_RetTypes = m_Types.load_type(sig_data["return"]);
+			m_RetType = m_Types.load_type(sig_data["return"]);
 			
-			if (m_RetTypes.empty())
+			if (m_RetType.Types.empty())
 			{
 				err = "Invalid return type";
 				return;
 			}
 
-			// if (m_RetTypes.size() > 1) we wouldn't care about 'final_ret_sig'
+			// if (m_RetType.Types.size() > 1) we wouldn't care about 'final_ret_sig'
 			TypeId final_ret_sig{ };
-			for (TypeId& type : m_RetTypes)
+			for (TypeId& type : m_RetType.Types)
 			{
 				final_ret_sig = resolve_type(type);
 			}
 
 			// if the type's size is bigger than 1 type, it should return in the stack, else we will use m_RetType[0] (either void, int, etc)
-			if (m_RetTypes.size() > 1)
+			if (m_RetType.Types.size() > 1)
 			{
-				m_FuncSig.setRetT<void>();
+				// the callee returns the pointer it was passed, on every convention
+				m_FuncSig.setRetT<void*>();
 				m_FuncSig.addArgT<void*>();
 			}
 			else
@@ -124,7 +125,7 @@ namespace detour_detail
 				m_ArgTypes.reserve(args->size());
 				for (auto& arg : *args)
 				{
-					auto& fullarg = m_ArgTypes.emplace_back(m_Types.load_type(arg["type"]), arg.contains("const") ? static_cast<bool>(arg["const"]) : false).first;
+					auto& fullarg = m_ArgTypes.emplace_back(m_Types.load_type(arg["type"]), arg.contains("const") ? static_cast<bool>(arg["const"]) : false).first.Types;
 
 					if (fullarg.empty() || fullarg[0] == TypeId::kVoid)
 					{
@@ -145,18 +146,24 @@ namespace detour_detail
 	}
 
 
-	std::unique_ptr<DetourCallContext> SigBuilder::load_args(asmjit::x86::Compiler& comp, TypeInfo& info)
+	asmjit::FuncNode* SigBuilder::add_func(asmjit::x86::Compiler& comp)
 	{
 		using namespace asmjit;
 
-		const bool is_thiscall = m_FuncSig.callConvId() == CallConvId::kThisCall;
+		m_IsThisCall = m_FuncSig.callConvId() == CallConvId::kThisCall;
 		// a hacky way to make va_args works in asmjit with thiscall convention
 		// otherwise it will grab a garbage ecx register, and treat the actual thisptr pushed in the stack as an argument
-		if (is_thiscall && m_FuncSig.hasVarArgs())
+		if (m_IsThisCall && m_FuncSig.hasVarArgs())
 			m_FuncSig.setCallConvId(CallConvId::kHost);
 
 		FuncNode* pFunc = comp.addFunc(m_FuncSig);
 		this->ManageFuncFrame(pFunc->frame());
+		return pFunc;
+	}
+
+	std::unique_ptr<DetourCallContext> SigBuilder::load_args(asmjit::x86::Compiler& comp, asmjit::FuncNode* pFunc, TypeInfo& info)
+	{
+		using namespace asmjit;
 
 		size_t arg_pos = 0;
 
@@ -164,7 +171,7 @@ namespace detour_detail
 
 		// if the convention is |this| call
 		// set the first arg for compiler to IntPtr and insert a 'void*' type to 'arg_buf'
-		if (is_thiscall)
+		if (m_IsThisCall)
 		{
 			info.m_ContainThisPtr = true;
 			arg_buf.emplace_back(sizeof(void*), m_SigInfo.contains("mutable") ? m_SigInfo["mutable"].get<bool>() : true);
@@ -175,16 +182,16 @@ namespace detour_detail
 		// Set return in compiler
 		{
 			// if the return value is on the stack, set push the arg_pos and advance it in compiler
-			if (m_RetTypes.size() > 1)
+			if (m_RetType.Types.size() > 1)
 			{
 				info.m_RetType = TypeInfo::RetType::RetMem;
-				info.m_Ret[0] = { comp.newUInt32(), 4 };
+				info.m_Ret[0] = { comp.newUIntPtr(), sizeof(void*) };
 				pFunc->setArg(arg_pos++, info.m_Ret[0].Reg);
 			}
 			else if (m_FuncSig.hasRet())
 			{
 				// check if we're in a 32bits env and if we should split the register
-				if (const TypeId type = m_RetTypes[0]; (TypeUtils::isInt64(type) || TypeUtils::isUInt64(type)) && comp.is32Bit())
+				if (const TypeId type = m_RetType.Types[0]; (TypeUtils::isInt64(type) || TypeUtils::isUInt64(type)) && comp.is32Bit())
 				{
 					info.m_RetType = TypeInfo::RetType::RetRegx2;
 					for (auto& ret : info.m_Ret)
@@ -193,7 +200,7 @@ namespace detour_detail
 				else
 				{
 					info.m_RetType = TypeInfo::RetType::RetReg;
-					info.m_Ret[0] = { comp.newReg(type), TypeUtils::sizeOf(m_RetTypes[0]) };
+					info.m_Ret[0] = { comp.newReg(type), TypeUtils::sizeOf(m_RetType.Types[0]) };
 				}
 			}
 			else
@@ -202,12 +209,11 @@ namespace detour_detail
 
 		// Set args in compiler
 		{
-			for (auto& [types, is_const] : m_ArgTypes)
+			for (auto& [arg_type, is_const] : m_ArgTypes)
 			{
-				size_t underlying_size = m_Types.get_size(types);
-				arg_buf.emplace_back(underlying_size, is_const);
+				arg_buf.emplace_back(arg_type.Size, is_const);
 
-				for (const TypeId type : types)
+				for (const TypeId type : arg_type.Types)
 				{
 					// get type's true size, if it's [U]IntPtr, convert it to [U]Int32/[U]Int64
 					size_t type_size = TypeUtils::sizeOf(type);
@@ -236,8 +242,9 @@ namespace detour_detail
 
 		DetourCallContext::InitToken token{
 			.FuncSig = m_FuncSig,
-			.RetData = m_Types.get_size(m_RetTypes),
-			.ArgsData{ std::move(arg_buf), is_thiscall }
+			.RetSize = m_RetType.Size,
+			.ArgsInfo = std::move(arg_buf),
+			.HasThisPtr = m_IsThisCall
 		};
 
 		return std::make_unique<DetourCallContext>(std::move(token));
@@ -279,15 +286,12 @@ namespace detour_detail
 
 	void SigBuilder::ManageFuncFrame(asmjit::FuncFrame& func_frame) const
 	{
+		// the frame pointer is always kept, the detour reads the caller's stack pointer from it
+		func_frame.setPreservedFP();
+
 		const auto flags = m_SigInfo.find("Flags");
 		if (flags == m_SigInfo.end())
-		{
-			func_frame.setPreservedFP();
 			return;
-		}
-		
-		if (const auto fp = flags->find("no FP"); fp != flags->end() || !fp->get<bool>())
-			func_frame.setPreservedFP();
 
 		using FrameAttributes = asmjit::FuncAttributes;
 
@@ -151,7 +151,15 @@ namespace detour_detail
 			return m_FuncSig;
 		}
 
-		[[nodiscard]] std::unique_ptr<DetourCallContext> load_args(asmjit::x86::Compiler& comp, TypeInfo& info);
+		/// <summary>
+		/// Begin the function, the args are still in the registers the caller put them in until 'load_args' binds them
+		/// </summary>
+		[[nodiscard]] asmjit::FuncNode* add_func(asmjit::x86::Compiler& comp);
+
+		/// <summary>
+		/// Bind the return value and the args of a function started by 'add_func' to virtual registers
+		/// </summary>
+		[[nodiscard]] std::unique_ptr<DetourCallContext> load_args(asmjit::x86::Compiler& comp, asmjit::FuncNode* pFunc, TypeInfo& info);
 
 	private:
 		void SetCallConv(const std::string& callconv);
@@ -164,18 +172,20 @@ namespace detour_detail
 		/// 'return' section
 		/// contains full types of return value
 		/// </summary>
-		std::vector<asmjit::TypeId> m_RetTypes;
+		TypeTable::ResolvedType m_RetType;
 
 		/// <summary>
 		/// 'Arguments' section
 		/// first pair is the underlying type
 		/// second pair is for 'constness' of the type
 		/// </summary>
-		std::vector<std::pair<std::vector<asmjit::TypeId>, bool>> m_ArgTypes;
+		std::vector<std::pair<TypeTable::ResolvedType, bool>> m_ArgTypes;
 
 		const nlohmann::json& m_SigInfo;
 
 		bool m_MutableThisPtr{ };
-		TypeTable m_Types;
+		// set by 'add_func', the convention may be changed for variadic thiscalls
+		bool m_IsThisCall{ };
+		const TypeTable& m_Types = TypeTable::get();
 	};
 }
@@ -0,0 +1,443 @@
+#include <bit>
+#include <format>
+
+#include "StubCompiler.hpp"
+#include "HookStats.hpp"
+
+namespace detour_detail
+{
+	StubCode StubCompiler::Compile(
+		SigBuilder& sigbuilder,
+		std::shared_ptr<DetourCallContext>& context,
+		std::span<const InlineHookInfo> inline_callbacks,
+		std::atomic<uint32_t>* inline_calls,
+		std::string& out_err
+	) const
+	{
+		using namespace asmjit;
+
+		CodeHolder code;
+		code.init(m_Runtime.environment());
+
+		x86::Compiler comp(&code);
+
+		// the instance register is used to pass args in those
+		if (comp.is32Bit())
+		{
+			switch (sigbuilder.get_sig().callConvId())
+			{
+			case CallConvId::kRegParm1:
+			case CallConvId::kRegParm2:
+			case CallConvId::kRegParm3:
+			case CallConvId::kLightCall2:
+			case CallConvId::kLightCall3:
+			case CallConvId::kLightCall4:
+				out_err = "Calling convention isn't supported by detours.";
+				return { };
+
+			default: break;
+			}
+		}
+
+		EmitBypass(comp);
+
+		FuncNode* pFunc = sigbuilder.add_func(comp);
+
+		// copy the instance first, once the args are bound the register allocator may assign one of them to the instance register
+		const x86::Gp instance = comp.newIntPtr();
+		comp.mov(instance, InstanceRegister(comp.is32Bit()));
+
+		TypeInfo typeInfo;
+		// stubs of the same signature have the same layout, keep the first context, frames of calls in flight are keyed by its id
+		if (std::unique_ptr<DetourCallContext> new_context = sigbuilder.load_args(comp, pFunc, typeInfo); !context)
+			context = std::move(new_context);
+
+		x86::Gp handler_res = comp.newUInt8();
+		const Label
+			L_PostCode = comp.newLabel(),
+			L_Return = comp.newLabel();
+
+		// args, return value and stack pointer of the current call live on the stub's own stack
+		// so concurrent and recursive calls never share them
+		const x86::Mem frame_data = comp.newStack(static_cast<uint32_t>(context->frame_data_size()), 16);
+		const x86::Mem stats_data = comp.newStack(sizeof(HookStats::CallData), alignof(HookStats::CallData));
+
+		DataInfo info{
+			.typeInfo = typeInfo,
+			.Compiler = comp,
+			.Context = *context,
+			.FrameData = frame_data,
+			.Instance = instance,
+			.Stats = stats_data
+		};
+
+		if (!ValidateRegisters(info, out_err))
+			return { };
+
+		// the frame pointer is preserved, the caller's stack pointer is right above the saved frame pointer
+		{
+			const x86::Gp stack_ptr = comp.newIntPtr();
+			comp.lea(stack_ptr, x86::ptr(comp.is32Bit() ? x86::ebp : x86::rbp, static_cast<int32_t>(comp.registerSize())));
+			comp.mov(frame_data.cloneAdjusted(context->stack_pointer_offset()), stack_ptr);
+		}
+
+		EmitStats(info, StatsCall::Enter);
+
+		if (!inline_callbacks.empty())
+		{
+			InvokeInlineCallbacks(info, inline_callbacks, inline_calls, L_Return);
+			EmitStats(info, StatsCall::RecordPre);
+
+			// only inline callbacks, call the original function without going through the handler
+			const Label L_Handler = comp.newLabel();
+			comp.test(x86::byte_ptr(instance, m_Layout.Flags), HasPreCallbacks | HasPostCallbacks);
+			comp.jnz(L_Handler);
+
+			InvokeOriginal(info);
+			comp.jmp(L_Return);
+
+			comp.bind(L_Handler);
+		}
+
+		InvokeCallbacks(info, false, handler_res);
+		EmitStats(info, StatsCall::RecordPre);
+		comp.test(handler_res, CallOriginal);
+
+		comp.jz(L_PostCode);
+
+		InvokeOriginal(info);
+
+		// no post hooks to run, the original's return value is still in its registers
+		comp.test(handler_res, RunPost);
+		comp.jz(L_Return);
+
+		ReadReturn(info);
+
+		comp.bind(L_PostCode);
+
+		InvokeCallbacks(info, true, handler_res);
+		EmitStats(info, StatsCall::RecordPost);
+
+		WriteReturn(info, L_Return);
+
+		comp.endFunc();
+		if (const auto err = comp.finalize())
+		{
+			std::format_to(std::back_inserter(out_err), "Failed to finalize the x86::Compiler (Code: {})", err);
+			return { };
+		}
+
+		void* fn;
+		if (const auto err = m_Runtime.add(&fn, &code))
+		{
+			std::format_to(std::back_inserter(out_err), "Failed to add the function to JIT runtime (Code: {})", err);
+			return { };
+		}
+
+		return { fn, code.codeSize() };
+	}
+
+	void StubCompiler::EmitBypass(asmjit::x86::Compiler& comp) const
+	{
+		using namespace asmjit;
+
+		// emitted before 'addFunc', the function's frame wasn't set up yet and all args are still where the caller put them
+		// so only touch the flags register and the instance register
+		const Label L_Hooked = comp.newLabel();
+		const x86::Gp& instance = InstanceRegister(comp.is32Bit());
+
+		comp.test(x86::byte_ptr(instance, m_Layout.Flags), HasPreCallbacks | HasPostCallbacks | HasInlineCallbacks);
+		comp.jnz(L_Hooked);
+		comp.jmp(x86::ptr(instance, m_Layout.ActualFunc, comp.registerSize()));
+
+		comp.bind(L_Hooked);
+		// decremented by 'WriteReturn', the few instructions before and after are covered by checking the threads' instruction pointer on release
+		comp.lock().inc(x86::dword_ptr(instance, m_Layout.CallsInFlight));
+	}
+
+	bool StubCompiler::ValidateRegisters(DataInfo info, std::string& out_err)
+	{
+		const auto& comp = info.Compiler;
+		const auto& typeInfo = info.typeInfo;
+
+		if (typeInfo.has_ret())
+		{
+			if (!comp.isVirtRegValid(typeInfo.ret()))
+			{
+				out_err = "Invalid return value register id";
+				return false;
+			}
+
+			if (typeInfo.has_regx2())
+			{
+				if (!comp.isVirtRegValid(typeInfo.ret(true)))
+				{
+					out_err = "Invalid return value register id (2nd register)";
+					return false;
+				}
+			}
+		}
+
+		if (typeInfo.has_this_ptr())
+		{
+			if (!comp.isVirtRegValid(typeInfo.this_()))
+			{
+				out_err = "Invalid |this| pointer register id";
+				return false;
+			}
+		}
+
+		for (auto& arg : typeInfo.args_iterator())
+		{
+			if (!comp.isVirtRegValid(arg.Reg) || (arg.ExtraReg.isValid() && !comp.isVirtRegValid(arg.ExtraReg)))
+			{
+				out_err = "Invalid arg register id";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void StubCompiler::InvokeCallbacks(DataInfo info, bool post, const asmjit::x86::Gp& ret) const
+	{
+		using namespace asmjit;
+
+		// we don't want to reload args two times, we will just do once it in pre hooks
+		if (!post)
+			info.Context.ManageArgs(info.typeInfo, info.Compiler, info.FrameData, true);
+
+		x86::Gp frame_data = info.Compiler.newIntPtr();
+		info.Compiler.lea(frame_data, info.FrameData);
+
+		InvokeNode* pFunc;
+		info.Compiler.invoke(&pFunc, std::bit_cast<void*>(m_Layout.Handler), FuncSignatureT<uint8_t, void*, bool, std::byte*>(CallConvId::kCDecl));
+
+		pFunc->setArg(0, info.Instance);
+		pFunc->setArg(1, post);
+		pFunc->setArg(2, frame_data);
+		pFunc->setRet(0, ret);
+
+		if (!post)
+			info.Context.ManageArgs(info.typeInfo, info.Compiler, info.FrameData, false);
+	}
+
+
+	void StubCompiler::InvokeOriginal(DataInfo info) const
+	{
+		using namespace asmjit;
+
+		InvokeNode* pFunc;
+		info.Compiler.invoke(
+			&pFunc,
+			x86::ptr(info.Instance, m_Layout.ActualFunc, info.Compiler.registerSize()),
+			info.Context.m_FuncSig
+		);
+
+		SetCallArgs(info.typeInfo, pFunc);
+
+		// if it contains a return, grab it
+		if (info.typeInfo.has_ret())
+		{
+			const BaseReg& ret0 = info.typeInfo.ret();
+			pFunc->setRet(0, ret0);
+
+			const BaseReg& ret1 = info.typeInfo.has_regx2() ? info.typeInfo.ret(true) : BaseReg{ };
+			if (ret1.isValid())
+				pFunc->setRet(1, ret1);
+		}
+
+		EmitStats(info, StatsCall::RecordOriginal);
+	}
+
+	void StubCompiler::EmitStats(DataInfo info, StatsCall call) const
+	{
+		using namespace asmjit;
+
+		auto& comp = info.Compiler;
+		const auto stats_field = [&info] (size_t offset, uint32_t size)
+		{
+			x86::Mem mem = info.Stats.cloneAdjusted(static_cast<int64_t>(offset));
+			mem.setSize(size);
+			return mem;
+		};
+
+		const Label L_Skip = comp.newLabel();
+		if (call == StatsCall::Enter)
+		{
+			comp.mov(stats_field(offsetof(HookStats::CallData, Active), 1), 0);
+			comp.mov(stats_field(offsetof(HookStats::CallData, CalledOriginal), 1), 0);
+
+			const x86::Gp enabled = comp.newIntPtr();
+			comp.mov(enabled, reinterpret_cast<uintptr_t>(HookStats::GetEnabledFlag()));
+			comp.cmp(x86::byte_ptr(enabled), 0);
+		}
+		else comp.cmp(stats_field(offsetof(HookStats::CallData, Active), 1), 0);
+		comp.je(L_Skip);
+
+		const x86::Gp data = comp.newIntPtr();
+		comp.lea(data, info.Stats);
+
+		InvokeNode* pFunc;
+		if (call == StatsCall::Enter)
+		{
+			comp.invoke(&pFunc, std::bit_cast<void*>(&HookStats::Enter), FuncSignatureT<void, HookStats::CallData*>(CallConvId::kCDecl));
+			pFunc->setArg(0, data);
+		}
+		else
+		{
+			const x86::Gp index = comp.newUInt32();
+			comp.mov(index, x86::dword_ptr(info.Instance, m_Layout.StatsIndex));
+
+			if (call == StatsCall::Leave)
+			{
+				comp.invoke(&pFunc, std::bit_cast<void*>(&HookStats::Leave), FuncSignatureT<void, uint32_t, HookStats::CallData*>(CallConvId::kCDecl));
+			}
+			else
+			{
+				const HookStats::Time time =
+					call == StatsCall::RecordPre ? HookStats::Time::Pre :
+					call == StatsCall::RecordPost ? HookStats::Time::Post : HookStats::Time::Original;
+
+				comp.invoke(&pFunc, std::bit_cast<void*>(&HookStats::Record), FuncSignatureT<void, uint32_t, HookStats::CallData*, uint32_t>(CallConvId::kCDecl));
+				pFunc->setArg(2, Imm(static_cast<uint32_t>(time)));
+			}
+			pFunc->setArg(0, index);
+			pFunc->setArg(1, data);
+		}
+
+		comp.bind(L_Skip);
+	}
+
+	void StubCompiler::InvokeInlineCallbacks(DataInfo info, std::span<const InlineHookInfo> inline_callbacks, std::atomic<uint32_t>* calls_in_flight, const asmjit::Label& L_Return)
+	{
+		using namespace asmjit;
+		using px::HookRes;
+
+		auto& comp = info.Compiler;
+		const x86::Gp res = comp.newUInt32();
+		const Label
+			L_Done = comp.newLabel(),
+			L_DontCall = comp.newLabel();
+
+		// the callbacks may live in a plugin being unloaded, 'DetoursManager::WaitForCallbacks' waits for the count to drop
+		const x86::Gp counter = comp.newIntPtr();
+		comp.mov(counter, reinterpret_cast<uintptr_t>(calls_in_flight));
+		comp.lock().inc(x86::dword_ptr(counter));
+
+		for (const InlineHookInfo& hook : inline_callbacks)
+		{
+			InvokeNode* pFunc;
+			comp.invoke(&pFunc, hook.Callback, hook.Signature);
+			SetCallArgs(info.typeInfo, pFunc);
+			pFunc->setRet(0, res);
+
+			const Label L_Next = comp.newLabel();
+			comp.test(res, InlineHookRes(HookRes::Ignored));
+			comp.jnz(L_Next);
+
+			// there is no return value to return instead of the original's
+			if (!info.typeInfo.has_ret())
+			{
+				comp.test(res, InlineHookRes(HookRes::DontCall));
+				comp.jnz(L_DontCall);
+			}
+
+			comp.test(res, InlineHookRes(HookRes::BreakLoop));
+			comp.jnz(L_Done);
+
+			comp.bind(L_Next);
+		}
+
+		if (!info.typeInfo.has_ret())
+		{
+			comp.jmp(L_Done);
+
+			comp.bind(L_DontCall);
+			comp.lock().dec(x86::dword_ptr(counter));
+			comp.jmp(L_Return);
+		}
+
+		comp.bind(L_Done);
+		comp.lock().dec(x86::dword_ptr(counter));
+	}
+
+	void StubCompiler::SetCallArgs(const TypeInfo& typeInfo, asmjit::InvokeNode* pFunc)
+	{
+		size_t arg_pos = 0;
+		// first check if it's thiscall, then set it as first arg
+		if (typeInfo.has_this_ptr())
+		{
+			pFunc->setArg(arg_pos++, typeInfo.this_());
+		}
+		// second check if it's return on the stack, then set it as (first/second) arg
+		if (typeInfo.has_ret_mem())
+		{
+			pFunc->setArg(arg_pos++, typeInfo.ret_mem());
+		}
+		// third set rest of args, and keep checking if it's a int64_t type to set second param on 'setArg'
+		for (auto& arg : typeInfo.args_iterator())
+		{
+			pFunc->setArg(arg_pos, arg.Reg);
+			if (arg.ExtraReg.isValid())
+				pFunc->setArg(arg_pos, 1, arg.ExtraReg);
+			++arg_pos;
+		}
+	}
+
+
+	void StubCompiler::ReadReturn(DataInfo info)
+	{
+		using namespace asmjit;
+
+		if (info.typeInfo.has_ret_mem())
+		{
+			info.Context.ManageReturnInMem(info.Compiler, info.FrameData, true, info.typeInfo.ret_mem());
+		}
+		else if (info.typeInfo.has_ret())
+		{
+			const BaseReg& 
+				ret0 = info.typeInfo.ret(),
+				ret1 = info.typeInfo.has_regx2() ? info.typeInfo.ret(true) : BaseReg{ };
+
+			info.Context.ManageReturn(info.Compiler, info.FrameData, true, ret0, ret1);
+		}
+	}
+
+	void StubCompiler::WriteReturn(DataInfo info, const asmjit::Label& L_Return) const
+	{
+		using namespace asmjit;
+
+		// every path of the stub returns through 'L_Return', the call is over past this point
+		const auto leave_stub = [&info, this]
+		{
+			EmitStats(info, StatsCall::Leave);
+			info.Compiler.lock().dec(x86::dword_ptr(info.Instance, m_Layout.CallsInFlight));
+		};
+
+		if (info.typeInfo.has_ret_mem())
+		{
+			const BaseReg ret = info.typeInfo.ret_mem();
+			info.Context.ManageReturnInMem(info.Compiler, info.FrameData, false, ret);
+			info.Compiler.bind(L_Return);
+			leave_stub();
+			info.Compiler.addRet(ret, Operand{ });
+		}
+		else if (info.typeInfo.has_ret())
+		{
+			BaseReg
+				ret0 = info.typeInfo.ret(),
+				ret1 = info.typeInfo.ret(true);
+
+			info.Context.ManageReturn(info.Compiler, info.FrameData, false, ret0, ret1);
+			// reached directly with the original's return value when there was no post hooks to run
+			info.Compiler.bind(L_Return);
+			leave_stub();
+			info.Compiler.addRet(ret0, info.typeInfo.has_regx2() ? ret1 : Operand{ });
+		}
+		else
+		{
+			info.Compiler.bind(L_Return);
+			leave_stub();
+		}
+	}
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <asmjit/asmjit.h>
+
+#include <px/interfaces/HooksManager.hpp>
+
+#include "CallContext.hpp"
+#include "SigBuilder.hpp"
+
+
+/// <summary>
+/// Native callback compiled directly into the detour's stub, called with the function's native args before any other callback
+/// </summary>
+struct InlineHookInfo
+{
+	void*							Callback;
+	// the detour's args, returning the callback's 'InlineHookRes'
+	asmjit::FuncSignatureBuilder	Signature;
+	px::HookOrder					Order;
+	px::IHookInstance::HookID		Id;
+};
+
+/// <summary>
+/// Code allocated in the JIT runtime
+/// </summary>
+struct StubCode
+{
+	void* Code{ };
+	size_t Size{ };
+
+	[[nodiscard]] bool Contains(uintptr_t ip) const noexcept
+	{
+		const uintptr_t begin = reinterpret_cast<uintptr_t>(Code);
+		return ip >= begin && ip < begin + Size;
+	}
+};
+
+/// <summary>
+/// Result of inline callbacks, a bit for each 'px::HookRes'
+/// only 'Ignored', 'BreakLoop' and 'DontCall' (for functions without return value) are handled, args are passed by value
+/// </summary>
+[[nodiscard]] constexpr uint32_t InlineHookRes(std::same_as<px::HookRes> auto... res) noexcept
+{
+	return (0u | ... | (1u << static_cast<uint32_t>(res)));
+}
+
+
+namespace detour_detail
+{
+	// set in the hook's flags while it has callbacks, the stub jumps straight to the original function when it's empty
+	enum CallbackFlags : uint8_t
+	{
+		HasPreCallbacks = 1 << 0,
+		HasPostCallbacks = 1 << 1,
+		HasInlineCallbacks = 1 << 2
+	};
+
+	// returned by the hook's handler for pre hooks
+	enum HandlerFlags : uint8_t
+	{
+		CallOriginal = 1 << 0,
+		// post hooks must run, otherwise the call frame was already popped and the original's return is returned as is
+		RunPost = 1 << 1
+	};
+
+	/// <summary>
+	/// Where the stub reads the hook's state, as offsets from the hook instance it's entered with
+	/// </summary>
+	struct StubLayout
+	{
+		// 'CallbackFlags', a byte
+		size_t Flags;
+		// pointer to the function called as the original function
+		size_t ActualFunc;
+		// calls past the stub's bypass, a dword incremented on entry and decremented right before returning
+		size_t CallsInFlight;
+		// hook's index in 'HookStats', a dword
+		size_t StatsIndex;
+		// runs the hook's callbacks on the call's frame data, returns 'HandlerFlags' for pre hooks
+		uint8_t(*Handler)(void* instance, bool is_post, std::byte* frame_data);
+	};
+
+	/// <summary>
+	/// Compile the stub of a detour, the stub doesn't depend on any hook instance
+	/// it expects the hook instance in 'InstanceRegister()', set by the hook's thunk, and reads its state through 'StubLayout'
+	/// </summary>
+	class StubCompiler
+	{
+	public:
+		StubCompiler(asmjit::JitRuntime& runtime, const StubLayout& layout) noexcept :
+			m_Runtime(runtime),
+			m_Layout(layout)
+		{ }
+
+		/// <summary>
+		/// Compile a stub calling 'inline_callbacks' then the handler
+		/// </summary>
+		/// <param name="context">context of the stub's signature, created by the stub if it's null</param>
+		/// <param name="inline_calls">incremented while the stub runs its inline callbacks, only used if it has any</param>
+		[[nodiscard]] StubCode Compile(
+			SigBuilder& sigbuilder,
+			std::shared_ptr<DetourCallContext>& context,
+			std::span<const InlineHookInfo> inline_callbacks,
+			std::atomic<uint32_t>* inline_calls,
+			std::string& out_err
+		) const;
+
+		/// <summary>
+		/// Pass the detoured function's args to a call
+		/// </summary>
+		static void SetCallArgs(const TypeInfo& typeInfo, asmjit::InvokeNode* pFunc);
+
+		/// <summary>
+		/// Scratch register holding the hook instance when entering a stub, no supported calling convention passes args in it
+		/// </summary>
+		[[nodiscard]] static const asmjit::x86::Gp& InstanceRegister(bool is_32bit) noexcept
+		{
+			return is_32bit ? asmjit::x86::eax : asmjit::x86::r11;
+		}
+
+	private:
+		struct DataInfo
+		{
+			const TypeInfo& typeInfo;
+			asmjit::x86::Compiler& Compiler;
+			DetourCallContext& Context;
+			// stack memory of the current call, see 'DetourCallContext::frame_data_size()'
+			const asmjit::x86::Mem& FrameData;
+			// the hook instance of the current call
+			const asmjit::x86::Gp& Instance;
+			// stack memory of the current call's stats, see 'HookStats::CallData'
+			const asmjit::x86::Mem& Stats;
+		};
+
+		enum class StatsCall : uint8_t
+		{
+			Enter,
+			RecordPre,
+			RecordPost,
+			RecordOriginal,
+			Leave
+		};
+
+		/// <summary>
+		/// Emit the stub's entry, before its function frame, that jumps to the original function if there are no callbacks
+		/// </summary>
+		void EmitBypass(asmjit::x86::Compiler& comp) const;
+
+		[[nodiscard]] static bool ValidateRegisters(DataInfo comp, std::string& out_err);
+
+		void InvokeCallbacks(DataInfo info, bool post, const asmjit::x86::Gp& ret) const;
+		void InvokeOriginal(DataInfo info) const;
+
+		/// <summary>
+		/// Emit a direct call to each inline callback, and branch on their results
+		/// 'calls_in_flight' is incremented before the first callback and decremented once they all returned
+		/// </summary>
+		/// <param name="L_Return">jumped to if a callback returned 'DontCall'</param>
+		static void InvokeInlineCallbacks(DataInfo info, std::span<const InlineHookInfo> inline_callbacks, std::atomic<uint32_t>* calls_in_flight, const asmjit::Label& L_Return);
+
+		/// <summary>
+		/// Emit a call to 'HookStats', skipped unless the stats are collected for the current call
+		/// the stats are only checked on 'StatsCall::Enter', so a call is either fully counted or not at all
+		/// </summary>
+		void EmitStats(DataInfo info, StatsCall call) const;
+
+		static void ReadReturn(DataInfo info);
+		void WriteReturn(DataInfo info, const asmjit::Label& L_Return) const;
+
+		asmjit::JitRuntime& m_Runtime;
+		StubLayout m_Layout;
+	};
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 #include <asmjit/asmjit.h>
 
@@ -7,33 +8,9 @@
 
 namespace detour_detail
 {
-	TypeTable::TypeTable()
-	{
-		std::ifstream file(std::string(LibraryManager::CommonTag) + ".jit_types.json");
-		if (file)
-			m_TypeInfos = nlohmann::json::parse(file, nullptr, false, true);
-
-		if (m_TypeInfos.is_discarded())
-		{
-			PX_LOG_ERROR(
-				PX_MESSAGE("Failed to load 'Pleiades.jit_types' file")
-			);
-		}
-	}
-
-	size_t TypeTable::get_size(const std::vector<asmjit::TypeId>& types) const noexcept
-	{
-		using namespace asmjit::TypeUtils;
-
-		size_t size = 0;
-		for (auto type : types)
-			size += sizeOf(deabstract(type, deabstractDeltaOfSize(sizeof(void*))));
-		return size;
-	}
-
 	/// <summary>
-	/// load type's underlying types into a vector
-	/// types also can reference other custom types and will be loaded respectively
+	/// expand a custom type's definition into its underlying types
+	/// types also can reference other custom types, 'lookup' finds them by name
 	/// 
 	/// eg:
 	/// "MyCustomType": [
@@ -109,104 +86,143 @@ namespace detour_detail
 	///	}
 	///
 	/// </summary>
-	std::vector<asmjit::TypeId> TypeTable::load_type(const nlohmann::json& type_name) const
+	template<typename _LookupFn>
+	static std::vector<asmjit::TypeId> expand_type(const nlohmann::json& definition, _LookupFn&& lookup)
 	{
-		if (type_name.is_null())
-			return { };
+		std::vector<asmjit::TypeId> types;
+		for (const auto& arg : definition)
+		{
+			const bool is_object = arg.is_object();
+			if (!is_object && !arg.is_string())
+				continue;
 
-		const nlohmann::json& default_types = default_table();
-		const bool type_is_string = type_name.is_string();
+			const nlohmann::json& name_or_arr = is_object ? arg["type"] : arg;
+			// support for array types
+			// instead of copy pasting N elements, "repeat" does it for us
+			const size_t size_of_array = is_object && arg.contains("repeat") ? arg["repeat"].get<size_t>() : 1;
 
-		if (type_is_string)
-		{
-			if (const auto iter = default_types.find(type_name); iter != default_types.end())
-				return { static_cast<asmjit::TypeId>(*iter) };
+			std::vector<asmjit::TypeId> sub_types;
+			if (name_or_arr.is_array())
+			{
+				sub_types = expand_type(name_or_arr, lookup);
+				if (sub_types.empty())
+					return { };
+			}
+			else if (name_or_arr.is_string())
+			{
+				const TypeTable::ResolvedType* type = lookup(name_or_arr.get_ref<const std::string&>());
+				// else the user didn't provide any information
+				if (!type)
+					return { };
+				sub_types = type->Types;
+			}
+			else continue;
+
+			types.reserve(types.size() + sub_types.size() * size_of_array);
+			for (size_t i = 0; i < size_of_array; i++)
+				types.insert(types.end(), sub_types.begin(), sub_types.end());
 		}
+		return types;
+	}
 
-		const nlohmann::json& custom_types = custom_table();
-		const nlohmann::json* custom_type = nullptr;
-		if (!type_is_string)
+
+	TypeTable::TypeTable()
+	{
+		nlohmann::json type_infos;
+
+		std::ifstream file(std::string(LibraryManager::CommonTag) + ".jit_types.json");
+		if (file)
+			type_infos = nlohmann::json::parse(file, nullptr, false, true);
+
+		if (type_infos.is_discarded())
 		{
-			custom_type = &type_name;
+			PX_LOG_ERROR(
+				PX_MESSAGE("Failed to load 'Pleiades.jit_types' file")
+			);
+			return;
 		}
-		else
+
+		if (!type_infos.is_object())
+			return;
+
+		if (const auto defaults = type_infos.find("Defaults"); defaults != type_infos.end())
 		{
-			const auto iter = custom_types.find(type_name);
-			if (iter != custom_types.end())
-				custom_type = &*iter;
+			for (const auto& [name, type] : defaults->items())
+				add_type(name, { static_cast<asmjit::TypeId>(type.get<int>()) });
 		}
 
-		if (custom_type)
+		if (const auto custom_types = type_infos.find("Custom"); custom_types != type_infos.end())
 		{
-			std::vector<asmjit::TypeId> types;
-			for (const auto& arg : *custom_type)
+			std::vector<std::string> resolving;
+			for (const auto& [name, type] : custom_types->items())
 			{
-				const bool is_object = arg.is_object();
-				if (!is_object && !arg.is_string())
-					continue;
-
-				using string_type = const std::string&;
-				const nlohmann::json& name_or_arr = is_object ? arg["type"] : arg;
-
-				if (name_or_arr.is_array())
+				if (!resolve_custom(name, *custom_types, resolving))
 				{
-					auto sub_types = load_type(name_or_arr);
-					if (!sub_types.empty())
-					{
-						size_t size_of_array = is_object && arg.contains("repeat") ? arg["repeat"].get<size_t>() : 1;
-						if (size_of_array > 1)
-						{
-							for (; size_of_array > 1; size_of_array--)
-							{
-								types.insert(
-									types.end(),
-									sub_types.begin(),
-									sub_types.end()
-								);
-							}
-						}
-
-						types.insert(
-							types.end(),
-							std::make_move_iterator(sub_types.begin()),
-							std::make_move_iterator(sub_types.end())
-						);
-
-						return types;
-					}
-					else return { };
+					PX_LOG_ERROR(
+						PX_MESSAGE("Failed to resolve custom type, it references an unknown type or itself."),
+						PX_LOGARG("Type", name)
+					);
 				}
+			}
+		}
+	}
 
-				else if (name_or_arr.is_string())
-				{
-					// if it's generic type
-					if (const auto iter = default_types.find(name_or_arr); iter != default_types.end())
-					{
-						// support for array types
-						// instead of copy pasting N elements, "repeat" does it for us
-						size_t size_of_array = is_object && arg.contains("repeat") ? arg["repeat"].get<size_t>() : 1;
-						for (; size_of_array > 0; size_of_array--)
-							types.push_back(static_cast<asmjit::TypeId>(iter->get<int>()));
-					}
-					// else if it's a custom type
-					else if (custom_types.contains(name_or_arr))
-					{
-						auto sub_types = load_type(name_or_arr);
-						if (!sub_types.empty())
-						{
-							types.insert(
-								types.end(),
-								std::make_move_iterator(sub_types.begin()),
-								std::make_move_iterator(sub_types.end())
-							);
-						}
-					}
-					// else the user didn't provide any information
-					else return { };
-				}
+	const TypeTable& TypeTable::get()
+	{
+		static const TypeTable type_table;
+		return type_table;
+	}
+
+	auto TypeTable::resolve_custom(const std::string& type_name, const nlohmann::json& custom_types, std::vector<std::string>& resolving) -> const ResolvedType*
+	{
+		// default types take precedence over custom types with the same name
+		if (const ResolvedType* type = find_type(type_name))
+			return type;
+
+		const auto iter = custom_types.find(type_name);
+		if (iter == custom_types.end() || std::ranges::find(resolving, type_name) != resolving.end())
+			return nullptr;
+
+		resolving.push_back(type_name);
+		std::vector<asmjit::TypeId> types = expand_type(
+			*iter,
+			[this, &custom_types, &resolving] (const std::string& name)
+			{
+				return resolve_custom(name, custom_types, resolving);
 			}
-			return types;
+		);
+		resolving.pop_back();
+
+		return types.empty() ? nullptr : &add_type(type_name, std::move(types));
+	}
+
+	auto TypeTable::add_type(const std::string& type_name, std::vector<asmjit::TypeId> types) -> const ResolvedType&
+	{
+		return m_Types.insert_or_assign(type_name, make_type(std::move(types))).first->second;
+	}
+
+	auto TypeTable::make_type(std::vector<asmjit::TypeId> types) noexcept -> ResolvedType
+	{
+		using namespace asmjit::TypeUtils;
+
+		ResolvedType type{ .Types = std::move(types) };
+		for (auto id : type.Types)
+			type.Size += sizeOf(deabstract(id, deabstractDeltaOfSize(sizeof(void*))));
+		return type;
+	}
+
+	auto TypeTable::load_type(const nlohmann::json& type_name) const -> ResolvedType
+	{
+		if (type_name.is_null())
+			return { };
+
+		if (type_name.is_string())
+		{
+			const ResolvedType* type = find_type(type_name.get_ref<const std::string&>());
+			return type ? *type : ResolvedType{ };
 		}
-		else return { };
+
+		// the custom type is defined in place
+		return make_type(expand_type(type_name, [this] (const std::string& name) { return find_type(name); }));
 	}
 }
\ No newline at end of file
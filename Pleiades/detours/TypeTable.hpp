@@ -1,46 +1,68 @@
 #pragma once
 
+#include <string>
 #include <unordered_map>
+#include <vector>
 #include <nlohmann/Json.hpp>
 #include <px/defines.hpp>
 
 namespace detour_detail
 {
+	/// <summary>
+	/// Types of 'Pleiades.jit_types.json', loaded once for the whole process
+	/// every type is expanded to its underlying types when the file is loaded, looking up a type by name is a single hash lookup
+	/// </summary>
 	class TypeTable
 	{
 	public:
-		TypeTable();
-
-		[[nodiscard]] bool is_default(const std::string& type_name) const
+		struct ResolvedType
 		{
-			default_table().contains(type_name);
-		}
-		[[nodiscard]] bool is_custom(const std::string& type_name) const
-		{
-			custom_table().contains(type_name);
-		}
+			std::vector<asmjit::TypeId> Types;
+			// sum of the underlying types' size, [U]IntPtr are counted as the pointer's size
+			size_t Size{ };
+		};
 
-		[[nodiscard]] asmjit::TypeId get_detault(const std::string& type_name) const
+		/// <summary>
+		/// Get the process' type table, the file is loaded on the first call
+		/// </summary>
+		[[nodiscard]] static const TypeTable& get();
+
+		/// <summary>
+		/// Find a default or custom type by its name
+		/// </summary>
+		/// <returns>the expanded type, null if it doesn't exists</returns>
+		[[nodiscard]] const ResolvedType* find_type(const std::string& type_name) const noexcept
 		{
-			return default_table()[type_name].get<asmjit::TypeId>();
+			const auto iter = m_Types.find(type_name);
+			return iter != m_Types.end() ? &iter->second : nullptr;
 		}
 
-		[[nodiscard]] const nlohmann::json& custom_table() const noexcept { return m_TypeInfos["Custom"]; }
-		[[nodiscard]] const nlohmann::json& default_table() const noexcept { return m_TypeInfos["Defaults"]; }
+		/// <summary>
+		/// load type's underlying types and their size
+		/// </summary>
+		/// <param name="type_name">either a type's name, or a custom type's definition</param>
+		/// <returns>no types if the type doesn't exists</returns>
+		[[nodiscard]] ResolvedType load_type(const nlohmann::json& type_name) const;
+
+	private:
+		TypeTable();
 
 		/// <summary>
-		/// collect the size of types
+		/// Resolve a custom type and the custom types it references, and cache them
 		/// </summary>
-		[[nodiscard]] size_t get_size(const std::vector<asmjit::TypeId>&) const noexcept;
+		/// <param name="resolving">custom types being resolved, to detect types referencing themselves</param>
+		/// <returns>the resolved type, null if the type doesn't exists or references itself</returns>
+		const ResolvedType* resolve_custom(const std::string& type_name, const nlohmann::json& custom_types, std::vector<std::string>& resolving);
+
+		const ResolvedType& add_type(const std::string& type_name, std::vector<asmjit::TypeId> types);
 
 		/// <summary>
-		/// load type's underlying types into a vector
+		/// collect the size of types
 		/// </summary>
-		/// <param name="type_name"></param>
-		/// <returns></returns>
-		[[nodiscard]] std::vector<asmjit::TypeId> load_type(const nlohmann::json& type_name) const;
+		[[nodiscard]] static ResolvedType make_type(std::vector<asmjit::TypeId> types) noexcept;
 
 	private:
-		nlohmann::json m_TypeInfos;
+		// default and custom types, by name
+		std::unordered_map<std::string, ResolvedType> m_Types;
 	};
 }
\ No newline at end of file
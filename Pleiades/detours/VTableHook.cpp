@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <atomic>
+#include <format>
+#include <nlohmann/json.hpp>
+
+#include "VTableHook.hpp"
+
+VTableHook::VTableHook(void** vtable, std::string& out_err) :
+	m_Original(vtable)
+{
+	m_Size = CountEntries(vtable);
+	if (!m_Size)
+	{
+		std::format_to(std::back_inserter(out_err), "'{}' is not a vtable.", static_cast<void*>(vtable));
+		return;
+	}
+
+	// committed memory is zeroed
+	m_Copy = static_cast<void**>(VirtualAlloc(nullptr, (m_Size + PrefixEntries) * sizeof(void*), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+	if (!m_Copy)
+	{
+		std::format_to(std::back_inserter(out_err), "Failed to allocate the vtable's copy (Code: {})", GetLastError());
+		return;
+	}
+
+	void** prefix = vtable - PrefixEntries;
+	if (MEMORY_BASIC_INFORMATION info; IsReadable(prefix, info) && IsReadable(vtable - 1, info))
+		std::copy_n(prefix, PrefixEntries, m_Copy);
+
+	std::copy_n(vtable, m_Size, GetTable());
+}
+
+VTableHook::~VTableHook() noexcept
+{
+	m_Slots.clear();
+	if (m_Copy)
+		VirtualFree(m_Copy, 0, MEM_RELEASE);
+}
+
+bool VTableHook::IsReadable(const void* address, MEMORY_BASIC_INFORMATION& info) noexcept
+{
+	constexpr DWORD readable = PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+
+	return VirtualQuery(address, &info, sizeof(info)) &&
+		info.State == MEM_COMMIT &&
+		(info.Protect & readable) &&
+		!(info.Protect & PAGE_GUARD);
+}
+
+size_t VTableHook::CountEntries(void** vtable) noexcept
+{
+	constexpr DWORD executable = PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+
+	// the table may end at the end of its region, check each region it crosses before reading from it
+	uintptr_t table_begin{ }, table_end{ };
+	// most entries are in the same region, only query the ones outside of the last one
+	uintptr_t region_begin{ }, region_end{ };
+	size_t count = 0;
+	for (; count < MaxEntries; count++)
+	{
+		if (const uintptr_t slot = reinterpret_cast<uintptr_t>(&vtable[count]); slot < table_begin || slot >= table_end)
+		{
+			MEMORY_BASIC_INFORMATION info;
+			if (!IsReadable(&vtable[count], info))
+				break;
+
+			table_begin = reinterpret_cast<uintptr_t>(info.BaseAddress);
+			table_end = table_begin + info.RegionSize;
+		}
+
+		const uintptr_t entry = reinterpret_cast<uintptr_t>(vtable[count]);
+		if (entry >= region_begin && entry < region_end)
+			continue;
+
+		MEMORY_BASIC_INFORMATION info;
+		if (!VirtualQuery(reinterpret_cast<void*>(entry), &info, sizeof(info)) ||
+			info.State != MEM_COMMIT ||
+			!(info.Protect & executable) ||
+			(info.Protect & PAGE_GUARD))
+			break;
+
+		region_begin = reinterpret_cast<uintptr_t>(info.BaseAddress);
+		region_end = region_begin + info.RegionSize;
+	}
+	return count;
+}
+
+HookInstance* VTableHook::LoadSlot(int index, const nlohmann::json& data, std::string& out_err)
+{
+	if (!m_Copy)
+	{
+		out_err = "The vtable's copy wasn't allocated.";
+		return nullptr;
+	}
+
+	if (index < 0 || static_cast<size_t>(index) >= m_Size)
+	{
+		std::format_to(std::back_inserter(out_err), "Virtual index {} is out of the vtable (Size: {})", index, m_Size);
+		return nullptr;
+	}
+
+	auto& hookInst = m_Slots[index];
+	if (hookInst)
+	{
+		if (!hookInst->RefCount++)
+			hookInst->Activate();
+		return hookInst.get();
+	}
+
+	hookInst = std::make_unique<HookInstance>(m_Original[index], data, out_err, &GetTable()[index]);
+	if (!out_err.empty())
+	{
+		m_Slots.erase(index);
+		return nullptr;
+	}
+
+	return hookInst.get();
+}
+
+void VTableHook::Swap(px::IntPtr object) const noexcept
+{
+	std::atomic_ref(*object.get<void**>()).store(GetTable(), std::memory_order_release);
+}
+
+void VTableHook::Restore(px::IntPtr object) const noexcept
+{
+	// the object may have been constructed again, or swapped by someone else
+	void** expected = GetTable();
+	std::atomic_ref(*object.get<void**>()).compare_exchange_strong(expected, m_Original, std::memory_order_acq_rel);
+}
+
+void VTableHook::DeactivateAll()
+{
+	for (auto& slot : m_Slots)
+	{
+		if (slot.second->RefCount)
+			slot.second->Deactivate();
+	}
+}
+
+bool VTableHook::WaitForCalls(std::chrono::steady_clock::time_point deadline) const
+{
+	for (auto& slot : m_Slots)
+	{
+		if (!slot.second->WaitForCalls(deadline))
+			return false;
+	}
+	return true;
+}
+
+void VTableHook::GetStubs(std::vector<StubCode>& stubs) const
+{
+	for (auto& slot : m_Slots)
+	{
+		auto hook_stubs = slot.second->GetStubs();
+		stubs.insert(stubs.end(), hook_stubs.begin(), hook_stubs.end());
+	}
+}
+
+void VTableHook::ReleaseStubs() noexcept
+{
+	for (auto& slot : m_Slots)
+		slot.second->ReleaseStubs();
+}
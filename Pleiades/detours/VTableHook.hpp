@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <nlohmann/json_fwd.hpp>
+
+#include <px/intptr.hpp>
+
+#include "HookInstance.hpp"
+
+
+/// <summary>
+/// Copy of a class' vtable, objects are hooked by pointing their vtable pointer to the copy, the functions themselves are never patched
+/// the copy is shared by every hooked object of the class, a hooked slot runs its callbacks for all of them
+/// hooking or unhooking an object is a single pointer write, no thread is suspended
+///
+/// the detour's entry is the same as a virtual function's detour, eg:
+/// "CBaseEntity::Think": {
+///		"Signature": { "virtual": "CBaseEntity::Think" },
+///		...
+/// }
+/// </summary>
+class VTableHook
+{
+public:
+	VTableHook(void** vtable, std::string& out_err);
+	~VTableHook() noexcept;
+
+	VTableHook(const VTableHook&) = delete;
+	VTableHook& operator=(const VTableHook&) = delete;
+
+	/// <summary>
+	/// Get the hook of a virtual function, create it if it doesn't exists, and activate it
+	/// </summary>
+	/// <returns>the slot's hook, null if the index is out of the vtable or the hook failed to load</returns>
+	[[nodiscard]] HookInstance* LoadSlot(int index, const nlohmann::json& data, std::string& out_err);
+
+	/// <summary>
+	/// Point the object's vtable pointer to the copy
+	/// </summary>
+	void Swap(px::IntPtr object) const noexcept;
+
+	/// <summary>
+	/// Point the object's vtable pointer back to the original vtable, if it's still pointing to the copy
+	/// </summary>
+	void Restore(px::IntPtr object) const noexcept;
+
+	/// <summary>
+	/// Deactivate every slot's hook, the copy then calls the original functions
+	/// </summary>
+	void DeactivateAll();
+
+	/// <summary>
+	/// Wait until every call inside the slots' hooks returned, see 'HookInstance::WaitForCalls'
+	/// </summary>
+	[[nodiscard]] bool WaitForCalls(std::chrono::steady_clock::time_point deadline) const;
+
+	/// <summary>
+	/// Append the stubs of every slot's hook
+	/// </summary>
+	void GetStubs(std::vector<StubCode>& stubs) const;
+
+	/// <summary>
+	/// Release the stubs of every slot's hook, the hooks must be deactivated and no thread may be running them
+	/// </summary>
+	void ReleaseStubs() noexcept;
+
+	[[nodiscard]] void** GetOriginal() const noexcept { return m_Original; }
+
+	/// <summary>
+	/// Get the copy's vtable, hooked objects point to it
+	/// </summary>
+	[[nodiscard]] void** GetTable() const noexcept { return m_Copy + PrefixEntries; }
+
+	// number of objects pointing to the copy
+	size_t ObjectCount{ };
+
+	// upper bound of a vtable's size, in case the table is followed by pointers to code
+	static constexpr size_t MaxEntries = 4096;
+
+private:
+	/// <summary>
+	/// Count the entries of a vtable, the table ends at the first entry that isn't readable or doesn't point to executable memory
+	/// </summary>
+	[[nodiscard]] static size_t CountEntries(void** vtable) noexcept;
+
+	/// <summary>
+	/// Check if the memory at 'address' is committed and readable, and get its region
+	/// </summary>
+	[[nodiscard]] static bool IsReadable(const void* address, MEMORY_BASIC_INFORMATION& info) noexcept;
+
+	// entries right before the vtable, msvc's RTTI locator, or the itanium abi's offset to top and type info
+#ifdef _MSC_VER
+	static constexpr size_t PrefixEntries = 1;
+#else
+	static constexpr size_t PrefixEntries = 2;
+#endif
+
+	void** m_Original;
+	// the copy starts with the entries before the vtable, so typeid and dynamic_cast still work
+	// they are left null if they aren't readable
+	void** m_Copy{ };
+	size_t m_Size{ };
+
+	// by vtable index
+	std::map<int, std::unique_ptr<HookInstance>> m_Slots;
+};
@@ -6,6 +6,8 @@
 #include <px/profiler.hpp>
 
 #include "library/Manager.hpp"
+#include "library/Scanner.hpp"
+#include "library/SignatureCache.hpp"
 #include "plugins/Manager.hpp"
 #include "detours/HooksManager.hpp"
 #include "Logs/Logger.hpp"
@@ -63,11 +65,16 @@ void DLLManager::Shutdown() noexcept
 		{
 			px::plugin_manager.UnloadAllDLLs();
 
+			// signatures read after the plugins were loaded are only written at shutdown
+			px::sig_cache.Save();
+
 			px::profiler::manager::Release();
 
 			px::plugin_manager.BasicShutdown();
 
-			px::detour_manager.SleepToReleaseHooks();
+			px::detour_manager.ReleaseAllHooks();
+
+			library_detail::ShutdownScanPool();
 
 			RemoveVectoredExceptionHandler(g_ExceptionHandler);
 
@@ -1,55 +1,102 @@
-
 #include "Manager.hpp"
 
+void EventManager::EventListeners::Compact()
+{
+	std::erase_if(Listeners, [] (const Listener& listener) { return !listener.Id; });
+	for (uint32_t i = 0; i < Listeners.size(); i++)
+		*Ids.find(Listeners[i].Id) = i;
+	Removed = 0;
+}
+
 px::EventID EventManager::AddListener(const char* event_name, const px::EventCallback& callback)
 {
 	auto iter = m_EventCallbacks.find(event_name);
-	if (iter == m_EventCallbacks.end())
+	if (iter == m_EventCallbacks.end() || iter->second.Erased)
 		return 0;
 
-	px::EventID id = 1;
-	for (const auto& entry : iter->second)
-	{
-		if (entry == id)
-			++id;
-	}
-	iter->second.emplace_back(callback, id);
+	auto& event = iter->second;
+	const px::EventID id = event.Ids.insert(static_cast<uint32_t>(event.Listeners.size()));
+	if (id == event.Ids.InvalidHandle)
+		return 0;
 
+	event.Listeners.emplace_back(EventListeners::Listener{ id, callback });
 	return id;
 }
 
 void EventManager::RemoveListener(const char* event_name, px::EventID id)
 {
 	auto it = m_EventCallbacks.find(event_name);
-	if (it != m_EventCallbacks.end())
-	{
-		auto& list = it->second;
-		std::erase(list, id);
-	}
+	if (it == m_EventCallbacks.end())
+		return;
+
+	auto& event = it->second;
+	const uint32_t* pos = event.Ids.find(id);
+	if (!pos)
+		return;
+
+	// the listener may be the one running, keep its callback alive until the event is done
+	event.Listeners[*pos].Id = 0;
+	event.Ids.erase(id);
+
+	// compacting is linear, only do it once half of the listeners were removed
+	if (++event.Removed * 2 > event.Listeners.size() && !event.Running)
+		event.Compact();
 }
 
 void EventManager::AddEvent(const char* event_name)
 {
-	m_EventCallbacks.try_emplace(event_name);
+	auto iter = m_EventCallbacks.try_emplace(event_name).first;
+	// the event was removed while it's running, its listeners were already removed
+	iter->second.Erased = false;
 }
 
 void EventManager::RemoveEvent(const char* event_name)
 {
-	m_EventCallbacks.erase(event_name);
+	auto it = m_EventCallbacks.find(event_name);
+	if (it == m_EventCallbacks.end())
+		return;
+
+	auto& event = it->second;
+	if (!event.Running)
+	{
+		m_EventCallbacks.erase(it);
+		return;
+	}
+
+	for (auto& listener : event.Listeners)
+		listener.Id = 0;
+	event.Ids.clear();
+	event.Removed = event.Listeners.size();
+	event.Erased = true;
 }
 
 bool EventManager::StartEvent(const char* event_name)
 {
 	auto it = m_EventCallbacks.find(event_name);
-	return it == m_EventCallbacks.end() ? false : it->second.size() > 0;
+	return it == m_EventCallbacks.end() ? false : !it->second.Ids.empty();
 }
 
 void EventManager::ExecuteEvent(const char* event_name, px::bitbuf& data)
 {
 	auto it = m_EventCallbacks.find(event_name);
-	if (it != m_EventCallbacks.end())
+	if (it == m_EventCallbacks.end())
+		return;
+
+	// listeners may add or remove listeners while the event is running
+	// added ones are run in this dispatch too, removed ones are skipped
+	auto& event = it->second;
+	++event.Running;
+	for (size_t i = 0; i < event.Listeners.size(); i++)
+	{
+		if (event.Listeners[i].Id)
+			event.Listeners[i].Callback(data);
+	}
+
+	if (!--event.Running)
 	{
-		for (auto& info : it->second)
-			info.Callback(data);
+		if (event.Erased)
+			m_EventCallbacks.erase(it);
+		else if (event.Removed)
+			event.Compact();
 	}
 }
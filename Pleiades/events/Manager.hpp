@@ -1,20 +1,46 @@
 #pragma once
 
 #include <map>
+#include <deque>
 #include <functional>
-#include <list>
 #include <px/interfaces/EventManager.hpp>
 
+#include "library/SlotMap.hpp"
+
 class EventManager : public px::IEventManager
 {
 public:
-	struct EventCallbackWrapper
+	/// <summary>
+	/// An event's listeners, run in the order they were added
+	/// listeners removed while the event is running are only marked, and dropped once no dispatch of the event is running
+	/// </summary>
+	struct EventListeners
 	{
-		px::EventCallback Callback;
-		px::EventID Id;
-		auto operator==(const px::EventID id) const noexcept { return this->Id == id; }
+		struct Listener
+		{
+			// 0 once the listener was removed, its callback may still be running
+			px::EventID Id;
+			px::EventCallback Callback;
+		};
+
+		// listeners' ids are the slots' handles, never 0, the values are the listeners' position in 'Listeners'
+		library_detail::SlotMap<uint32_t> Ids;
+		// a deque so adding a listener while the event is running doesn't move the running one
+		std::deque<Listener> Listeners;
+		// number of listeners marked as removed in 'Listeners'
+		size_t Removed{ };
+		// number of 'ExecuteEvent' calls running the event's listeners, the event may be running recursively
+		uint32_t Running{ };
+		// set when the event is removed while it's running, it's erased once the last dispatch returns
+		bool Erased{ };
+
+		/// <summary>
+		/// Drop the listeners marked as removed, only called when the event isn't running
+		/// </summary>
+		void Compact();
 	};
-	using map_type = std::map<std::string, std::list<EventCallbackWrapper>>;
+
+	using map_type = std::map<std::string, EventListeners>;
 
 	// Inherited via IEventManager
 	px::EventID AddListener(const char* event_name, const px::EventCallback& callback) override;
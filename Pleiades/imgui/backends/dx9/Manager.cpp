@@ -149,6 +149,7 @@ namespace renderer
 			std::unique_ptr<px::IGameData> pData(px::lib_manager.OpenGameData(nullptr));
 
 			std::vector<std::string> direct_3dx9{ "IDirect3DDevice9" };
+			DetoursBatch batch;
 			d3dx9_state::Hook_BeginScene = px::detour_manager.LoadHook(direct_3dx9, "BeginScene", nullptr, pData.get(), nullptr, nullptr);
 			d3dx9_state::Hook_Reset = px::detour_manager.LoadHook(direct_3dx9, "Reset", nullptr, pData.get(), nullptr, nullptr);
 
@@ -172,8 +173,11 @@ namespace renderer
 
 	void ShutdownForDx9()
 	{
-		px::detour_manager.ReleaseHook(d3dx9_state::Hook_BeginScene);
-		px::detour_manager.ReleaseHook(d3dx9_state::Hook_Reset);
+		{
+			DetoursBatch batch;
+			px::detour_manager.ReleaseHook(d3dx9_state::Hook_BeginScene);
+			px::detour_manager.ReleaseHook(d3dx9_state::Hook_Reset);
+		}
 
 		if (d3dx9_state::WndProcedure)
 		{
@@ -0,0 +1,57 @@
+#include "library/Manager.hpp"
+#include "plugins/GameData.hpp"
+#include "plugins/Manager.hpp"
+#include "../Console.hpp"
+#include "console/Manager.hpp"
+
+PX_COMMAND(
+	gamedata_compile,
+R"(Compile gamedata's json files into binary blobs, loaded instead of the json files until any of them changes.
+USAGE:
+	] gamedata_compile [flags] [plugins, ...]
+
+FLAGS:
+	-h, --help			show help message.
+
+Without any plugin, Pleiades' own gamedata files are compiled.)",
+	{
+		px::cmd_mask{ "help", 'h', false, true }
+	}
+)
+{
+	const auto compile = [] (px::IPlugin* plugin, std::string_view name)
+	{
+		GameData gamedata(plugin);
+		if (const size_t count = gamedata.CompileFiles())
+			px::console_manager.Print(std::format("[{}] : compiled {} gamedata blob(s).", name, count));
+		else
+		{
+			px::console_manager.Print(
+				{ 255, 120, 120, 255 },
+				std::format("[{}] : no gamedata was compiled, check the logs for errors.", name)
+			);
+		}
+	};
+
+	auto vals = exec_info.value.split<std::string_view>();
+	if (vals.empty())
+	{
+		compile(nullptr, LibraryManager::MainName);
+		return;
+	}
+
+	for (std::string_view name : vals)
+	{
+		px::IPlugin* plugin = px::plugin_manager.FindPlugin(std::string(name));
+		if (!plugin)
+		{
+			px::console_manager.Print(
+				{ 255, 120, 120, 255 },
+				std::format("Plugin '{}' isn't loaded.", name)
+			);
+			continue;
+		}
+
+		compile(plugin, name);
+	}
+}
@@ -0,0 +1,94 @@
+#include <chrono>
+#include "library/Manager.hpp"
+#include "library/Module.hpp"
+#include "library/Signature.hpp"
+#include "../Console.hpp"
+#include "console/Manager.hpp"
+
+PX_COMMAND(
+	sig_bench,
+R"(Compare the throughput of the serial and the parallel signature scanners.
+USAGE:
+	] sig_bench [flags] <module> <pattern>
+
+FLAGS:
+	-h, --help			show help message.
+	-i, --iterations	Number of scans per scanner.
+	-w, --workers		 Number of threads for the parallel scanner, defaults to "scan workers" in Pleiades.json.)",
+	{
+		px::cmd_mask{ "help",		'h', false, true },
+		px::cmd_mask{ "iterations",	'i' },
+		px::cmd_mask{ "workers",	'w' }
+	}
+)
+{
+	auto vals = exec_info.value.split<std::string_view>();
+	if (vals.size() < 2)
+	{
+		px::console_manager.Print(std::string{ sig_bench_cmd.help() });
+		return;
+	}
+
+	std::string pattern;
+	for (size_t i = 1; i < vals.size(); i++)
+	{
+		if (i != 1)
+			pattern += ' ';
+		pattern += vals[i];
+	}
+
+	std::unique_ptr<LibraryImpl> lib(static_cast<LibraryImpl*>(px::lib_manager.ReadLibrary(std::string(vals[0]))));
+	if (!lib)
+	{
+		px::console_manager.Print(
+			{ 255, 120, 120, 255 },
+			std::format("Module '{}' isn't loaded.", vals[0])
+		);
+		return;
+	}
+
+	const library_detail::CompiledSignature* signature;
+	try
+	{
+		signature = &library_detail::CompiledSignature::Get(pattern);
+	}
+	catch (const std::exception& ex)
+	{
+		px::console_manager.Print(
+			{ 255, 120, 120, 255 },
+			std::format("Invalid pattern '{}': {}", pattern, ex.what())
+		);
+		return;
+	}
+
+	const size_t iterations = std::max<size_t>(exec_info.args.get<size_t>("iterations", 10), 1);
+	const size_t workers = exec_info.args.get<size_t>("workers", px::lib_manager.GetScanWorkers());
+	const std::span<const std::byte> image = lib->GetImage();
+
+	const auto bench = [&] (const char* name, auto&& scan)
+	{
+		const std::byte* res = nullptr;
+
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < iterations; i++)
+			res = scan();
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		const double seconds = elapsed.count() / iterations;
+		px::console_manager.Print(
+			std::format(
+				"[{}] : {:.3f} ms per scan, {:.1f} MB/s, result: {}",
+				name,
+				seconds * 1000.0,
+				seconds > 0.0 ? image.size() / seconds / (1024.0 * 1024.0) : 0.0,
+				res ? std::format("{}+{:#x}", vals[0], res - image.data()) : "not found"
+			)
+		);
+	};
+
+	bench("serial", [&] { return library_detail::FindPattern(image, signature->view()); });
+	bench(
+		std::format("parallel x{}", workers).c_str(),
+		[&] { return library_detail::FindPatternParallel(image, signature->view(), workers); }
+	);
+}
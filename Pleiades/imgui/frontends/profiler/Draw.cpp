@@ -87,6 +87,9 @@ void ImGuiPlProfiler::Render()
             }
         }
         m_ProfilerInstance.m_NeedReload = false;
+
+        if (auto hooks_tab = main_profiler_tab.add_item("Hooks"))
+            DisplayHookStats();
     }
 }
 
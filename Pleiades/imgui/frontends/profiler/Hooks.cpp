@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <limits>
+#include "ImPlot/implot.h"
+#include "Profiler.hpp"
+
+/*
+-----------------------------------------------------------------------------------------------------------------
+Hooks           |   Hits    |   Skips   |   Pre (avg)   |   Original (avg)  |   Post (avg)  |   p50 |   p99    |
+-----------------------------------------------------------------------------------------------------------------
+Foo::Bar        |   XXX     |   YYY     |   XXns        |   XXus            |   XXns        |   XXus|   XXus   |
+-----------------------------------------------------------------------------------------------------------------
+Histogram of the selected hook's latency, a bar for each bucket
+*/
+static constexpr const char* HookStatsNames[]{
+    "Hooks",            // 1
+    "Hits",             // 2
+    "Skips",            // 3
+    "Pre (avg)",        // 4
+    "Original (avg)",   // 5
+    "Post (avg)",       // 6
+    "p50",              // 7
+    "p99"               // 8
+};
+
+static std::string ImGuiProfiler_FormatDuration(std::chrono::nanoseconds duration)
+{
+    using namespace std::chrono_literals;
+    if (duration < 10us)
+        return std::format("{}ns", duration / 1ns);
+    else if (duration < 10ms)
+        return std::format("{}us", duration / 1us);
+    else
+        return std::format("{}ms", duration / 1ms);
+}
+
+
+void ImGuiPlProfiler::DisplayHookStats()
+{
+    using detour_detail::HookStats;
+
+    if (bool enabled = HookStats::IsEnabled(); imcxx::checkbox::call("Collect", enabled))
+        HookStats::Enable(enabled);
+
+    ImGui::SameLine();
+    if (ImGui::Button(ICON_FA_REDO " Update"))
+        m_HookStats = HookStats::Collect();
+
+    ImGui::SameLine();
+    if (ImGui::Button(ICON_FA_TIMES " Reset"))
+    {
+        HookStats::Reset();
+        m_HookStats.clear();
+    }
+
+    constexpr ImGuiTableFlags table_flags =
+        ImGuiTableFlags_SizingStretchProp |
+        ImGuiTableFlags_Borders |
+        ImGuiTableFlags_Resizable |
+        ImGuiTableFlags_Hideable |
+        ImGuiTableFlags_RowBg |
+        ImGuiTableFlags_NoHostExtendX;
+
+    if (imcxx::table hooks_table{ "Hooks Table", static_cast<int>(std::size(HookStatsNames)), table_flags })
+    {
+        for (auto name : HookStatsNames)
+            ImGui::TableSetupColumn(name);
+        ImGui::TableHeadersRow();
+
+        for (size_t i = 0; i < m_HookStats.size(); i++)
+        {
+            const HookStats::Snapshot& stats = m_HookStats[i];
+            // time spent in callbacks is averaged over every call, time in the original only over the calls that weren't skipped
+            const int64_t
+                calls = std::max<int64_t>(stats.Hits, 1),
+                original_calls = std::max<int64_t>(stats.Hits - stats.Skips, 1);
+
+            ImGui::TableNextColumn();
+            if (ImGui::Selectable(std::format("{}##{}", stats.Name, i).c_str(), m_SelectedHook == i, ImGuiSelectableFlags_SpanAllColumns))
+                m_SelectedHook = m_SelectedHook == i ? std::numeric_limits<size_t>::max() : i;
+
+            if (ImGui::TableNextColumn())
+                ImGui::Text("%llu", stats.Hits);
+            if (ImGui::TableNextColumn())
+                ImGui::Text("%llu", stats.Skips);
+
+            for (auto dur : {
+                stats.PreTime / calls,
+                stats.OriginalTime / original_calls,
+                stats.PostTime / calls,
+                stats.Percentile(.5),
+                stats.Percentile(.99)
+                })
+            {
+                if (ImGui::TableNextColumn())
+                    ImGui::TextUnformatted(ImGuiProfiler_FormatDuration(dur).c_str());
+            }
+        }
+    }
+
+    if (m_SelectedHook < m_HookStats.size())
+        DisplayHookHistogram(m_HookStats[m_SelectedHook]);
+}
+
+void ImGuiPlProfiler::DisplayHookHistogram(const detour_detail::HookStats::Snapshot& stats)
+{
+    using detour_detail::HookStats;
+
+    // only plot the buckets between the fastest and the slowest call
+    const auto& histogram = stats.Histogram;
+    const auto first = std::ranges::find_if(histogram, [] (uint64_t count) { return count != 0; });
+    if (first == histogram.end())
+        return;
+    const auto last = std::ranges::find_if(histogram.rbegin(), histogram.rend(), [] (uint64_t count) { return count != 0; }).base();
+
+    const uint32_t begin = static_cast<uint32_t>(first - histogram.begin()), end = static_cast<uint32_t>(last - histogram.begin());
+
+    std::vector<double> xs, ys;
+    std::vector<double> ticks;
+    std::vector<std::string> tick_labels;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        xs.push_back(i);
+        ys.push_back(static_cast<double>(histogram[i]));
+
+        // label the first bucket of each power of two
+        if (i == begin || !(i % HookStats::SubBuckets))
+        {
+            ticks.push_back(i);
+            tick_labels.emplace_back(ImGuiProfiler_FormatDuration(std::chrono::nanoseconds(HookStats::BucketLowerBound(i))));
+        }
+    }
+
+    std::vector<const char*> labels;
+    for (auto& label : tick_labels)
+        labels.push_back(label.c_str());
+
+    ImPlot::SetNextPlotTicksX(ticks.data(), static_cast<int>(ticks.size()), labels.data());
+    ImPlot::SetNextPlotLimits(begin - 1., end, 0., *std::max_element(ys.begin(), ys.end()) * 1.1, ImGuiCond_Always);
+    if (ImPlot::BeginPlot(std::format("{}##HookHistogram", stats.Name).c_str(), "Latency", "Calls", { -FLT_MIN, -FLT_MIN }, ImPlotFlags_NoLegend))
+    {
+        ImPlot::PlotBars("Calls", xs.data(), ys.data(), static_cast<int>(xs.size()), .9);
+        ImPlot::EndPlot();
+    }
+}
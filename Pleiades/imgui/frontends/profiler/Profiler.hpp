@@ -1,7 +1,9 @@
 #pragma once
 
+#include <limits>
 #include "imgui/backends/States.hpp"
 #include <px/profiler.hpp>
+#include "detours/HookStats.hpp"
 
 
 struct ImGuiProfilerInstance
@@ -187,8 +189,22 @@ public:
     static inline StackTracePopup_t StackTracePopup;
 
 private:
+    /// <summary>
+    /// Render the hooks' call statistics in a table, see 'detour_detail::HookStats'
+    /// statistics are only collected while enabled, and only summed up on update
+    /// </summary>
+    void DisplayHookStats();
+
+    /// <summary>
+    /// Render the latency histogram of a hook
+    /// </summary>
+    void DisplayHookHistogram(const detour_detail::HookStats::Snapshot& stats);
+
     // TODO: Multiple instances of profilers?
     /*using map_type = std::map<std::string, ImGuiProfilerInstance>;
     map_type m_ProfilerInstances;*/
     ImGuiProfilerInstance m_ProfilerInstance;
+
+    std::vector<detour_detail::HookStats::Snapshot> m_HookStats;
+    size_t m_SelectedHook{ std::numeric_limits<size_t>::max() };
 };
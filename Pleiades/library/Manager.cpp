@@ -1,6 +1,7 @@
 
 #include <fstream>
 #include <filesystem>
+#include <thread>
 
 #include <px/profiler.hpp>
 
@@ -24,6 +25,15 @@
 LibraryManager::LibraryManager() : m_Runtime(std::make_unique<asmjit::JitRuntime>())
 { }
 
+size_t LibraryManager::GetScanWorkers() const noexcept
+{
+	if (m_ScanWorkers)
+		return m_ScanWorkers;
+
+	const unsigned int hardware_threads = std::thread::hardware_concurrency();
+	return hardware_threads ? hardware_threads : 1;
+}
+
 px::ILibrary* LibraryManager::ReadLibrary(std::string_view module_name)
 {
 	HMODULE pMod;
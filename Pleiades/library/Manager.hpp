@@ -34,8 +34,22 @@ public:
 		m_HostName.assign(name);
 	}
 
+	/// <summary>
+	/// set the number of threads used to scan for signatures, 0 to use every hardware thread
+	/// </summary>
+	void SetScanWorkers(size_t workers) noexcept
+	{
+		m_ScanWorkers = workers;
+	}
+
+	/// <summary>
+	/// get the number of threads used to scan for signatures, including the calling thread
+	/// </summary>
+	[[nodiscard]] size_t GetScanWorkers() const noexcept;
+
 private:
 	std::string m_HostName;
+	size_t m_ScanWorkers{ };
 	std::unique_ptr<asmjit::JitRuntime> m_Runtime;
 };
 
@@ -1,45 +1,15 @@
+#include <span>
 #include <vector>
-#include <regex>
-#include <sstream>
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
+#include "Manager.hpp"
 #include "Module.hpp"
+#include "Signature.hpp"
 
 using px::IntPtr;
 
-static std::vector<int> PatternToBytes(std::string_view pattern)
-{
-	using namespace std;
-
-	regex to_replace{ "(\\?|\\*)" };
-	regex reg{ "([A-Fa-f0-9]{2})" };
-
-	string actual = regex_replace(pattern.data(), to_replace, "2A");
-	sregex_iterator bytes_begin{ actual.begin(), actual.end(), reg }, bytes_end;
-
-	const size_t size = distance(bytes_begin, bytes_end);
-	std::vector<int> bytes;
-	bytes.reserve(size);
-
-	int res;
-	stringstream stream;
-	stream << std::hex;
-
-	while (bytes_begin != bytes_end)
-	{
-		stream << bytes_begin->str();
-		stream >> res;
-		stream.clear();
-
-		bytes.push_back(res);
-		bytes_begin++;
-	}
-
-	return bytes;
-}
-
 IntPtr LibraryImpl::FindByName(std::string_view name)
 {
 	if (m_IsManualMapped)
@@ -65,39 +35,112 @@ IntPtr LibraryImpl::FindByName(std::string_view name)
 	}
 }
 
-IntPtr LibraryImpl::FindBySignature(std::string_view signature)
+std::span<const std::byte> LibraryImpl::GetImage() const noexcept
 {
-	IntPtr cur_address = m_ModuleHandle;
-
 	const PIMAGE_DOS_HEADER IDH = m_ModuleHandle.get<IMAGE_DOS_HEADER>();
 	const PIMAGE_NT_HEADERS NTH = IntPtr(m_ModuleHandle + IDH->e_lfanew).get<IMAGE_NT_HEADERS>();
 
-	const IntPtr end_address = cur_address + NTH->OptionalHeader.SizeOfImage - 1;
+	return { m_ModuleHandle.get<const std::byte>(), NTH->OptionalHeader.SizeOfImage };
+}
 
-	std::vector<int> bytes = PatternToBytes(signature);
+const library_detail::PEImage* LibraryImpl::GetPEImage()
+{
+	if (!m_PEImageParsed)
+	{
+		m_PEImageParsed = true;
+		m_PEImage = library_detail::PEImage::Parse(GetImage(), library_detail::PEImage::Layout::Mapped);
+	}
 
-	const size_t size = bytes.size();
+	return m_PEImage ? &*m_PEImage : nullptr;
+}
 
-	bool found;
-	while (cur_address < end_address)
+std::vector<std::span<const std::byte>> LibraryImpl::GetSections(std::string_view section)
+{
+	const library_detail::PEImage* image = GetPEImage();
+	if (!image)
+		return { GetImage() };
+
+	if (section.empty())
+	{
+		std::vector<std::span<const std::byte>> sections = image->code_sections();
+		if (sections.empty())
+			sections.emplace_back(GetImage());
+		return sections;
+	}
+
+	if (const library_detail::PESection* found = image->find_section(section))
+		return { image->section_data(*found) };
+
+	return { };
+}
+
+IntPtr LibraryImpl::FindBySignature(std::string_view signature)
+{
+	return FindBySignature(signature, { });
+}
+
+IntPtr LibraryImpl::FindBySignature(std::string_view signature, std::string_view section)
+{
+	try
+	{
+		return FindBySignature(library_detail::CompiledSignature::Get(signature).view(), section);
+	}
+	catch (const std::invalid_argument&)
 	{
-		found = true;
-		for (size_t i = 0; i < size; i++)
+		return nullptr;
+	}
+}
+
+IntPtr LibraryImpl::FindBySignature(const library_detail::PatternView& pattern, std::string_view section)
+{
+	for (std::span<const std::byte> region : GetSections(section))
+	{
+		if (const std::byte* res = library_detail::FindPatternParallel(region, pattern, px::lib_manager.GetScanWorkers()))
+			return const_cast<std::byte*>(res);
+	}
+	return nullptr;
+}
+
+std::vector<IntPtr> LibraryImpl::FindBySignatures(std::span<const std::string_view> signatures, std::string_view section)
+{
+	std::vector<library_detail::PatternView> views;
+	views.reserve(signatures.size());
+	for (std::string_view signature : signatures)
+	{
+		try
 		{
-			if (bytes[i] != 0x2A && bytes[i] != cur_address.read<uint8_t>(i))
-			{
-				found = false;
-				break;
-			}
+			views.emplace_back(library_detail::CompiledSignature::Get(signature).view());
 		}
+		catch (const std::invalid_argument&)
+		{
+			// empty patterns are never matched
+			views.emplace_back();
+		}
+	}
 
-		if (found)
-			return cur_address;
+	return FindBySignatures(views, section);
+}
+
+std::vector<IntPtr> LibraryImpl::FindBySignatures(std::span<const library_detail::PatternView> patterns, std::string_view section)
+{
+	std::vector<library_detail::PatternView> views(patterns.begin(), patterns.end());
+
+	std::vector<IntPtr> results(views.size());
+	for (std::span<const std::byte> region : GetSections(section))
+	{
+		const std::vector<const std::byte*> found = library_detail::FindPatternsParallel(region, views, px::lib_manager.GetScanWorkers());
+		for (size_t i = 0; i < found.size(); i++)
+		{
+			if (!found[i])
+				continue;
 
-		++cur_address;
+			results[i] = const_cast<std::byte*>(found[i]);
+			// sections are sorted by address, the first match is the lowest one
+			views[i] = { };
+		}
 	}
 
-	return nullptr;
+	return results;
 }
 
 IntPtr LibraryImpl::FindBySignature(const ILibrary::SignaturePredicate& signature)
@@ -124,29 +167,41 @@ IntPtr LibraryImpl::FindByString(std::string_view str)
 	if (str.empty())
 		return nullptr;
 
-	return FindBySignature(
-		[str](IntPtr cur_address, IntPtr end_address) -> bool
-		{
-			for (IntPtr ptr = cur_address; ptr < end_address; ptr++)
-			{
-				int i = 0;
-				bool found = true;
-				while (str[i])
-				{
-					if (ptr.read<char>(i) != str[i])
-					{
-						found = false;
-						break;
-					}
-					++i;
-				}
-				if (found)
-					return true;
-			}
+	const library_detail::PEImage* image = GetPEImage();
+	const std::vector<std::span<const std::byte>> sections = image ?
+		image->data_sections() :
+		std::vector<std::span<const std::byte>>{ GetImage() };
 
-			return false;
-		}
-	);
+	const std::span<const std::byte> needle = std::as_bytes(std::span(str));
+	for (std::span<const std::byte> region : sections)
+	{
+		if (const std::byte* res = library_detail::FindBytes(region, needle))
+			return const_cast<std::byte*>(res);
+	}
+
+	return nullptr;
+}
+
+IntPtr LibraryImpl::FindByString(std::string_view str, std::vector<IntPtr>& xrefs)
+{
+	const IntPtr ptr = FindByString(str);
+	xrefs = ptr ? FindXRefs(ptr) : std::vector<IntPtr>{ };
+	return ptr;
+}
+
+std::vector<IntPtr> LibraryImpl::FindXRefs(IntPtr target)
+{
+	const library_detail::PEImage* image = GetPEImage();
+	const bool is_64bit = image ? image->is_64bit() : sizeof(void*) == sizeof(uint64_t);
+
+	std::vector<IntPtr> xrefs;
+	for (std::span<const std::byte> region : GetSections({ }))
+	{
+		for (const std::byte* res : library_detail::FindReferences(region, reinterpret_cast<uintptr_t>(target.get()), is_64bit))
+			xrefs.emplace_back(const_cast<std::byte*>(res));
+	}
+
+	return xrefs;
 }
 
 LibraryImpl::~LibraryImpl()
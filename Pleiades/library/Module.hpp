@@ -1,10 +1,17 @@
 #pragma once
 
+#include <span>
+#include <vector>
+#include <optional>
+
 #include <boost/system.hpp>
 #include <asmjit/asmjit.h>
 #include <px/interfaces/LibrarySys.hpp>
 #include <px/IntPtr.hpp>
 
+#include "Scanner.hpp"
+#include "PEImage.hpp"
+
 class LibraryImpl : public px::ILibrary
 {
 	friend class LibraryManager;
@@ -27,10 +34,71 @@ public:
 	px::IntPtr FindByString(std::string_view str) override;
 
 public:
+	/// <summary>
+	/// read a signature from a pattern, only searching in 'section'
+	/// </summary>
+	/// <param name="section">name of the section to search in, eg: ".text", or empty to search in every executable section</param>
+	/// <returns>pointer to the target address, null if it doesn't exists</returns>
+	px::IntPtr FindBySignature(std::string_view signature, std::string_view section);
+
+	/// <summary>
+	/// read a signature from a compiled pattern
+	/// </summary>
+	/// <param name="section">name of the section to search in, eg: ".text", or empty to search in every executable section</param>
+	/// <returns>pointer to the target address, null if it doesn't exists</returns>
+	px::IntPtr FindBySignature(const library_detail::PatternView& pattern, std::string_view section = { });
+
+	/// <summary>
+	/// read a list of signatures from patterns in a single pass over the module
+	/// </summary>
+	/// <param name="section">name of the section to search in, eg: ".text", or empty to search in every executable section</param>
+	/// <returns>pointers to the target addresses in the same order as 'signatures', null for missing signatures</returns>
+	std::vector<px::IntPtr> FindBySignatures(std::span<const std::string_view> signatures, std::string_view section = { });
+
+	/// <summary>
+	/// read a list of signatures from compiled patterns in a single pass over the module
+	/// </summary>
+	/// <param name="section">name of the section to search in, eg: ".text", or empty to search in every executable section</param>
+	/// <returns>pointers to the target addresses in the same order as 'patterns', null for missing signatures</returns>
+	std::vector<px::IntPtr> FindBySignatures(std::span<const library_detail::PatternView> patterns, std::string_view section = { });
+
+	/// <summary>
+	/// read a string from the module's data sections, and every code reference to it
+	/// </summary>
+	/// <param name="xrefs">filled with the address of every absolute address or rip-relative displacement that refers to the string</param>
+	/// <returns>pointer to the string, null if it doesn't exists</returns>
+	px::IntPtr FindByString(std::string_view str, std::vector<px::IntPtr>& xrefs);
+
+	/// <summary>
+	/// read every code reference to 'target' from the module's executable sections
+	/// </summary>
+	/// <returns>addresses of every absolute address or rip-relative displacement that refers to 'target', in increasing order</returns>
+	std::vector<px::IntPtr> FindXRefs(px::IntPtr target);
+
+	/// <summary>
+	/// get the module's mapped image, from the base address to 'SizeOfImage'
+	/// </summary>
+	[[nodiscard]] std::span<const std::byte> GetImage() const noexcept;
+
+	/// <summary>
+	/// get the module's parsed headers and section table, parsed once on first use
+	/// </summary>
+	/// <returns>the parsed image, null if the module's headers are invalid</returns>
+	[[nodiscard]] const library_detail::PEImage* GetPEImage();
+
+	/// <summary>
+	/// get the regions to search for a section
+	/// </summary>
+	/// <param name="section">name of the section, or empty for every executable section</param>
+	/// <returns>the section's bytes, or the whole image if the module's headers couldn't be parsed</returns>
+	[[nodiscard]] std::vector<std::span<const std::byte>> GetSections(std::string_view section);
+
 	px::IntPtr GetModule() noexcept { return m_ModuleHandle; }
 
 private:
 	px::IntPtr	m_ModuleHandle;
+	std::optional<library_detail::PEImage> m_PEImage;
 	bool	m_ShouldFreeModule : 1;
 	bool	m_IsManualMapped : 1;
+	bool	m_PEImageParsed : 1{ };
 };
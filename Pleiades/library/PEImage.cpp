@@ -0,0 +1,134 @@
+#include <cstring>
+#include <algorithm>
+
+#include "PEImage.hpp"
+
+namespace library_detail
+{
+	/// <summary>
+	/// Read a little endian value at 'offset', returns false if it's out of bounds
+	/// </summary>
+	template<typename _Ty>
+	static bool ReadAt(std::span<const std::byte> buffer, size_t offset, _Ty& out) noexcept
+	{
+		if (offset > buffer.size() || buffer.size() - offset < sizeof(_Ty))
+			return false;
+
+		std::memcpy(&out, buffer.data() + offset, sizeof(_Ty));
+		return true;
+	}
+
+	std::optional<PEImage> PEImage::Parse(std::span<const std::byte> buffer, Layout layout)
+	{
+		constexpr uint16_t DosMagic = 0x5A4D;		// 'MZ'
+		constexpr uint32_t NtSignature = 0x00004550;	// 'PE\0\0'
+		constexpr uint16_t OptMagic32 = 0x10B;
+		constexpr uint16_t OptMagic64 = 0x20B;
+
+		constexpr size_t SizeOfFileHeader = 20;
+		constexpr size_t SizeOfSectionHeader = 40;
+
+		uint16_t dos_magic;
+		if (!ReadAt(buffer, 0, dos_magic) || dos_magic != DosMagic)
+			return std::nullopt;
+
+		int32_t nt_offset;
+		if (!ReadAt(buffer, 0x3C, nt_offset) || nt_offset < 0)
+			return std::nullopt;
+
+		uint32_t nt_signature;
+		if (!ReadAt(buffer, nt_offset, nt_signature) || nt_signature != NtSignature)
+			return std::nullopt;
+
+		PEImage image;
+		image.m_Buffer = buffer;
+		image.m_Layout = layout;
+
+		const size_t file_header = static_cast<size_t>(nt_offset) + sizeof(uint32_t);
+		uint16_t num_sections, size_of_opt_header, opt_magic;
+		if (!ReadAt(buffer, file_header + 0, image.m_Machine) ||
+			!ReadAt(buffer, file_header + 2, num_sections) ||
+			!ReadAt(buffer, file_header + 4, image.m_TimeDateStamp) ||
+			!ReadAt(buffer, file_header + 16, size_of_opt_header))
+			return std::nullopt;
+
+		const size_t opt_header = file_header + SizeOfFileHeader;
+		if (!ReadAt(buffer, opt_header, opt_magic) || (opt_magic != OptMagic32 && opt_magic != OptMagic64))
+			return std::nullopt;
+
+		image.m_Is64Bit = opt_magic == OptMagic64;
+		// 'SizeOfImage' and 'CheckSum' are at the same offset for both PE32 and PE32+
+		if (!ReadAt(buffer, opt_header + 56, image.m_SizeOfImage) ||
+			!ReadAt(buffer, opt_header + 64, image.m_CheckSum))
+			return std::nullopt;
+
+		const size_t section_table = opt_header + size_of_opt_header;
+		image.m_Sections.reserve(num_sections);
+
+		for (size_t i = 0; i < num_sections; i++)
+		{
+			const size_t header = section_table + i * SizeOfSectionHeader;
+			if (header + SizeOfSectionHeader > buffer.size())
+				return std::nullopt;
+
+			PESection& section = image.m_Sections.emplace_back();
+			std::memcpy(section.Name, buffer.data() + header, 8);
+
+			ReadAt(buffer, header + 8, section.VirtualSize);
+			ReadAt(buffer, header + 12, section.VirtualAddress);
+			ReadAt(buffer, header + 16, section.RawSize);
+			ReadAt(buffer, header + 20, section.RawOffset);
+			ReadAt(buffer, header + 36, section.Characteristics);
+		}
+
+		return image;
+	}
+
+	const PESection* PEImage::find_section(std::string_view name) const noexcept
+	{
+		const auto iter = std::ranges::find(m_Sections, name, &PESection::name);
+		return iter != m_Sections.end() ? &*iter : nullptr;
+	}
+
+	std::span<const std::byte> PEImage::section_data(const PESection& section) const noexcept
+	{
+		size_t offset, size;
+		if (m_Layout == Layout::Mapped)
+		{
+			offset = section.VirtualAddress;
+			size = section.VirtualSize ? section.VirtualSize : section.RawSize;
+		}
+		else
+		{
+			offset = section.RawOffset;
+			size = section.RawSize;
+		}
+
+		if (offset >= m_Buffer.size())
+			return { };
+
+		return m_Buffer.subspan(offset, std::min(size, m_Buffer.size() - offset));
+	}
+
+	std::vector<std::span<const std::byte>> PEImage::code_sections() const
+	{
+		std::vector<std::span<const std::byte>> sections;
+		for (const PESection& section : m_Sections)
+		{
+			if (section.is_executable())
+				sections.emplace_back(section_data(section));
+		}
+		return sections;
+	}
+
+	std::vector<std::span<const std::byte>> PEImage::data_sections() const
+	{
+		std::vector<std::span<const std::byte>> sections;
+		for (const PESection& section : m_Sections)
+		{
+			if (section.is_data())
+				sections.emplace_back(section_data(section));
+		}
+		return sections;
+	}
+}
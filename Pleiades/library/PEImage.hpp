@@ -0,0 +1,98 @@
+#pragma once
+
+#include <span>
+#include <vector>
+#include <optional>
+#include <string_view>
+#include <cstdint>
+
+namespace library_detail
+{
+	struct PESection
+	{
+		static constexpr uint32_t CntCode			= 0x00000020;
+		static constexpr uint32_t CntInitializedData = 0x00000040;
+		static constexpr uint32_t MemExecute		= 0x20000000;
+		static constexpr uint32_t MemRead			= 0x40000000;
+		static constexpr uint32_t MemWrite			= 0x80000000;
+
+		char		Name[9]{ };
+		uint32_t	VirtualAddress{ };
+		uint32_t	VirtualSize{ };
+		uint32_t	RawOffset{ };
+		uint32_t	RawSize{ };
+		uint32_t	Characteristics{ };
+
+		[[nodiscard]] std::string_view name() const noexcept { return Name; }
+
+		[[nodiscard]] bool is_executable() const noexcept
+		{
+			return (Characteristics & (MemExecute | CntCode)) != 0;
+		}
+
+		[[nodiscard]] bool is_data() const noexcept
+		{
+			return !is_executable() && (Characteristics & CntInitializedData);
+		}
+	};
+
+	/// <summary>
+	/// Minimal PE parser, reads the headers and section table from a buffer
+	/// works on both a module mapped in memory and a raw file read from disk, without any OS dependency
+	/// </summary>
+	class PEImage
+	{
+	public:
+		enum class Layout : char8_t
+		{
+			// module loaded in memory, sections are at their virtual address
+			Mapped,
+			// file read from disk, sections are at their raw offset
+			File
+		};
+
+		/// <summary>
+		/// Parse the headers and section table of a PE image
+		/// </summary>
+		/// <returns>the parsed image, or nullopt if the buffer isn't a valid PE image</returns>
+		[[nodiscard]] static std::optional<PEImage> Parse(std::span<const std::byte> buffer, Layout layout);
+
+		[[nodiscard]] const std::vector<PESection>& sections() const noexcept { return m_Sections; }
+
+		[[nodiscard]] const PESection* find_section(std::string_view name) const noexcept;
+
+		/// <summary>
+		/// Get a section's bytes, clamped to the buffer
+		/// </summary>
+		[[nodiscard]] std::span<const std::byte> section_data(const PESection& section) const noexcept;
+
+		/// <summary>
+		/// Get the bytes of every executable section, in the same order as the section table
+		/// </summary>
+		[[nodiscard]] std::vector<std::span<const std::byte>> code_sections() const;
+
+		/// <summary>
+		/// Get the bytes of every initialized, non-executable section, in the same order as the section table
+		/// </summary>
+		[[nodiscard]] std::vector<std::span<const std::byte>> data_sections() const;
+
+		[[nodiscard]] std::span<const std::byte> buffer() const noexcept { return m_Buffer; }
+
+		[[nodiscard]] uint16_t machine() const noexcept { return m_Machine; }
+		[[nodiscard]] uint32_t timestamp() const noexcept { return m_TimeDateStamp; }
+		[[nodiscard]] uint32_t size_of_image() const noexcept { return m_SizeOfImage; }
+		[[nodiscard]] uint32_t checksum() const noexcept { return m_CheckSum; }
+		[[nodiscard]] bool is_64bit() const noexcept { return m_Is64Bit; }
+
+	private:
+		std::span<const std::byte> m_Buffer;
+		std::vector<PESection> m_Sections;
+
+		uint32_t m_TimeDateStamp{ };
+		uint32_t m_SizeOfImage{ };
+		uint32_t m_CheckSum{ };
+		uint16_t m_Machine{ };
+		Layout m_Layout{ };
+		bool m_Is64Bit{ };
+	};
+}
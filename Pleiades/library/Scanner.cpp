@@ -0,0 +1,717 @@
+#include <array>
+#include <bit>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <system_error>
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PX_SCANNER_TARGET(isa)
+#else
+#include <cpuid.h>
+#define PX_SCANNER_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+#include "Scanner.hpp"
+
+namespace library_detail
+{
+	ScanIsa GetHostIsa() noexcept
+	{
+		static const ScanIsa host_isa = []
+		{
+#if defined(_MSC_VER)
+			int regs[4]{ };
+			__cpuid(regs, 0);
+			const int max_leaf = regs[0];
+
+			__cpuid(regs, 1);
+			const bool has_sse2 = (regs[3] & (1 << 26)) != 0;
+			const bool has_osxsave = (regs[2] & (1 << 27)) != 0;
+
+			bool has_avx2 = false;
+			if (max_leaf >= 7 && has_osxsave && (_xgetbv(0) & 0x6) == 0x6)
+			{
+				__cpuidex(regs, 7, 0);
+				has_avx2 = (regs[1] & (1 << 5)) != 0;
+			}
+#else
+			__builtin_cpu_init();
+			const bool has_sse2 = __builtin_cpu_supports("sse2");
+			const bool has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+			return has_avx2 ? ScanIsa::AVX2 : has_sse2 ? ScanIsa::SSE2 : ScanIsa::Scalar;
+		}();
+
+		return host_isa;
+	}
+
+	static bool MatchScalar(const uint8_t* data, const uint8_t* bytes, const uint8_t* mask, size_t size) noexcept
+	{
+		for (size_t i = 0; i < size; i++)
+		{
+			if ((data[i] ^ bytes[i]) & mask[i])
+				return false;
+		}
+		return true;
+	}
+
+	PX_SCANNER_TARGET("sse2")
+	static bool MatchSSE2(const uint8_t* data, const uint8_t* bytes, const uint8_t* mask, size_t size) noexcept
+	{
+		size_t i = 0;
+		for (; i + 16 <= size; i += 16)
+		{
+			const __m128i diff = _mm_and_si128(
+				_mm_xor_si128(
+					_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)),
+					_mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i))
+				),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i))
+			);
+
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF)
+				return false;
+		}
+		return MatchScalar(data + i, bytes + i, mask + i, size - i);
+	}
+
+	PX_SCANNER_TARGET("avx2")
+	static bool MatchAVX2(const uint8_t* data, const uint8_t* bytes, const uint8_t* mask, size_t size) noexcept
+	{
+		size_t i = 0;
+		for (; i + 32 <= size; i += 32)
+		{
+			const __m256i diff = _mm256_and_si256(
+				_mm256_xor_si256(
+					_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)),
+					_mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + i))
+				),
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(mask + i))
+			);
+
+			if (static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(diff, _mm256_setzero_si256()))) != 0xFFFFFFFFu)
+				return false;
+		}
+		return MatchSSE2(data + i, bytes + i, mask + i, size - i);
+	}
+
+
+	bool MatchPattern(const std::byte* data, const PatternView& pattern) noexcept
+	{
+		const auto ptr = reinterpret_cast<const uint8_t*>(data);
+		switch (GetHostIsa())
+		{
+		case ScanIsa::AVX2:
+			return MatchAVX2(ptr, pattern.Bytes.data(), pattern.Mask.data(), pattern.Bytes.size());
+		case ScanIsa::SSE2:
+			return MatchSSE2(ptr, pattern.Bytes.data(), pattern.Mask.data(), pattern.Bytes.size());
+		default:
+			return MatchScalar(ptr, pattern.Bytes.data(), pattern.Mask.data(), pattern.Bytes.size());
+		}
+	}
+
+
+	/// <summary>
+	/// Scan context shared by the kernels
+	/// every candidate 'pos' is the position of the anchor byte in the image, 'pos - Anchor' is where the pattern starts
+	/// </summary>
+	struct ScanState
+	{
+		const uint8_t* Image;
+		const uint8_t* Bytes;
+		const uint8_t* Mask;
+		const uint32_t* Skip;
+		size_t ImageSize;
+		size_t Size;
+		size_t Anchor;
+		// exclusive end for the anchor position
+		size_t AnchorEnd;
+	};
+
+	template<bool(*_Match)(const uint8_t*, const uint8_t*, const uint8_t*, size_t) noexcept>
+	static const uint8_t* ScanTail(const ScanState& state, size_t pos) noexcept
+	{
+		const uint8_t anchor_byte = state.Bytes[state.Anchor];
+		while (pos < state.AnchorEnd)
+		{
+			const auto found = static_cast<const uint8_t*>(std::memchr(state.Image + pos, anchor_byte, state.AnchorEnd - pos));
+			if (!found)
+				break;
+
+			const uint8_t* start = found - state.Anchor;
+			if (_Match(start, state.Bytes, state.Mask, state.Size))
+				return start;
+
+			pos = static_cast<size_t>(found - state.Image) + 1;
+		}
+		return nullptr;
+	}
+
+	static const uint8_t* ScanScalar(const ScanState& state) noexcept
+	{
+		if (!state.Skip)
+			return ScanTail<MatchScalar>(state, state.Anchor);
+
+		// Horspool, shift the window by the distance between its last byte and that byte's last occurrence in the pattern
+		const size_t last = state.Size - 1;
+		for (size_t pos = 0; pos + state.Size <= state.ImageSize; pos += state.Skip[state.Image[pos + last]])
+		{
+			if (MatchScalar(state.Image + pos, state.Bytes, state.Mask, state.Size))
+				return state.Image + pos;
+		}
+		return nullptr;
+	}
+
+	PX_SCANNER_TARGET("sse2")
+	static const uint8_t* ScanSSE2(const ScanState& state) noexcept
+	{
+		const __m128i anchor_vec = _mm_set1_epi8(static_cast<char>(state.Bytes[state.Anchor]));
+
+		size_t pos = state.Anchor;
+		for (; pos + 16 <= state.AnchorEnd; pos += 16)
+		{
+			const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state.Image + pos));
+			uint32_t candidates = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, anchor_vec)));
+
+			while (candidates)
+			{
+				const uint8_t* start = state.Image + pos + std::countr_zero(candidates) - state.Anchor;
+				if (MatchSSE2(start, state.Bytes, state.Mask, state.Size))
+					return start;
+				candidates &= candidates - 1;
+			}
+		}
+
+		return ScanTail<MatchSSE2>(state, pos);
+	}
+
+	PX_SCANNER_TARGET("avx2")
+	static const uint8_t* ScanAVX2(const ScanState& state) noexcept
+	{
+		const __m256i anchor_vec = _mm256_set1_epi8(static_cast<char>(state.Bytes[state.Anchor]));
+
+		size_t pos = state.Anchor;
+		for (; pos + 32 <= state.AnchorEnd; pos += 32)
+		{
+			const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state.Image + pos));
+			uint32_t candidates = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, anchor_vec)));
+
+			while (candidates)
+			{
+				const uint8_t* start = state.Image + pos + std::countr_zero(candidates) - state.Anchor;
+				if (MatchAVX2(start, state.Bytes, state.Mask, state.Size))
+					return start;
+				candidates &= candidates - 1;
+			}
+		}
+
+		return ScanTail<MatchAVX2>(state, pos);
+	}
+
+
+	const std::byte* FindPattern(std::span<const std::byte> image, const PatternView& pattern, ScanIsa isa) noexcept
+	{
+		const size_t size = pattern.Bytes.size();
+		if (!size || size > image.size() || pattern.Mask.size() != size)
+			return nullptr;
+
+		const auto image_ptr = reinterpret_cast<const uint8_t*>(image.data());
+
+		// a pattern made only of wildcards matches at the start of the image
+		if (pattern.Anchor >= size)
+			return image.data();
+
+		const ScanState state{
+			.Image = image_ptr,
+			.Bytes = pattern.Bytes.data(),
+			.Mask = pattern.Mask.data(),
+			.Skip = pattern.Skip.size() == 256 ? pattern.Skip.data() : nullptr,
+			.ImageSize = image.size(),
+			.Size = size,
+			.Anchor = pattern.Anchor,
+			.AnchorEnd = image.size() - size + pattern.Anchor + 1
+		};
+
+		const uint8_t* res;
+		switch (isa)
+		{
+		case ScanIsa::AVX2:
+			res = ScanAVX2(state);
+			break;
+		case ScanIsa::SSE2:
+			res = ScanSSE2(state);
+			break;
+		default:
+			res = ScanScalar(state);
+			break;
+		}
+
+		return reinterpret_cast<const std::byte*>(res);
+	}
+
+
+	/// <summary>
+	/// Find 'needle' with memchr on its first byte, used for short images and for the tail of the SIMD kernels
+	/// </summary>
+	static const uint8_t* FindBytesScalar(const uint8_t* image, size_t image_size, const uint8_t* needle, size_t size, size_t pos) noexcept
+	{
+		while (pos + size <= image_size)
+		{
+			const auto found = static_cast<const uint8_t*>(std::memchr(image + pos, needle[0], image_size - size + 1 - pos));
+			if (!found)
+				break;
+
+			if (!std::memcmp(found + 1, needle + 1, size - 1))
+				return found;
+
+			pos = static_cast<size_t>(found - image) + 1;
+		}
+		return nullptr;
+	}
+
+	PX_SCANNER_TARGET("sse2")
+	static const uint8_t* FindBytesSSE2(const uint8_t* image, size_t image_size, const uint8_t* needle, size_t size) noexcept
+	{
+		const __m128i first = _mm_set1_epi8(static_cast<char>(needle[0]));
+		const __m128i last = _mm_set1_epi8(static_cast<char>(needle[size - 1]));
+
+		size_t pos = 0;
+		for (; pos + size - 1 + 16 <= image_size; pos += 16)
+		{
+			const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(image + pos));
+			const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(image + pos + size - 1));
+
+			uint32_t candidates = static_cast<uint32_t>(_mm_movemask_epi8(
+				_mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last))
+			));
+
+			while (candidates)
+			{
+				const uint8_t* start = image + pos + std::countr_zero(candidates);
+				if (!std::memcmp(start + 1, needle + 1, size - 2))
+					return start;
+				candidates &= candidates - 1;
+			}
+		}
+
+		return FindBytesScalar(image, image_size, needle, size, pos);
+	}
+
+	PX_SCANNER_TARGET("avx2")
+	static const uint8_t* FindBytesAVX2(const uint8_t* image, size_t image_size, const uint8_t* needle, size_t size) noexcept
+	{
+		const __m256i first = _mm256_set1_epi8(static_cast<char>(needle[0]));
+		const __m256i last = _mm256_set1_epi8(static_cast<char>(needle[size - 1]));
+
+		size_t pos = 0;
+		for (; pos + size - 1 + 32 <= image_size; pos += 32)
+		{
+			const __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(image + pos));
+			const __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(image + pos + size - 1));
+
+			uint32_t candidates = static_cast<uint32_t>(_mm256_movemask_epi8(
+				_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last))
+			));
+
+			while (candidates)
+			{
+				const uint8_t* start = image + pos + std::countr_zero(candidates);
+				if (!std::memcmp(start + 1, needle + 1, size - 2))
+					return start;
+				candidates &= candidates - 1;
+			}
+		}
+
+		return FindBytesScalar(image, image_size, needle, size, pos);
+	}
+
+	const std::byte* FindBytes(std::span<const std::byte> image, std::span<const std::byte> needle, ScanIsa isa) noexcept
+	{
+		const size_t size = needle.size();
+		if (!size || size > image.size())
+			return nullptr;
+
+		const auto image_ptr = reinterpret_cast<const uint8_t*>(image.data());
+		const auto needle_ptr = reinterpret_cast<const uint8_t*>(needle.data());
+
+		const uint8_t* res;
+		// the SIMD kernels compare the first and last bytes separately
+		if (size == 1)
+			res = static_cast<const uint8_t*>(std::memchr(image_ptr, needle_ptr[0], image.size()));
+		else
+		{
+			switch (isa)
+			{
+			case ScanIsa::AVX2:
+				res = FindBytesAVX2(image_ptr, image.size(), needle_ptr, size);
+				break;
+			case ScanIsa::SSE2:
+				res = FindBytesSSE2(image_ptr, image.size(), needle_ptr, size);
+				break;
+			default:
+				res = FindBytesScalar(image_ptr, image.size(), needle_ptr, size, 0);
+				break;
+			}
+		}
+
+		return reinterpret_cast<const std::byte*>(res);
+	}
+
+	std::vector<const std::byte*> FindReferences(std::span<const std::byte> code, uintptr_t target, bool is_64bit)
+	{
+		std::vector<const std::byte*> references;
+
+		const size_t addr_size = is_64bit ? sizeof(uint64_t) : sizeof(uint32_t);
+		const uint64_t target64 = target;
+		const uint32_t target32 = static_cast<uint32_t>(target);
+
+		// absolute addresses
+		std::span<const std::byte> remaining = code;
+		const std::span<const std::byte> target_bytes{ reinterpret_cast<const std::byte*>(is_64bit ? static_cast<const void*>(&target64) : &target32), addr_size };
+		while (const std::byte* found = FindBytes(remaining, target_bytes))
+		{
+			references.push_back(found);
+			remaining = remaining.subspan(static_cast<size_t>(found - remaining.data()) + 1);
+		}
+
+		// rip-relative displacements are relative to the end of the instruction, assume the displacement ends it
+		if (is_64bit && code.size() >= sizeof(int32_t))
+		{
+			const size_t absolute_count = references.size();
+			const uintptr_t code_begin = reinterpret_cast<uintptr_t>(code.data());
+			for (size_t pos = 0; pos + sizeof(int32_t) <= code.size(); pos++)
+			{
+				int32_t disp;
+				std::memcpy(&disp, code.data() + pos, sizeof(disp));
+				if (code_begin + pos + sizeof(int32_t) + static_cast<intptr_t>(disp) == target)
+					references.push_back(code.data() + pos);
+			}
+
+			std::inplace_merge(references.begin(), references.begin() + absolute_count, references.end());
+		}
+
+		return references;
+	}
+
+
+	std::vector<const std::byte*> FindPatterns(std::span<const std::byte> image, std::span<const PatternView> patterns)
+	{
+		std::vector<const std::byte*> results(patterns.size());
+
+		// indices of patterns, grouped by their anchor byte
+		std::array<std::vector<uint32_t>, 256> buckets;
+		size_t pending = 0;
+
+		for (uint32_t i = 0; i < patterns.size(); i++)
+		{
+			const PatternView& pattern = patterns[i];
+			const size_t size = pattern.Bytes.size();
+			if (!size || size > image.size() || pattern.Mask.size() != size)
+				continue;
+
+			if (pattern.Anchor >= size)
+			{
+				results[i] = image.data();
+				continue;
+			}
+
+			buckets[pattern.Bytes[pattern.Anchor]].push_back(i);
+			++pending;
+		}
+
+		const auto image_ptr = reinterpret_cast<const uint8_t*>(image.data());
+		for (size_t pos = 0; pending && pos < image.size(); pos++)
+		{
+			auto& bucket = buckets[image_ptr[pos]];
+			if (bucket.empty())
+				continue;
+
+			for (size_t j = 0; j < bucket.size();)
+			{
+				const PatternView& pattern = patterns[bucket[j]];
+				const size_t size = pattern.Bytes.size();
+
+				// anchor is too close to the start or the pattern would overflow the image
+				if (pos < pattern.Anchor || pos - pattern.Anchor + size > image.size())
+				{
+					++j;
+					continue;
+				}
+
+				const std::byte* start = image.data() + pos - pattern.Anchor;
+				if (MatchPattern(start, pattern))
+				{
+					results[bucket[j]] = start;
+					// pattern was resolved, no need to check it again
+					bucket[j] = bucket.back();
+					bucket.pop_back();
+					--pending;
+				}
+				else ++j;
+			}
+		}
+
+		return results;
+	}
+
+
+	/// <summary>
+	/// Smallest chunk handed to a worker, smaller chunks cost more in scheduling than they save
+	/// </summary>
+	static constexpr size_t MinChunkSize = 1 << 20;
+
+	/// <summary>
+	/// Split 'image_size' bytes into chunks, a few per worker so a slow chunk doesn't stall the others
+	/// </summary>
+	/// <returns>size of each chunk, or 0 if the image should be scanned on the calling thread</returns>
+	static size_t GetChunkSize(size_t image_size, size_t workers) noexcept
+	{
+		if (workers <= 1 || image_size < MinChunkSize * 2)
+			return 0;
+
+		return std::max(MinChunkSize, image_size / (workers * 4) + 1);
+	}
+
+	/// <summary>
+	/// Threads shared by every parallel scan, created once a scan needs them and kept until 'ShutdownScanPool'
+	/// a single scan runs on the pool at a time, a scan started while it's busy runs on the calling thread alone
+	/// </summary>
+	class ScanPool
+	{
+	public:
+		using chunk_fn = void(*)(const void* ctx, size_t chunk);
+
+		/// <summary>
+		/// Run 'fn(ctx, chunk_index)' for every chunk, chunks are handed out in increasing order
+		/// the calling thread is one of the workers, and every worker is done with the chunks once this returns
+		/// </summary>
+		void Run(size_t chunk_count, size_t workers, const void* ctx, chunk_fn fn)
+		{
+			std::unique_lock run_lock(m_RunLock, std::try_to_lock);
+			const size_t helpers = run_lock.owns_lock() ? std::min(workers, chunk_count) - 1 : 0;
+			if (!helpers)
+			{
+				for (size_t i = 0; i < chunk_count; i++)
+					fn(ctx, i);
+				return;
+			}
+
+			{
+				std::scoped_lock lock(m_Lock);
+				try
+				{
+					while (m_Threads.size() < helpers)
+						m_Threads.emplace_back([this] (std::stop_token stop) { Work(stop); });
+				}
+				catch (const std::system_error&)
+				{
+					// scan with the threads we got
+				}
+
+				m_Ctx = ctx;
+				m_Fn = fn;
+				m_ChunkCount = chunk_count;
+				m_NextChunk.store(0, std::memory_order_relaxed);
+				m_Helpers = helpers;
+				m_Joined = 0;
+				m_Generation++;
+			}
+			m_Wake.notify_all();
+
+			Drain();
+
+			// close the job so late threads don't join it, and wait for the ones still scanning
+			std::unique_lock lock(m_Lock);
+			m_Helpers = 0;
+			m_Done.wait(lock, [this] { return !m_Busy; });
+		}
+
+		/// <summary>
+		/// Stop and join every thread, waits for the running scan first
+		/// </summary>
+		void Shutdown() noexcept
+		{
+			std::vector<std::jthread> threads;
+			{
+				std::scoped_lock lock(m_RunLock, m_Lock);
+				threads.swap(m_Threads);
+			}
+			// jthread's destructor requests a stop, which wakes the waiting threads, and joins them
+		}
+
+	private:
+		void Work(std::stop_token stop)
+		{
+			size_t seen = 0;
+			std::unique_lock lock(m_Lock);
+			while (m_Wake.wait(lock, stop, [&] { return m_Generation != seen && m_Joined < m_Helpers; }))
+			{
+				seen = m_Generation;
+				m_Joined++;
+				m_Busy++;
+
+				lock.unlock();
+				Drain();
+				lock.lock();
+
+				if (!--m_Busy)
+					m_Done.notify_all();
+			}
+		}
+
+		void Drain() const
+		{
+			for (size_t i; (i = m_NextChunk.fetch_add(1, std::memory_order_relaxed)) < m_ChunkCount;)
+				m_Fn(m_Ctx, i);
+		}
+
+		std::mutex m_RunLock;
+
+		std::mutex m_Lock;
+		std::condition_variable_any m_Wake;
+		std::condition_variable m_Done;
+		std::vector<std::jthread> m_Threads;
+
+		// current job, only written while no thread is draining it
+		const void* m_Ctx{ };
+		chunk_fn m_Fn{ };
+		size_t m_ChunkCount{ };
+		mutable std::atomic<size_t> m_NextChunk{ };
+
+		size_t m_Generation{ };
+		// number of threads allowed to join the current job, and the ones that did
+		size_t m_Helpers{ }, m_Joined{ };
+		size_t m_Busy{ };
+	};
+
+	/// <summary>
+	/// The pool is never destroyed, joining its threads in a static destructor would deadlock on the loader lock once the dll is unloaded
+	/// </summary>
+	static ScanPool& GetScanPool()
+	{
+		static ScanPool* pool = new ScanPool;
+		return *pool;
+	}
+
+	void ShutdownScanPool() noexcept
+	{
+		GetScanPool().Shutdown();
+	}
+
+	/// <summary>
+	/// Run 'fn(chunk_index)' for every chunk on the scan pool, see 'ScanPool::Run'
+	/// </summary>
+	template<typename _Fn>
+	static void RunChunks(size_t chunk_count, size_t workers, const _Fn& fn)
+	{
+		GetScanPool().Run(
+			chunk_count,
+			workers,
+			&fn,
+			[] (const void* ctx, size_t chunk) { (*static_cast<const _Fn*>(ctx))(chunk); }
+		);
+	}
+
+	/// <summary>
+	/// Lower 'best' to 'offset' if it's smaller
+	/// </summary>
+	static void StoreLowest(std::atomic<size_t>& best, size_t offset) noexcept
+	{
+		size_t cur = best.load(std::memory_order_relaxed);
+		while (offset < cur && !best.compare_exchange_weak(cur, offset, std::memory_order_relaxed))
+		{ }
+	}
+
+
+	const std::byte* FindPatternParallel(std::span<const std::byte> image, const PatternView& pattern, size_t workers)
+	{
+		const size_t size = pattern.Bytes.size();
+		const size_t chunk_size = GetChunkSize(image.size(), workers);
+		if (!chunk_size || !size)
+			return FindPattern(image, pattern);
+
+		const size_t chunk_count = (image.size() + chunk_size - 1) / chunk_size;
+		std::atomic<size_t> best{ image.size() };
+
+		RunChunks(
+			chunk_count,
+			workers,
+			[&] (size_t chunk)
+			{
+				const size_t begin = chunk * chunk_size;
+				// a match was already found in an earlier chunk
+				if (begin >= best.load(std::memory_order_relaxed))
+					return;
+
+				// overlap with the next chunk so patterns crossing the boundary are still matched
+				const size_t end = std::min(image.size(), begin + chunk_size + size - 1);
+				if (const std::byte* res = FindPattern(image.subspan(begin, end - begin), pattern))
+					StoreLowest(best, static_cast<size_t>(res - image.data()));
+			}
+		);
+
+		const size_t offset = best.load(std::memory_order_relaxed);
+		return offset < image.size() ? image.data() + offset : nullptr;
+	}
+
+	std::vector<const std::byte*> FindPatternsParallel(std::span<const std::byte> image, std::span<const PatternView> patterns, size_t workers)
+	{
+		const size_t chunk_size = GetChunkSize(image.size(), workers);
+		if (!chunk_size || patterns.empty())
+			return FindPatterns(image, patterns);
+
+		size_t max_size = 0;
+		for (const PatternView& pattern : patterns)
+			max_size = std::max(max_size, pattern.Bytes.size());
+
+		const size_t chunk_count = (image.size() + chunk_size - 1) / chunk_size;
+		std::vector<std::atomic<size_t>> best(patterns.size());
+		for (auto& offset : best)
+			offset.store(image.size(), std::memory_order_relaxed);
+
+		RunChunks(
+			chunk_count,
+			workers,
+			[&] (size_t chunk)
+			{
+				const size_t begin = chunk * chunk_size;
+				const size_t end = std::min(image.size(), begin + chunk_size + (max_size ? max_size - 1 : 0));
+
+				// skip patterns that were already found in an earlier chunk
+				std::vector<PatternView> views(patterns.begin(), patterns.end());
+				bool has_pending = false;
+				for (size_t i = 0; i < views.size(); i++)
+				{
+					if (best[i].load(std::memory_order_relaxed) <= begin)
+						views[i] = { };
+					else has_pending = true;
+				}
+
+				if (!has_pending)
+					return;
+
+				const std::vector<const std::byte*> results = FindPatterns(image.subspan(begin, end - begin), views);
+				for (size_t i = 0; i < results.size(); i++)
+				{
+					if (results[i])
+						StoreLowest(best[i], static_cast<size_t>(results[i] - image.data()));
+				}
+			}
+		);
+
+		std::vector<const std::byte*> results(patterns.size());
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const size_t offset = best[i].load(std::memory_order_relaxed);
+			if (offset < image.size())
+				results[i] = image.data() + offset;
+		}
+		return results;
+	}
+}
\ No newline at end of file
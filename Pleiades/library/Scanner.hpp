@@ -0,0 +1,149 @@
+#pragma once
+
+#include <span>
+#include <array>
+#include <limits>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace library_detail
+{
+	enum class ScanIsa : char8_t
+	{
+		Scalar,
+		SSE2,
+		AVX2
+	};
+
+	/// <summary>
+	/// A pattern to match against a byte span
+	/// 'Mask[i]' is 0xFF for a byte that must match 'Bytes[i]' and 0x00 for a wildcard
+	/// </summary>
+	struct PatternView
+	{
+		std::span<const uint8_t> Bytes;
+		std::span<const uint8_t> Mask;
+		// index of the byte to search for first, must not be a wildcard
+		size_t Anchor{ };
+		// optional bad character shift table (256 entries) for the scalar kernel
+		std::span<const uint32_t> Skip;
+	};
+
+	/// <summary>
+	/// Get the best instruction set supported by the current cpu
+	/// </summary>
+	[[nodiscard]] ScanIsa GetHostIsa() noexcept;
+
+	/// <summary>
+	/// Relative frequency of bytes in x86/x64 code sections, higher is more common
+	/// used to pick an anchor byte that rarely shows up in the image
+	/// </summary>
+	inline constexpr std::array<uint8_t, 256> ByteFrequencies = []
+	{
+		std::array<uint8_t, 256> freqs{ };
+		constexpr std::pair<uint8_t, uint8_t> common_bytes[]{
+			{ 0x00, 255 }, { 0xFF, 220 }, { 0xCC, 200 }, { 0x8B, 190 }, { 0x48, 180 },
+			{ 0x89, 170 }, { 0x24, 150 }, { 0x0F, 140 }, { 0x45, 130 }, { 0x4C, 120 },
+			{ 0x83, 120 }, { 0x44, 110 }, { 0x85, 100 }, { 0xE8, 100 }, { 0x8D, 100 },
+			{ 0x01, 90 },  { 0x74, 90 },  { 0x75, 90 },  { 0xC3, 80 },  { 0x08, 80 },
+			{ 0x10, 80 },  { 0x55, 70 },  { 0xEC, 70 },  { 0x5D, 70 },  { 0xC7, 70 },
+			{ 0x33, 60 },  { 0xC0, 60 },  { 0x04, 60 },  { 0x50, 60 },  { 0x56, 60 },
+			{ 0x57, 60 },  { 0x53, 50 },  { 0x51, 50 },  { 0x6A, 50 },  { 0xE9, 50 },
+			{ 0xEB, 50 },  { 0x90, 50 },  { 0x40, 50 },  { 0x41, 50 },  { 0x49, 40 },
+			{ 0x20, 40 },  { 0x18, 40 },  { 0x28, 40 },  { 0x30, 40 },  { 0x38, 40 },
+			{ 0x68, 40 },  { 0x0C, 30 },  { 0x14, 30 },  { 0x1C, 30 },  { 0xF8, 30 },
+			{ 0xFC, 30 },  { 0xC4, 30 },  { 0x5E, 30 },  { 0x5F, 30 },  { 0x5B, 30 },
+			{ 0x84, 30 },  { 0x02, 30 },  { 0x03, 30 },  { 0x80, 30 },  { 0xC1, 20 }
+		};
+
+		for (auto [byte, freq] : common_bytes)
+			freqs[byte] = freq;
+		return freqs;
+	}();
+
+	/// <summary>
+	/// Select the rarest non-wildcard byte in the pattern, based on byte frequencies in x86/x64 code
+	/// </summary>
+	/// <returns>index of the anchor byte, or 'bytes.size()' if the pattern only contains wildcards</returns>
+	[[nodiscard]] constexpr size_t SelectAnchor(std::span<const uint8_t> bytes, std::span<const uint8_t> mask) noexcept
+	{
+		size_t anchor = bytes.size();
+		unsigned int best_freq = std::numeric_limits<unsigned int>::max();
+
+		for (size_t i = 0; i < bytes.size(); i++)
+		{
+			if (!mask[i])
+				continue;
+
+			if (const unsigned int freq = ByteFrequencies[bytes[i]]; freq < best_freq)
+			{
+				best_freq = freq;
+				anchor = i;
+			}
+		}
+
+		return anchor;
+	}
+
+	/// <summary>
+	/// Check if the pattern matches at the start of 'data', 'data' must be at least as long as the pattern
+	/// </summary>
+	[[nodiscard]] bool MatchPattern(const std::byte* data, const PatternView& pattern) noexcept;
+
+	/// <summary>
+	/// Find the lowest address in 'image' where the pattern matches
+	/// </summary>
+	/// <returns>pointer to the first match, null if it doesn't exists</returns>
+	[[nodiscard]] const std::byte* FindPattern(std::span<const std::byte> image, const PatternView& pattern, ScanIsa isa) noexcept;
+
+	[[nodiscard]] inline const std::byte* FindPattern(std::span<const std::byte> image, const PatternView& pattern) noexcept
+	{
+		return FindPattern(image, pattern, GetHostIsa());
+	}
+
+	/// <summary>
+	/// Find the lowest occurrence of 'needle' in 'image'
+	/// candidates are filtered on the needle's first and last bytes before being compared, the search is linear in practice
+	/// </summary>
+	/// <returns>pointer to the first occurrence, null if it doesn't exists</returns>
+	[[nodiscard]] const std::byte* FindBytes(std::span<const std::byte> image, std::span<const std::byte> needle, ScanIsa isa) noexcept;
+
+	[[nodiscard]] inline const std::byte* FindBytes(std::span<const std::byte> image, std::span<const std::byte> needle) noexcept
+	{
+		return FindBytes(image, needle, GetHostIsa());
+	}
+
+	/// <summary>
+	/// Find every reference to 'target' in 'code'
+	/// references are absolute addresses (eg: push imm32, mov reg, imm), and on x64 rip-relative displacements (eg: lea reg, [rip + disp32])
+	/// </summary>
+	/// <returns>pointers to the start of each absolute address or displacement, in increasing order</returns>
+	[[nodiscard]] std::vector<const std::byte*> FindReferences(std::span<const std::byte> code, uintptr_t target, bool is_64bit);
+
+	/// <summary>
+	/// Find the lowest match of every pattern in a single pass over 'image'
+	/// patterns are bucketed by their anchor byte, each byte of the image is checked once against its bucket
+	/// </summary>
+	/// <returns>pointers to the first match of each pattern, in the same order as 'patterns', null for missing patterns</returns>
+	[[nodiscard]] std::vector<const std::byte*> FindPatterns(std::span<const std::byte> image, std::span<const PatternView> patterns);
+
+	/// <summary>
+	/// Same as 'FindPattern', 'image' is split into chunks that are scanned by 'workers' threads
+	/// chunks overlap by the pattern's size minus one, and the lowest match wins so the result doesn't depend on scheduling
+	/// </summary>
+	/// <param name="workers">number of threads to scan with, including the calling thread</param>
+	[[nodiscard]] const std::byte* FindPatternParallel(std::span<const std::byte> image, const PatternView& pattern, size_t workers);
+
+	/// <summary>
+	/// Same as 'FindPatterns', 'image' is split into chunks that are scanned by 'workers' threads
+	/// </summary>
+	/// <param name="workers">number of threads to scan with, including the calling thread</param>
+	[[nodiscard]] std::vector<const std::byte*> FindPatternsParallel(std::span<const std::byte> image, std::span<const PatternView> patterns, size_t workers);
+
+	/// <summary>
+	/// Stop and join the threads of the parallel scans, must be called before the dll is unloaded
+	/// </summary>
+	void ShutdownScanPool() noexcept;
+}
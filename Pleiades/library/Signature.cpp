@@ -0,0 +1,53 @@
+#include <string>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "Signature.hpp"
+
+namespace library_detail
+{
+	CompiledSignature::CompiledSignature(std::string_view pattern)
+	{
+		m_Bytes.reserve(pattern.size() / 2);
+		m_Mask.reserve(pattern.size() / 2);
+
+		const bool valid = ParsePattern(
+			pattern,
+			[this] (uint8_t value, bool is_exact)
+			{
+				m_Bytes.push_back(value);
+				m_Mask.push_back(is_exact ? 0xFF : 0x00);
+			}
+		);
+
+		if (!valid)
+			throw std::invalid_argument("Invalid signature pattern");
+
+		m_Anchor = SelectAnchor(m_Bytes, m_Mask);
+		m_UseSkip = !m_Bytes.empty() && BuildSkipTable(m_Bytes, m_Mask, m_Skip) >= 4;
+	}
+
+	const CompiledSignature& CompiledSignature::Get(std::string_view pattern)
+	{
+		struct string_hash
+		{
+			using is_transparent = void;
+			size_t operator()(std::string_view str) const noexcept { return std::hash<std::string_view>{ }(str); }
+		};
+
+		static std::shared_mutex cache_lock;
+		static std::unordered_map<std::string, CompiledSignature, string_hash, std::equal_to<>> cache;
+
+		{
+			std::shared_lock lock(cache_lock);
+			if (const auto iter = cache.find(pattern); iter != cache.end())
+				return iter->second;
+		}
+
+		CompiledSignature signature(pattern);
+
+		std::unique_lock lock(cache_lock);
+		return cache.try_emplace(std::string(pattern), std::move(signature)).first->second;
+	}
+}
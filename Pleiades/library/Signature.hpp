@@ -0,0 +1,201 @@
+#pragma once
+
+#include <string_view>
+#include <stdexcept>
+
+#include "Scanner.hpp"
+
+namespace library_detail
+{
+	/// <summary>
+	/// Parse a pattern into bytes, eg: "55 8B EC ? ?? * 8B 0D 2A"
+	/// each '?' and '*' is a single wildcard byte, "??" is two of them, any pair of hex digits is a byte matched exactly
+	/// every other character is skipped, eg: whitespaces or "\x" escapes, same as the old regex parser did
+	/// whitespaces between bytes are optional, "558BEC" is the same as "55 8B EC"
+	/// </summary>
+	/// <param name="emit">called with (byte, is_exact) for every parsed byte</param>
+	/// <returns>false if the pattern doesn't contain any byte</returns>
+	template<typename _Fn>
+	[[nodiscard]] constexpr bool ParsePattern(std::string_view pattern, _Fn&& emit)
+	{
+		const auto hex_value = [] (char c) constexpr -> int
+		{
+			if (c >= '0' && c <= '9')
+				return c - '0';
+			if (c >= 'a' && c <= 'f')
+				return c - 'a' + 10;
+			if (c >= 'A' && c <= 'F')
+				return c - 'A' + 10;
+			return -1;
+		};
+
+		bool has_bytes = false;
+		for (size_t i = 0; i < pattern.size();)
+		{
+			const char c = pattern[i];
+			if (c == '?' || c == '*')
+			{
+				emit(uint8_t{ }, false);
+				has_bytes = true;
+				++i;
+				continue;
+			}
+
+			// a lone hex digit is skipped like any other character, eg: the '0' of "0x55"
+			const int high = hex_value(c), low = i + 1 < pattern.size() ? hex_value(pattern[i + 1]) : -1;
+			if (high < 0 || low < 0)
+			{
+				++i;
+				continue;
+			}
+
+			emit(static_cast<uint8_t>((high << 4) | low), true);
+			has_bytes = true;
+			i += 2;
+		}
+
+		return has_bytes;
+	}
+
+	/// <summary>
+	/// Build a Horspool bad character table, a wildcard matches any byte so no shift can skip past it
+	/// </summary>
+	/// <returns>smallest shift in the table</returns>
+	constexpr uint32_t BuildSkipTable(std::span<const uint8_t> bytes, std::span<const uint8_t> mask, std::array<uint32_t, 256>& skip) noexcept
+	{
+		const size_t size = bytes.size();
+
+		uint32_t max_shift = static_cast<uint32_t>(size);
+		for (size_t i = 0; i + 1 < size; i++)
+		{
+			if (!mask[i])
+				max_shift = static_cast<uint32_t>(size - 1 - i);
+		}
+
+		skip.fill(max_shift);
+		uint32_t min_shift = max_shift;
+		for (size_t i = 0; i + 1 < size; i++)
+		{
+			if (!mask[i])
+				continue;
+
+			const uint32_t shift = static_cast<uint32_t>(size - 1 - i);
+			if (shift < skip[bytes[i]])
+				skip[bytes[i]] = shift;
+			if (shift < min_shift)
+				min_shift = shift;
+		}
+
+		return min_shift;
+	}
+
+
+	/// <summary>
+	/// A pattern parsed once into separate value and mask arrays, with a precomputed anchor and skip table
+	/// </summary>
+	class CompiledSignature
+	{
+	public:
+		CompiledSignature() = default;
+
+		/// <summary>
+		/// Parse and compile a pattern
+		/// </summary>
+		/// <exception cref="std::invalid_argument">if the pattern doesn't contain any byte</exception>
+		explicit CompiledSignature(std::string_view pattern);
+
+		/// <summary>
+		/// Get a compiled pattern from the process-wide cache, patterns are only parsed on their first lookup
+		/// </summary>
+		/// <exception cref="std::invalid_argument">if the pattern doesn't contain any byte</exception>
+		[[nodiscard]] static const CompiledSignature& Get(std::string_view pattern);
+
+		[[nodiscard]] size_t size() const noexcept { return m_Bytes.size(); }
+		[[nodiscard]] bool empty() const noexcept { return m_Bytes.empty(); }
+
+		[[nodiscard]] std::span<const uint8_t> bytes() const noexcept { return m_Bytes; }
+		[[nodiscard]] std::span<const uint8_t> mask() const noexcept { return m_Mask; }
+		[[nodiscard]] size_t anchor() const noexcept { return m_Anchor; }
+
+		[[nodiscard]] PatternView view() const noexcept
+		{
+			return {
+				.Bytes = m_Bytes,
+				.Mask = m_Mask,
+				.Anchor = m_Anchor,
+				.Skip = m_UseSkip ? std::span<const uint32_t>(m_Skip) : std::span<const uint32_t>{ }
+			};
+		}
+
+		/// <summary>
+		/// Check if the pattern matches at 'data', 'data' must be at least 'size()' bytes long
+		/// </summary>
+		[[nodiscard]] bool match(const std::byte* data) const noexcept
+		{
+			return MatchPattern(data, view());
+		}
+
+		/// <summary>
+		/// Find the lowest address in 'image' where the pattern matches
+		/// </summary>
+		[[nodiscard]] const std::byte* find(std::span<const std::byte> image) const noexcept
+		{
+			return FindPattern(image, view());
+		}
+
+	private:
+		std::vector<uint8_t> m_Bytes;
+		std::vector<uint8_t> m_Mask;
+		std::array<uint32_t, 256> m_Skip{ };
+		size_t m_Anchor{ };
+		// the skip table is only worth it if every shift moves the window by more than a few bytes
+		bool m_UseSkip{ };
+	};
+
+
+	/// <summary>
+	/// A pattern parsed at compile time, eg:
+	/// static constexpr library_detail::StaticSignature sig{ "55 8B EC 83 E4 ? 81 EC" };
+	/// lib->FindBySignature(sig.view());
+	/// </summary>
+	template<size_t _Len>
+	class StaticSignature
+	{
+	public:
+		consteval StaticSignature(const char(&pattern)[_Len])
+		{
+			const bool valid = ParsePattern(
+				std::string_view(pattern, _Len - 1),
+				[this] (uint8_t value, bool is_exact)
+				{
+					m_Bytes[m_Size] = value;
+					m_Mask[m_Size] = is_exact ? 0xFF : 0x00;
+					++m_Size;
+				}
+			);
+
+			// not a constant expression, patterns without any byte fail to compile
+			if (!valid)
+				throw std::invalid_argument("Invalid signature pattern");
+
+			m_Anchor = SelectAnchor({ m_Bytes.data(), m_Size }, { m_Mask.data(), m_Size });
+		}
+
+		[[nodiscard]] constexpr size_t size() const noexcept { return m_Size; }
+
+		[[nodiscard]] constexpr PatternView view() const noexcept
+		{
+			return {
+				.Bytes = { m_Bytes.data(), m_Size },
+				.Mask = { m_Mask.data(), m_Size },
+				.Anchor = m_Anchor
+			};
+		}
+
+	private:
+		std::array<uint8_t, _Len> m_Bytes{ };
+		std::array<uint8_t, _Len> m_Mask{ };
+		size_t m_Size{ };
+		size_t m_Anchor{ };
+	};
+}
@@ -0,0 +1,170 @@
+#include <format>
+#include <fstream>
+
+#include <nlohmann/json.hpp>
+
+#include "Manager.hpp"
+#include "Module.hpp"
+#include "Signature.hpp"
+#include "SignatureCache.hpp"
+
+using px::IntPtr;
+
+static std::string GetCachePath()
+{
+	return std::format("{}\\signatures.cache.json", LibraryManager::LogsDir);
+}
+
+
+IntPtr SignatureCache::Find(LibraryImpl& lib, const std::string& lib_name, std::string_view section, std::string_view pattern)
+{
+	try
+	{
+		return Find(lib, lib_name, section, pattern, library_detail::CompiledSignature::Get(pattern).view());
+	}
+	catch (const std::invalid_argument&)
+	{
+		return nullptr;
+	}
+}
+
+IntPtr SignatureCache::Find(LibraryImpl& lib, const std::string& lib_name, std::string_view section, std::string_view pattern, const library_detail::PatternView& compiled)
+{
+	std::scoped_lock lock(m_Lock);
+
+	const ModuleEntry& entry = GetModule(lib, lib_name);
+	const auto iter = entry.Signatures.find(GetKey(section, pattern));
+	if (iter == entry.Signatures.end())
+		return nullptr;
+
+	const std::span<const std::byte> image = lib.GetImage();
+
+	// the module's code may have been patched since, verify the bytes before trusting the cached address
+	if (compiled.Bytes.empty() || iter->second > image.size() || image.size() - iter->second < compiled.Bytes.size() ||
+		!library_detail::MatchPattern(image.data() + iter->second, compiled))
+		return nullptr;
+
+	return const_cast<std::byte*>(image.data() + iter->second);
+}
+
+void SignatureCache::Store(LibraryImpl& lib, const std::string& lib_name, std::string_view section, std::string_view pattern, IntPtr address)
+{
+	const std::span<const std::byte> image = lib.GetImage();
+	const std::byte* ptr = address.get<const std::byte>();
+	if (ptr < image.data() || ptr >= image.data() + image.size())
+		return;
+
+	std::scoped_lock lock(m_Lock);
+
+	ModuleEntry& entry = GetModule(lib, lib_name);
+	const uint32_t rva = static_cast<uint32_t>(ptr - image.data());
+
+	auto [iter, inserted] = entry.Signatures.try_emplace(GetKey(section, pattern), rva);
+	if (inserted || iter->second != rva)
+	{
+		iter->second = rva;
+		m_Dirty = true;
+	}
+}
+
+void SignatureCache::Save()
+{
+	std::scoped_lock lock(m_Lock);
+	if (!m_Dirty)
+		return;
+
+	nlohmann::json cache_info = nlohmann::json::object();
+	for (const auto& [lib_name, entry] : m_Modules)
+	{
+		nlohmann::json& module_info = cache_info[lib_name];
+		module_info["size"] = entry.SizeOfImage;
+		module_info["timestamp"] = entry.TimeDateStamp;
+		module_info["checksum"] = entry.CheckSum;
+
+		nlohmann::json& signatures = module_info["signatures"] = nlohmann::json::object();
+		for (const auto& [key, rva] : entry.Signatures)
+			signatures[key] = rva;
+	}
+
+	std::ofstream file(GetCachePath());
+	if (file)
+	{
+		file << cache_info;
+		m_Dirty = false;
+	}
+}
+
+void SignatureCache::Load()
+{
+	m_Loaded = true;
+
+	std::ifstream file(GetCachePath());
+	if (!file)
+		return;
+
+	const nlohmann::json cache_info = nlohmann::json::parse(file, nullptr, false);
+	if (!cache_info.is_object())
+		return;
+
+	for (const auto& module_info : cache_info.items())
+	{
+		const nlohmann::json& info = module_info.value();
+		if (!info.is_object())
+			continue;
+
+		const auto size = info.find("size"), timestamp = info.find("timestamp"), checksum = info.find("checksum"), signatures = info.find("signatures");
+		if (size == info.end() || !size->is_number_unsigned() ||
+			timestamp == info.end() || !timestamp->is_number_unsigned() ||
+			checksum == info.end() || !checksum->is_number_unsigned() ||
+			signatures == info.end() || !signatures->is_object())
+			continue;
+
+		ModuleEntry& entry = m_Modules[module_info.key()];
+		entry.SizeOfImage = size->get<uint32_t>();
+		entry.TimeDateStamp = timestamp->get<uint32_t>();
+		entry.CheckSum = checksum->get<uint32_t>();
+
+		for (const auto& sig : signatures->items())
+		{
+			if (sig.value().is_number_unsigned())
+				entry.Signatures.emplace(sig.key(), sig.value().get<uint32_t>());
+		}
+	}
+}
+
+auto SignatureCache::GetModule(LibraryImpl& lib, const std::string& lib_name) -> ModuleEntry&
+{
+	if (!m_Loaded)
+		Load();
+
+	ModuleEntry& entry = m_Modules[lib_name];
+	if (entry.Validated)
+		return entry;
+
+	entry.Validated = true;
+
+	// only read the headers, the mapped code is relocated and may be patched by anyone, it can't identify the module
+	uint32_t size_of_image = 0, timestamp = 0, checksum = 0;
+	if (const library_detail::PEImage* image = lib.GetPEImage())
+	{
+		size_of_image = image->size_of_image();
+		timestamp = image->timestamp();
+		checksum = image->checksum();
+	}
+
+	if (entry.SizeOfImage != size_of_image || entry.TimeDateStamp != timestamp || entry.CheckSum != checksum)
+	{
+		entry.SizeOfImage = size_of_image;
+		entry.TimeDateStamp = timestamp;
+		entry.CheckSum = checksum;
+		entry.Signatures.clear();
+		m_Dirty = true;
+	}
+
+	return entry;
+}
+
+std::string SignatureCache::GetKey(std::string_view section, std::string_view pattern)
+{
+	return std::format("{}:{}", section, pattern);
+}
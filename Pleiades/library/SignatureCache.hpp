@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <px/IntPtr.hpp>
+
+#include "Scanner.hpp"
+
+class LibraryImpl;
+
+/// <summary>
+/// On-disk cache of resolved signatures, maps a module and a signature to the signature's RVA
+/// a module is identified by its image size, timestamp and checksum from the PE headers, entries are dropped once it changes
+/// cached addresses are always verified against the pattern before being returned
+/// </summary>
+class SignatureCache
+{
+public:
+	/// <summary>
+	/// Find a signature in the cache
+	/// </summary>
+	/// <returns>pointer to the signature if it was cached and still matches, null otherwise</returns>
+	px::IntPtr Find(LibraryImpl& lib, const std::string& lib_name, std::string_view section, std::string_view pattern);
+
+	/// <summary>
+	/// Find a signature in the cache, 'compiled' is used to verify the cached address instead of parsing 'pattern' again
+	/// </summary>
+	/// <returns>pointer to the signature if it was cached and still matches, null otherwise</returns>
+	px::IntPtr Find(LibraryImpl& lib, const std::string& lib_name, std::string_view section, std::string_view pattern, const library_detail::PatternView& compiled);
+
+	/// <summary>
+	/// Store a resolved signature in the cache
+	/// </summary>
+	void Store(LibraryImpl& lib, const std::string& lib_name, std::string_view section, std::string_view pattern, px::IntPtr address);
+
+	/// <summary>
+	/// Write the cache file if it was modified since it was loaded
+	/// 'Store' only marks the cache as modified, it's saved after 'GameData::ResolveSignatures', once the plugins are loaded and at shutdown
+	/// </summary>
+	void Save();
+
+private:
+	struct ModuleEntry
+	{
+		uint32_t SizeOfImage{ };
+		uint32_t TimeDateStamp{ };
+		uint32_t CheckSum{ };
+		// the identity was checked against the loaded module in this process
+		bool Validated{ };
+		std::unordered_map<std::string, uint32_t> Signatures;
+	};
+
+	/// <summary>
+	/// Read the cache file, once
+	/// </summary>
+	void Load();
+
+	/// <summary>
+	/// Get a module's entry, its cached signatures are dropped if the module changed since they were stored
+	/// </summary>
+	ModuleEntry& GetModule(LibraryImpl& lib, const std::string& lib_name);
+
+	static std::string GetKey(std::string_view section, std::string_view pattern);
+
+private:
+	std::mutex m_Lock;
+	std::unordered_map<std::string, ModuleEntry> m_Modules;
+	bool m_Loaded{ };
+	bool m_Dirty{ };
+};
+
+PX_NAMESPACE_BEGIN();
+inline SignatureCache sig_cache;
+PX_NAMESPACE_END();
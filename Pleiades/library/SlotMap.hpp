@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace library_detail
+{
+	/// <summary>
+	/// Values addressed by handles made of a slot's index and its generation, insertion, lookup and removal are O(1)
+	/// a slot's generation changes each time it's freed, so a removed handle never refers to a newer value
+	/// a slot is retired once its generation wraps around instead of being reused, its old handles would match again
+	/// values are packed, removing one moves the last value in its place, iteration order isn't insertion order
+	/// </summary>
+	template<typename _Ty>
+	class SlotMap
+	{
+	public:
+		using handle_type = uint32_t;
+
+		// handles' low bits are the slot's index, high bits are its generation
+		static constexpr uint32_t IndexBits = 16;
+		static constexpr handle_type IndexMask = (1u << IndexBits) - 1;
+		// the last index is never used so no handle is all bits set, eg: 'px::IHookInstance::InvalidId'
+		static constexpr size_t MaxSize = IndexMask;
+
+		/// <summary>
+		/// Handle that is never returned by 'insert', 0 is never valid either
+		/// </summary>
+		static constexpr handle_type InvalidHandle = std::numeric_limits<handle_type>::max();
+
+		/// <summary>
+		/// Insert a value
+		/// </summary>
+		/// <returns>the value's handle, 'InvalidHandle' if the map is full</returns>
+		template<typename... _Args>
+		handle_type insert(_Args&&... args)
+		{
+			uint32_t slot_idx;
+			if (m_FreeHead != NoSlot)
+			{
+				slot_idx = m_FreeHead;
+				m_FreeHead = m_Slots[slot_idx].Next;
+			}
+			else
+			{
+				if (m_Slots.size() >= MaxSize)
+					return InvalidHandle;
+				slot_idx = static_cast<uint32_t>(m_Slots.size());
+				m_Slots.emplace_back();
+			}
+
+			Slot& slot = m_Slots[slot_idx];
+			slot.Next = static_cast<uint32_t>(m_Values.size());
+			slot.Used = true;
+
+			m_Values.emplace_back(std::forward<_Args>(args)...);
+			m_Owners.emplace_back(slot_idx);
+
+			return make_handle(slot_idx, slot.Generation);
+		}
+
+		/// <summary>
+		/// Remove a value, do nothing if the handle was already removed
+		/// </summary>
+		/// <returns>true if the value was removed</returns>
+		bool erase(handle_type handle)
+		{
+			Slot* slot = find_slot(handle);
+			if (!slot)
+				return false;
+
+			// move the last value in place of the removed one
+			const uint32_t value_idx = slot->Next;
+			if (const uint32_t last_idx = static_cast<uint32_t>(m_Values.size() - 1); value_idx != last_idx)
+			{
+				m_Values[value_idx] = std::move(m_Values[last_idx]);
+				m_Owners[value_idx] = m_Owners[last_idx];
+				m_Slots[m_Owners[value_idx]].Next = value_idx;
+			}
+			m_Values.pop_back();
+			m_Owners.pop_back();
+
+			release_slot(handle & IndexMask);
+			return true;
+		}
+
+		[[nodiscard]] _Ty* find(handle_type handle) noexcept
+		{
+			const Slot* slot = find_slot(handle);
+			return slot ? &m_Values[slot->Next] : nullptr;
+		}
+
+		[[nodiscard]] const _Ty* find(handle_type handle) const noexcept
+		{
+			return const_cast<SlotMap*>(this)->find(handle);
+		}
+
+		[[nodiscard]] bool contains(handle_type handle) const noexcept
+		{
+			return find(handle) != nullptr;
+		}
+
+		void clear() noexcept
+		{
+			for (const uint32_t slot_idx : m_Owners)
+				release_slot(slot_idx);
+			m_Values.clear();
+			m_Owners.clear();
+		}
+
+		[[nodiscard]] size_t size() const noexcept { return m_Values.size(); }
+		[[nodiscard]] bool empty() const noexcept { return m_Values.empty(); }
+
+		/// <summary>
+		/// Packed values, references stay valid when values are inserted, but not when they are removed
+		/// </summary>
+		[[nodiscard]] auto begin() noexcept { return m_Values.begin(); }
+		[[nodiscard]] auto end() noexcept { return m_Values.end(); }
+		[[nodiscard]] auto begin() const noexcept { return m_Values.begin(); }
+		[[nodiscard]] auto end() const noexcept { return m_Values.end(); }
+
+		[[nodiscard]] _Ty& operator[](size_t value_idx) noexcept { return m_Values[value_idx]; }
+		[[nodiscard]] const _Ty& operator[](size_t value_idx) const noexcept { return m_Values[value_idx]; }
+
+	private:
+		static constexpr uint32_t NoSlot = std::numeric_limits<uint32_t>::max();
+
+		struct Slot
+		{
+			// index of the value if the slot is used, index of the next free slot otherwise
+			uint32_t Next{ NoSlot };
+			uint16_t Generation{ 1 };
+			bool Used{ };
+		};
+
+		[[nodiscard]] static handle_type make_handle(uint32_t slot_idx, uint16_t generation) noexcept
+		{
+			return (static_cast<handle_type>(generation) << IndexBits) | slot_idx;
+		}
+
+		/// <summary>
+		/// Bump a freed slot's generation and push it to the free list, or retire it if its generation wrapped around
+		/// </summary>
+		void release_slot(uint32_t slot_idx) noexcept
+		{
+			Slot& slot = m_Slots[slot_idx];
+			slot.Used = false;
+			slot.Next = NoSlot;
+
+			// generation 0 is never used so handles are never 0, the slot is never used again
+			if (!++slot.Generation)
+				return;
+
+			slot.Next = m_FreeHead;
+			m_FreeHead = slot_idx;
+		}
+
+		[[nodiscard]] Slot* find_slot(handle_type handle) noexcept
+		{
+			const uint32_t slot_idx = handle & IndexMask;
+			if (slot_idx >= m_Slots.size())
+				return nullptr;
+
+			Slot& slot = m_Slots[slot_idx];
+			return slot.Used && slot.Generation == static_cast<uint16_t>(handle >> IndexBits) ? &slot : nullptr;
+		}
+
+		std::vector<Slot> m_Slots;
+		// a deque so inserting never moves the values, eg: a callback that adds another callback while it's running
+		std::deque<_Ty> m_Values;
+		// slot of each value
+		std::vector<uint32_t> m_Owners;
+		uint32_t m_FreeHead{ NoSlot };
+	};
+}
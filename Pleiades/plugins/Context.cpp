@@ -8,6 +8,7 @@
 #include "Context.hpp"
 #include "library/Manager.hpp"
 #include "library/Module.hpp"
+#include "detours/HooksManager.hpp"
 //#include "Impl/Console/config.hpp"
 
 constexpr const char* GlobalInitFunction = "Tella_GetPlugin";
@@ -216,5 +217,9 @@ void PluginContext::SaveConfig()
 PluginContext::~PluginContext()
 {
 	if (m_Plugin)
+	{
 		m_Plugin->OnPluginUnload();
+		// the plugin's module is freed right after, make sure none of its callbacks is still running
+		px::detour_manager.WaitForCallbacks();
+	}
 }
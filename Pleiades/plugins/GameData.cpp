@@ -1,6 +1,7 @@
 
 #include <filesystem>
-#include <fstream>
+#include <map>
+#include <unordered_set>
 
 #include <boost/lexical_cast.hpp>
 
@@ -8,6 +9,8 @@
 
 #include "Library/Manager.hpp"
 #include "Library/Module.hpp"
+#include "Library/Signature.hpp"
+#include "Library/SignatureCache.hpp"
 
 #include "Logs/Logger.hpp"
 #include "GameData.hpp"
@@ -23,6 +26,12 @@ GameData::GameData(px::IPlugin* pPlugin) :
 
 void GameData::PushFiles(const std::vector<std::string>& files)
 {
+	std::scoped_lock lock(m_Lock);
+	// signatures already resolved are kept unless their files changed on disk, files pushed later have a lower priority
+	if (HasStaleSources())
+		m_Signatures.clear();
+	ResetSources();
+
 	const std::string_view& host_name = px::lib_manager.GetHostName();
 	m_Paths.reserve(m_Paths.size() + files.size());
 	const char* const file_name = this->GetPluginName();
@@ -44,30 +53,29 @@ void GameData::PushFiles(const std::vector<std::string>& files)
 
 px::IntPtr GameData::ReadSignature(const std::vector<std::string>& keys, const std::string& signame)
 {
+	const std::string key_path = JoinKeys(keys, signame);
+	const auto find_resolved = [this, &key_path] () -> std::pair<bool, std::optional<px::IntPtr>>
+	{
+		std::shared_lock lock(m_Lock);
+		const auto iter = m_Signatures.find(key_path);
+		if (iter == m_Signatures.end())
+			return { m_SignaturesResolved, std::nullopt };
+		return { true, ApplyExtra(iter->second.Address, iter->second.Info) };
+	};
+
 	try
 	{
-		for (const std::string& file_name : GetPaths("signatures"))
+		auto [resolved, ptr] = find_resolved();
+		if (!resolved)
 		{
-			std::ifstream file(file_name);
-			if (!file)
-				continue;
-
-			auto sig_info{ nlohmann::json::parse(file, nullptr, true, true) };
-			auto key = JumpTo(sig_info, keys);
-
-			if (key && key->is_object())
-			{
-				if (signame.empty())
-				{
-					if (key->is_object())
-						return LoadSignature(*key, true);
-				}
-				else if (const auto iter = key->find(signame); iter != key->end() && iter->is_object())
-				{
-					return LoadSignature(*iter, true);
-				}
-			}
+			ResolveSignatures();
+			ptr = find_resolved().second;
 		}
+		if (ptr)
+			return *ptr;
+
+		if (const std::optional<nlohmann::json> sig_info = FindEntry("signatures", keys, signame, [] (const nlohmann::json& info) { return info.is_object(); }))
+			return LoadSignature(*sig_info, true);
 
 		throw std::runtime_error("Failed to find keys.");
 	}
@@ -89,28 +97,8 @@ px::IntPtr GameData::ReadAddress(const std::vector<std::string>& keys, const std
 {
 	try
 	{
-		for (const std::string& file_name : GetPaths("addresses"))
-		{
-			std::ifstream file(file_name);
-			if (!file)
-				continue;
-
-			auto addr_info{ nlohmann::json::parse(file, nullptr, true, true) };
-			auto key = JumpTo(addr_info, keys);
-
-			if (key && key->is_object())
-			{
-				if (addrname.empty())
-				{
-					if (key->is_number_integer())
-						return LoadSignature(*key, false);
-				}
-				else if (const auto iter = key->find(addrname); iter != key->end() && iter->is_number_integer())
-				{
-					return LoadSignature(*iter, false);
-				}
-			}
-		}
+		if (const std::optional<nlohmann::json> addr_info = FindEntry("addresses", keys, addrname, [] (const nlohmann::json& info) { return info.is_number_integer(); }))
+			return LoadSignature(*addr_info, false);
 
 		throw std::runtime_error("Failed to find keys.");
 	}
@@ -130,16 +118,31 @@ px::IntPtr GameData::ReadAddress(const std::vector<std::string>& keys, const std
 
 px::IntPtr GameData::ReadVirtual(const std::vector<std::string>& keys, const std::string& func_name, px::IntPtr pThis)
 {
-	px::IntPtr res;
-	auto val = LoadOffset(keys, func_name, false);
+	const VirtualHandle handle = ReadVirtualHandle(keys, func_name);
+	return handle ? handle.get(pThis) : nullptr;
+}
 
-	if (val.has_value())
+VirtualHandle GameData::ReadVirtualHandle(const std::vector<std::string>& keys, const std::string& func_name)
+{
+	std::string key_path = JoinKeys(keys, func_name);
+	uint32_t generation;
 	{
-		px::IntPtr vt = pThis.read<void*>();
-		res = vt.read<void*>(val.value() * sizeof(void*));
+		std::shared_lock lock(m_Lock);
+		if (const auto iter = m_Virtuals.find(key_path); iter != m_Virtuals.end())
+			return { iter->second };
+		generation = m_Generation;
 	}
 
-	return res;
+	// missing virtuals aren't cached, 'PushFiles' may add them later
+	const std::optional<int> index = LoadOffset(keys, func_name, false);
+	if (!index || *index < 0)
+		return { };
+
+	// the sources may have been dropped while reading the index, it would be stale
+	std::scoped_lock lock(m_Lock);
+	if (m_Generation == generation)
+		m_Virtuals.emplace(std::move(key_path), *index);
+	return { *index };
 }
 
 std::optional<int> GameData::ReadOffset(const std::vector<std::string>& keys, const std::string& name)
@@ -152,28 +155,8 @@ nlohmann::json GameData::ReadDetour(const std::vector<std::string>& keys, const
 {
 	try
 	{
-		for (const std::string& file_name : GetPaths("detours"))
-		{
-			std::ifstream file(file_name);
-			if (!file)
-				continue;
-
-			auto detour_info{ nlohmann::json::parse(file, nullptr, true, true) };
-			auto key = JumpTo(detour_info, keys);
-
-			if (key && key->is_object())
-			{
-				if (detourname.empty())
-				{
-					if (key->is_object())
-						return *key;
-				}
-				else if (const auto iter = key->find(detourname); iter != key->end() && iter->is_object())
-				{
-					return *iter;
-				}
-			}
-		}
+		if (const std::optional<nlohmann::json> detour_info = FindEntry("detours", keys, detourname, [] (const nlohmann::json& info) { return info.is_object(); }))
+			return *detour_info;
 
 		throw std::runtime_error("Failed to find keys.");
 	}
@@ -192,21 +175,176 @@ nlohmann::json GameData::ReadDetour(const std::vector<std::string>& keys, const
 }
 
 
-const nlohmann::json* GameData::JumpTo(const nlohmann::json& main, const std::vector<std::string>& keys)
+void GameData::ResolveSignatures()
 {
-	auto data = &main;
+	// a single thread scans, the others wait for its results instead of scanning for the same signatures
+	std::scoped_lock resolve_lock(m_ResolveLock);
 
-	const bool bad_key = false;
-	for (const auto& key : keys)
+	struct PendingSignature
 	{
-		if (!data->contains(key))
-			return nullptr;
-		else data = &(data->at(key));
+		std::string Key;
+		std::string_view Pattern;
+		library_detail::PatternView View;
+		// signature's info in a json file, or its entry in a blob
+		const nlohmann::json* Info;
+		const GameDataBlob* Blob;
+		const GameDataBlob::Entry* Entry;
+	};
+
+	std::unordered_set<std::string> seen_keys;
+	// signatures are grouped by library and by the section they are searched in
+	std::map<std::pair<std::string, std::string>, std::vector<PendingSignature>> libraries;
+
+	// the pending signatures point into the sources, they are kept alive while scanning even if 'PushFiles' drops them
+	FileList sources;
+	uint32_t generation;
+
+	std::unique_lock lock(m_Lock);
+	if (m_SignaturesResolved)
+		return;
+
+	sources = GetFiles("signatures");
+	generation = m_Generation;
+
+	for (const FileSource& source : sources)
+	{
+		if (source.Blob)
+		{
+			// patterns were compiled with the blob
+			for (const GameDataBlob::Entry& entry : source.Blob->entries(GameDataBlob::GetType("signatures")))
+			{
+				GameDataBlob::Signature signature;
+				if (!source.Blob->signature(entry, signature))
+					continue;
+
+				std::string key{ source.Blob->key(entry) };
+				if (!m_Signatures.contains(key) && seen_keys.emplace(key).second)
+				{
+					std::pair lib_section{ std::string(signature.Library), std::string(signature.Section) };
+					libraries[std::move(lib_section)].emplace_back(std::move(key), signature.Pattern, signature.View, nullptr, source.Blob.get(), &entry);
+				}
+			}
+			continue;
+		}
+
+		// walk the file and collect every object that looks like a signature
+		std::vector<std::pair<std::vector<std::string>, const nlohmann::json*>> nodes{ { { }, &source.File->root() } };
+		while (!nodes.empty())
+		{
+			auto [keys, node] = std::move(nodes.back());
+			nodes.pop_back();
+
+			for (const auto& item : node->items())
+			{
+				const std::string& name = item.key();
+				const nlohmann::json& value = item.value();
+				if (!value.is_object())
+					continue;
+
+				const auto lib = value.find("library");
+				const auto sig = value.find("windows");
+				if (lib != value.end() && lib->is_string() && sig != value.end() && sig->is_object() && sig->contains("pattern"))
+				{
+					// signatures in earlier files take priority, same as 'ReadSignature'
+					std::string key = JoinKeys(keys, name);
+					const nlohmann::json& pattern_info = (*sig)["pattern"];
+					if (pattern_info.is_string() && !m_Signatures.contains(key) && seen_keys.emplace(key).second)
+					{
+						const std::string& pattern = pattern_info.get_ref<const std::string&>();
+
+						library_detail::PatternView view;
+						try
+						{
+							view = library_detail::CompiledSignature::Get(pattern).view();
+						}
+						catch (const std::invalid_argument&)
+						{
+							// empty patterns are never matched
+						}
+
+						std::pair lib_section{ lib->get<std::string>(), sig->value("section", std::string{ }) };
+						libraries[std::move(lib_section)].emplace_back(std::move(key), pattern, view, &value, nullptr, nullptr);
+					}
+				}
+				else
+				{
+					auto& sub_keys = nodes.emplace_back(keys, &value).first;
+					sub_keys.emplace_back(name);
+				}
+			}
+		}
 	}
 
-	return data;
+	// the libraries are scanned without holding 'm_Lock', the other lookups aren't blocked by the scan
+	lock.unlock();
+
+	std::vector<std::pair<std::string, ResolvedSignature>> resolved;
+	for (const auto& [lib_section, signatures] : libraries)
+	{
+		const auto& [lib_name, section] = lib_section;
+		std::unique_ptr<LibraryImpl> lib(static_cast<LibraryImpl*>(px::lib_manager.ReadLibrary(lib_name.c_str())));
+		if (!lib)
+			continue;
+
+		std::vector<library_detail::PatternView> patterns;
+		std::vector<px::IntPtr> results(signatures.size());
+		// indices in 'signatures' of the patterns that weren't in the cache
+		std::vector<size_t> uncached;
+		for (size_t i = 0; i < signatures.size(); i++)
+		{
+			if (!(results[i] = px::sig_cache.Find(*lib, lib_name, section, signatures[i].Pattern, signatures[i].View)))
+			{
+				patterns.emplace_back(signatures[i].View);
+				uncached.emplace_back(i);
+			}
+		}
+
+		if (!patterns.empty())
+		{
+			const std::vector<px::IntPtr> found = lib->FindBySignatures(patterns, section);
+			for (size_t i = 0; i < found.size(); i++)
+			{
+				if (!found[i])
+					continue;
+
+				results[uncached[i]] = found[i];
+				px::sig_cache.Store(*lib, lib_name, section, signatures[uncached[i]].Pattern, found[i]);
+			}
+		}
+
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			// missing signatures are left for 'ReadSignature' to report
+			if (!results[i])
+				continue;
+
+			try
+			{
+				const PendingSignature& pending = signatures[i];
+				if (pending.Info)
+					resolved.emplace_back(pending.Key, ResolvedSignature{ results[i], (*pending.Info)["windows"] });
+				else
+					resolved.emplace_back(pending.Key, ResolvedSignature{ results[i], pending.Blob->value(*pending.Entry)["windows"] });
+			}
+			catch (const std::exception&)
+			{ }
+		}
+	}
+
+	lock.lock();
+	// the sources were dropped while scanning, the signatures are resolved again from the new ones on the next read
+	if (m_Generation == generation)
+	{
+		for (auto& [key, signature] : resolved)
+			m_Signatures.try_emplace(std::move(key), std::move(signature));
+		m_SignaturesResolved = true;
+	}
+	lock.unlock();
+
+	px::sig_cache.Save();
 }
 
+
 px::IntPtr GameData::LoadSignature(const nlohmann::json& info, bool is_signature)
 {
 	if (!info.contains("library"))
@@ -224,16 +362,34 @@ px::IntPtr GameData::LoadSignature(const nlohmann::json& info, bool is_signature
 
 	auto& sig = info["windows"];
 
-	px::IntPtr ptr = is_signature ?
-		lib->FindBySignature(sig["pattern"]) :
-		sig["address"].is_number_integer() ?
-			(lib->GetModule() + sig["address"].get<int>()) :nullptr;
+	px::IntPtr ptr;
+	if (is_signature)
+	{
+		const std::string& pattern = sig["pattern"].get_ref<const std::string&>();
+		const std::string section = sig.value("section", std::string{ });
+
+		ptr = px::sig_cache.Find(*lib, lib_name, section, pattern);
+		if (!ptr)
+		{
+			ptr = lib->FindBySignature(pattern, section);
+			// marks the cache as modified, it's written once the plugins are loaded, see 'SignatureCache::Save'
+			if (ptr)
+				px::sig_cache.Store(*lib, lib_name, section, pattern, ptr);
+		}
+	}
+	else if (sig["address"].is_number_integer())
+		ptr = lib->GetModule() + sig["address"].get<int>();
 
 	if (!ptr)
 	{
 		throw std::runtime_error("Failed to find signature.");
 	}
 
+	return ApplyExtra(ptr, sig);
+}
+
+px::IntPtr GameData::ApplyExtra(px::IntPtr ptr, const nlohmann::json& sig)
+{
 	if (sig.contains("extra"))
 	{
 		auto& extra = sig["extra"];
@@ -271,28 +427,8 @@ std::optional<int> GameData::LoadOffset(const std::vector<std::string>& keys, co
 {
 	try
 	{
-		for (const std::string& file_name : GetPaths(is_offset ? "offsets" : "virtuals"))
-		{
-			std::ifstream file(file_name);
-			if (!file)
-				continue;
-
-			auto offset_info{ nlohmann::json::parse(file, nullptr, true, true) };
-			auto key = JumpTo(offset_info, keys);
-
-			if (key)
-			{
-				if (name.empty())
-				{
-					if (key->is_number_integer())
-						return key->get<int>();
-				}
-				else if (const auto iter = key->find(name); iter != key->end() && iter->is_number_integer())
-				{
-					return iter->get<int>();
-				}
-			}
-		}
+		if (const std::optional<nlohmann::json> offset_info = FindEntry(is_offset ? "offsets" : "virtuals", keys, name, [] (const nlohmann::json& info) { return info.is_number_integer(); }))
+			return offset_info->get<int>();
 
 		throw std::runtime_error("Failed to find keys.");
 	}
@@ -322,6 +458,137 @@ std::vector<std::string> GameData::GetPaths(const std::string_view& key) const
 	return paths;
 }
 
+auto GameData::GetFiles(const std::string_view& key) -> const FileList&
+{
+	auto iter = m_Files.find(key);
+	if (iter != m_Files.end())
+		return iter->second;
+
+	if (!m_Blobs)
+		m_Blobs = OpenBlobs();
+
+	return m_Files.emplace(std::string(key), OpenFiles(key, *m_Blobs)).first->second;
+}
+
+auto GameData::OpenBlobs() const -> BlobList
+{
+	BlobList blobs;
+	blobs.reserve(m_Paths.size());
+	for (const std::string& path : m_Paths)
+		blobs.emplace_back(GameDataBlob::Open(path));
+	return blobs;
+}
+
+auto GameData::OpenFiles(const std::string_view& key, const BlobList& blobs) const -> FileList
+{
+	FileList files;
+	const std::vector<std::string> paths = GetPaths(key);
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		if (blobs[i])
+			files.emplace_back(blobs[i], nullptr);
+		else if (auto file = GameDataFile::Open(paths[i]))
+			files.emplace_back(nullptr, std::move(file));
+	}
+	return files;
+}
+
+void GameData::ResetSources()
+{
+	m_SignaturesResolved = false;
+	m_Files.clear();
+	m_Blobs.reset();
+	m_BlobValues.clear();
+	m_Virtuals.clear();
+	++m_Generation;
+}
+
+bool GameData::ReloadFiles()
+{
+	std::scoped_lock lock(m_Lock);
+	if (!HasStaleSources())
+		return false;
+
+	ResetSources();
+	m_Signatures.clear();
+	return true;
+}
+
+bool GameData::HasStaleSources() const
+{
+	// the files and blobs are opened again only if their last write time changed, otherwise the same ones are returned
+	const BlobList blobs = OpenBlobs();
+	for (const auto& [key, files] : m_Files)
+	{
+		if (OpenFiles(key, blobs) != files)
+			return true;
+	}
+	return false;
+}
+
+const nlohmann::json* GameData::FindIn(const FileSource& source, const std::string_view& key, const std::string& key_path)
+{
+	if (!source.Blob)
+		return source.File->find(key_path);
+
+	const GameDataBlob::Entry* entry = source.Blob->find(GameDataBlob::GetType(key), key_path);
+	if (!entry)
+		return nullptr;
+
+	auto iter = m_BlobValues.find(entry);
+	if (iter == m_BlobValues.end())
+		iter = m_BlobValues.emplace(entry, source.Blob->value(*entry)).first;
+
+	return &iter->second;
+}
+
+size_t GameData::CompileFiles()
+{
+	std::vector<std::string> paths;
+	{
+		std::shared_lock lock(m_Lock);
+		paths = m_Paths;
+	}
+
+	size_t count = 0;
+	for (const std::string& path : paths)
+	{
+		try
+		{
+			GameDataBlob::Compile(path);
+			++count;
+		}
+		catch (const std::exception& ex)
+		{
+			PX_LOG_ERROR(
+				PX_MESSAGE("Exception reported while compiling gamedata."),
+				PX_LOGARG("Plugin", this->GetPluginName()),
+				PX_LOGARG("Path", path),
+				PX_LOGARG("Exception", ex.what())
+			);
+		}
+	}
+
+	return count;
+}
+
+std::string GameData::JoinKeys(const std::vector<std::string>& keys, const std::string& name)
+{
+	std::string path;
+	for (const std::string& key : keys)
+	{
+		path.append(key);
+		path.push_back(GameDataFile::KeySeparator);
+	}
+
+	if (!name.empty())
+		path.append(name);
+	else if (!path.empty())
+		path.pop_back();
+
+	return path;
+}
+
 const char* GameData::GetPluginName() const noexcept
 {
 	return m_Plugin ? m_Plugin->GetFileName().c_str() : LibraryManager::MainName;
@@ -1,11 +1,40 @@
 #pragma once
 
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <shared_mutex>
+#include <unordered_map>
 
 #include <nlohmann/Json.hpp>
 #include <px/interfaces/GameData.hpp>
 
 #include "Manager.hpp"
+#include "GameDataFile.hpp"
+#include "GameDataBlob.hpp"
+
+/// <summary>
+/// A virtual function's resolved vtable index, resolve it once with 'GameData::ReadVirtualHandle' and reuse it in hot paths
+/// only Pleiades' own code can use it for now, 'px::IGameData' is declared in the px SDK and plugins still go through 'ReadVirtual'
+/// </summary>
+struct VirtualHandle
+{
+	static constexpr int InvalidIndex = -1;
+
+	int Index = InvalidIndex;
+
+	[[nodiscard]] bool valid() const noexcept { return Index != InvalidIndex; }
+	explicit operator bool() const noexcept { return valid(); }
+
+	/// <summary>
+	/// Get the virtual function of 'pThis', the handle must be valid
+	/// </summary>
+	[[nodiscard]] px::IntPtr get(px::IntPtr pThis) const noexcept
+	{
+		return pThis.read<void**>()[Index];
+	}
+};
 
 class GameData : public px::IGameData
 {
@@ -27,11 +56,117 @@ public:
 public:
 	nlohmann::json ReadDetour(const std::vector<std::string>& keys, const std::string& signame);
 
+	/// <summary>
+	/// Resolve a virtual function's vtable index once, the handle can then be used on any instance without any lookup
+	/// not part of 'px::IGameData' until the px SDK declares it, see 'VirtualHandle'
+	/// </summary>
+	/// <returns>the virtual function's handle, invalid if it doesn't exists</returns>
+	VirtualHandle ReadVirtualHandle(const std::vector<std::string>& keys, const std::string& func_name);
+
+	/// <summary>
+	/// Resolve every signature in the gamedata's signature files at once, with a single pass per library
+	/// called lazily by 'ReadSignature', and again after 'PushFiles' for the newly added files, does nothing if they are already resolved
+	/// the libraries are scanned without holding 'm_Lock', the signatures found are published once every library was scanned
+	/// </summary>
+	void ResolveSignatures();
+
+	/// <summary>
+	/// Drop the opened sources and every entry read from them if any of the files changed on disk since they were opened
+	/// lookups never check the files themselves, they keep using the opened sources until this or 'PushFiles' is called
+	/// </summary>
+	/// <returns>true if the files changed and were dropped</returns>
+	bool ReloadFiles();
+
+	/// <summary>
+	/// Compile the json files of every gamedata path into a blob, see 'GameDataBlob'
+	/// </summary>
+	/// <returns>number of blobs written</returns>
+	size_t CompileFiles();
+
 private:
-	const nlohmann::json* JumpTo(const nlohmann::json& main, const std::vector<std::string>& keys);
+	/// <summary>
+	/// A gamedata type's source for a single path, the compiled blob if it's up to date, the json file otherwise
+	/// </summary>
+	struct FileSource
+	{
+		std::shared_ptr<const GameDataBlob> Blob;
+		std::shared_ptr<const GameDataFile> File;
+
+		bool operator==(const FileSource&) const = default;
+	};
+	using FileList = std::vector<FileSource>;
+	using BlobList = std::vector<std::shared_ptr<const GameDataBlob>>;
+
+	/// <summary>
+	/// A signature found by 'ResolveSignatures', its "extra" is applied on every read since 'r' dereferences must read the pointers' current value
+	/// </summary>
+	struct ResolvedSignature
+	{
+		px::IntPtr Address;
+		// the signature's "windows" object
+		nlohmann::json Info;
+	};
+
+	/// <summary>
+	/// Get the sources for a gamedata type, eg: "signatures", opened once until 'PushFiles' is called again
+	/// 'm_Lock' must be held exclusively while the sources are used, see 'FindEntry'
+	/// </summary>
+	const FileList& GetFiles(const std::string_view& key);
+
+	/// <summary>
+	/// Open the compiled blob of each path in 'm_Paths', null for paths without an up to date blob
+	/// </summary>
+	BlobList OpenBlobs() const;
+
+	/// <summary>
+	/// Open the sources for a gamedata type, the blob of each path if it has one, its json file otherwise
+	/// </summary>
+	FileList OpenFiles(const std::string_view& key, const BlobList& blobs) const;
+
+	/// <summary>
+	/// Drop the opened sources and every entry read from them, 'm_Lock' must be held exclusively
+	/// </summary>
+	void ResetSources();
+
+	/// <summary>
+	/// Check if any of the opened sources changed on disk, 'm_Lock' must be held
+	/// </summary>
+	bool HasStaleSources() const;
+
+	/// <summary>
+	/// Find an entry by its key path in a single source, entries from a blob are decoded on their first lookup
+	/// </summary>
+	/// <returns>the entry, null if it doesn't exists</returns>
+	const nlohmann::json* FindIn(const FileSource& source, const std::string_view& key, const std::string& key_path);
+
+	/// <summary>
+	/// Find the first entry at keys/name in a gamedata type's sources that satisfies 'is_valid'
+	/// the entry is copied so it can be used once 'm_Lock' is released, eg: while scanning for a signature
+	/// </summary>
+	/// <returns>the entry, nothing if it doesn't exists in any source</returns>
+	template<typename _Fn>
+	std::optional<nlohmann::json> FindEntry(const std::string_view& key, const std::vector<std::string>& keys, const std::string& name, _Fn&& is_valid)
+	{
+		const std::string key_path = JoinKeys(keys, name);
+
+		std::scoped_lock lock(m_Lock);
+		for (const FileSource& source : GetFiles(key))
+		{
+			if (const nlohmann::json* entry = FindIn(source, key, key_path); entry && is_valid(*entry))
+				return *entry;
+		}
+		return std::nullopt;
+	}
 
 	px::IntPtr LoadSignature(const nlohmann::json& info, bool is_signature);
 
+	px::IntPtr ApplyExtra(px::IntPtr ptr, const nlohmann::json& sig);
+
+	/// <summary>
+	/// Join keys and name into a single key path, used to index resolved entries
+	/// </summary>
+	static std::string JoinKeys(const std::vector<std::string>& keys, const std::string& name);
+
 	std::optional<int> LoadOffset(const std::vector<std::string>& keys, const std::string& name, bool is_offset);
 
 	std::vector<std::string> GetPaths(const std::string_view& key) const;
@@ -41,4 +176,21 @@ private:
 private:
 	px::IPlugin* m_Plugin;
 	std::vector<std::string> m_Paths;
+
+	// plugins may read their gamedata from any thread, guards every member below, and 'm_Paths' while 'PushFiles' adds to it
+	// lookups in the resolved entries only take it shared, opening the sources and resolving entries take it exclusively
+	mutable std::shared_mutex m_Lock;
+	std::map<std::string, FileList, std::less<>> m_Files;
+	// compiled blob of each path in 'm_Paths', null for paths without an up to date blob
+	std::optional<BlobList> m_Blobs;
+	std::unordered_map<const GameDataBlob::Entry*, nlohmann::json> m_BlobValues;
+
+	std::unordered_map<std::string, ResolvedSignature> m_Signatures;
+	// resolved vtable indices, by joined key path
+	std::unordered_map<std::string, int> m_Virtuals;
+	bool m_SignaturesResolved{ };
+	// held by 'ResolveSignatures' while it scans, without 'm_Lock'
+	std::mutex m_ResolveLock;
+	// incremented every time the sources are dropped, entries read from older sources aren't cached
+	uint32_t m_Generation{ };
 };
@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <cstring>
+
+#include "Library/Signature.hpp"
+
+#include "Logs/Logger.hpp"
+#include "GameDataFile.hpp"
+#include "GameDataBlob.hpp"
+
+
+/// <summary>
+/// Get a file's last write time as stored in the blob's header, -1 if it doesn't exists
+/// </summary>
+static int64_t GetLastWriteTime(const std::string& path)
+{
+	std::error_code ec;
+	const std::filesystem::file_time_type last_write_time = std::filesystem::last_write_time(path, ec);
+	return ec ? -1 : static_cast<int64_t>(last_write_time.time_since_epoch().count());
+}
+
+static std::string GetBlobPath(const std::string& path)
+{
+	return std::format("{}.gamedata", path);
+}
+
+
+std::shared_ptr<const GameDataBlob> GameDataBlob::Open(const std::string& path)
+{
+	static std::mutex blobs_lock;
+	static std::unordered_map<std::string, std::shared_ptr<const GameDataBlob>> blobs;
+
+	const std::string blob_path = GetBlobPath(path);
+	const int64_t last_write_time = GetLastWriteTime(blob_path);
+
+	std::shared_ptr<const GameDataBlob> blob;
+	{
+		std::scoped_lock lock(blobs_lock);
+		if (last_write_time == -1)
+		{
+			blobs.erase(blob_path);
+			return nullptr;
+		}
+
+		if (const auto iter = blobs.find(blob_path); iter != blobs.end() && iter->second->m_LastWriteTime == last_write_time)
+			blob = iter->second;
+		else
+		{
+			auto new_blob = std::make_shared<GameDataBlob>();
+			new_blob->m_LastWriteTime = last_write_time;
+
+			std::error_code ec;
+			const uintmax_t size = std::filesystem::file_size(blob_path, ec);
+
+			std::ifstream file(blob_path, std::ios::binary);
+			if (!ec && file)
+			{
+				new_blob->m_Buffer.resize(static_cast<size_t>(size));
+				file.read(reinterpret_cast<char*>(new_blob->m_Buffer.data()), static_cast<std::streamsize>(size));
+			}
+
+			if (ec || !file || !new_blob->Validate())
+			{
+				PX_LOG_ERROR(
+					PX_MESSAGE("Invalid gamedata blob, falling back to json files."),
+					PX_LOGARG("Path", blob_path)
+				);
+				blobs.erase(blob_path);
+				return nullptr;
+			}
+
+			blobs.insert_or_assign(blob_path, new_blob);
+			blob = std::move(new_blob);
+		}
+	}
+
+	// the json files are the source of truth, ignore the blob once any of them changed
+	const Header& header = blob->header();
+	for (size_t type = 0; type < Types.size(); type++)
+	{
+		if (GetLastWriteTime(std::format("{}.{}.json", path, Types[type])) != header.SourceTimes[type])
+			return nullptr;
+	}
+
+	return blob;
+}
+
+size_t GameDataBlob::Compile(const std::string& path)
+{
+	Header header{ .Magic = Magic, .Version = Version };
+
+	std::vector<Entry> entries;
+	std::vector<std::byte> strings, data;
+	std::unordered_map<std::string, uint32_t> string_offsets;
+
+	const auto add_string = [&strings, &string_offsets] (std::string_view str) -> uint32_t
+	{
+		const auto [iter, inserted] = string_offsets.try_emplace(std::string(str), static_cast<uint32_t>(strings.size()));
+		if (inserted)
+		{
+			const std::byte* bytes = reinterpret_cast<const std::byte*>(str.data());
+			strings.insert(strings.end(), bytes, bytes + str.size());
+		}
+		return iter->second;
+	};
+
+	const auto add_data = [&data] (const void* bytes, size_t size, size_t alignment) -> uint32_t
+	{
+		data.resize((data.size() + alignment - 1) & ~(alignment - 1));
+		const uint32_t offset = static_cast<uint32_t>(data.size());
+		data.insert(data.end(), static_cast<const std::byte*>(bytes), static_cast<const std::byte*>(bytes) + size);
+		return offset;
+	};
+
+	const auto add_signature = [&] (const nlohmann::json& info) -> uint32_t
+	{
+		if (!info.is_object())
+			return NoSignature;
+
+		const auto lib = info.find("library");
+		const auto sig = info.find("windows");
+		if (lib == info.end() || !lib->is_string() || sig == info.end() || !sig->is_object())
+			return NoSignature;
+
+		const auto pattern = sig->find("pattern");
+		if (pattern == sig->end() || !pattern->is_string())
+			return NoSignature;
+
+		library_detail::CompiledSignature compiled;
+		try
+		{
+			compiled = library_detail::CompiledSignature(pattern->get_ref<const std::string&>());
+		}
+		catch (const std::invalid_argument&)
+		{
+			// invalid patterns are left for 'ReadSignature' to report
+			return NoSignature;
+		}
+
+		const std::string& lib_name = lib->get_ref<const std::string&>();
+		const std::string& pattern_str = pattern->get_ref<const std::string&>();
+		const std::string section = sig->value("section", std::string{ });
+
+		const SignatureInfo sig_info{
+			.Library = add_string(lib_name),
+			.LibrarySize = static_cast<uint32_t>(lib_name.size()),
+			.Pattern = add_string(pattern_str),
+			.PatternSize = static_cast<uint32_t>(pattern_str.size()),
+			.Section = add_string(section),
+			.SectionSize = static_cast<uint32_t>(section.size()),
+			.Anchor = static_cast<uint32_t>(compiled.anchor()),
+			.Size = static_cast<uint32_t>(compiled.size())
+		};
+
+		const uint32_t offset = add_data(&sig_info, sizeof(sig_info), alignof(SignatureInfo));
+		add_data(compiled.bytes().data(), compiled.size(), 1);
+		add_data(compiled.mask().data(), compiled.size(), 1);
+		return offset;
+	};
+
+	bool has_source = false;
+	for (size_t type = 0; type < Types.size(); type++)
+	{
+		header.TypeRanges[type] = static_cast<uint32_t>(entries.size());
+
+		const std::string file_name = std::format("{}.{}.json", path, Types[type]);
+		header.SourceTimes[type] = GetLastWriteTime(file_name);
+		if (header.SourceTimes[type] == -1)
+			continue;
+
+		std::ifstream file(file_name);
+		if (!file)
+			throw std::runtime_error(std::format("Failed to open '{}'.", file_name));
+
+		nlohmann::json root;
+		try
+		{
+			root = nlohmann::json::parse(file, nullptr, true, true);
+		}
+		catch (const std::exception& ex)
+		{
+			throw std::runtime_error(std::format("Failed to parse '{}': {}", file_name, ex.what()));
+		}
+
+		has_source = true;
+
+		// same key paths as 'GameDataFile', sorted for the binary search
+		std::map<std::string, const nlohmann::json*> nodes{ { std::string{ }, &root } };
+		std::vector<std::pair<std::string, const nlohmann::json*>> pending{ { std::string{ }, &root } };
+		while (!pending.empty())
+		{
+			auto [key_path, node] = std::move(pending.back());
+			pending.pop_back();
+
+			if (!node->is_object())
+				continue;
+
+			for (const auto& item : node->items())
+			{
+				std::string sub_path = key_path.empty() ? item.key() : std::format("{}{}{}", key_path, GameDataFile::KeySeparator, item.key());
+				if (nodes.emplace(sub_path, &item.value()).second && item.value().is_object())
+					pending.emplace_back(std::move(sub_path), &item.value());
+			}
+		}
+
+		for (auto iter = nodes.begin(); iter != nodes.end(); ++iter)
+		{
+			const uint32_t index = static_cast<uint32_t>(entries.size());
+			const auto& [key_path, node] = *iter;
+
+			Entry& entry = entries.emplace_back();
+			entry.Key = add_string(key_path);
+			entry.KeySize = static_cast<uint32_t>(key_path.size());
+			entry.Signature = Types[type] == "signatures" ? add_signature(*node) : NoSignature;
+			entry.IsObject = node->is_object();
+
+			if (entry.IsObject)
+			{
+				// descendants are sorted right after the object, up to the first key that doesn't start with its prefix
+				// the root's descendants are every other entry
+				auto end = nodes.end();
+				if (!key_path.empty())
+				{
+					std::string next_prefix = std::format("{}{}", key_path, GameDataFile::KeySeparator);
+					next_prefix.back()++;
+					end = nodes.lower_bound(next_prefix);
+				}
+
+				entry.Value = index + 1;
+				entry.ValueSize = static_cast<uint32_t>(std::distance(iter, end)) - 1;
+			}
+			else
+			{
+				const std::vector<uint8_t> cbor = nlohmann::json::to_cbor(*node);
+				entry.Value = add_data(cbor.data(), cbor.size(), 1);
+				entry.ValueSize = static_cast<uint32_t>(cbor.size());
+			}
+		}
+	}
+
+	header.TypeRanges[Types.size()] = static_cast<uint32_t>(entries.size());
+	if (!has_source)
+		throw std::runtime_error(std::format("No gamedata files found for '{}'.", path));
+
+	constexpr auto align8 = [] (size_t offset) { return (offset + 7) & ~size_t(7); };
+
+	header.EntriesOffset = static_cast<uint32_t>(align8(sizeof(Header)));
+	header.StringsOffset = static_cast<uint32_t>(header.EntriesOffset + entries.size() * sizeof(Entry));
+	header.StringsSize = static_cast<uint32_t>(strings.size());
+	header.DataOffset = static_cast<uint32_t>(align8(header.StringsOffset + strings.size()));
+	header.DataSize = static_cast<uint32_t>(data.size());
+
+	std::vector<std::byte> buffer(header.DataOffset + data.size());
+	std::memcpy(buffer.data(), &header, sizeof(header));
+	if (!entries.empty())
+		std::memcpy(buffer.data() + header.EntriesOffset, entries.data(), entries.size() * sizeof(Entry));
+	if (!strings.empty())
+		std::memcpy(buffer.data() + header.StringsOffset, strings.data(), strings.size());
+	if (!data.empty())
+		std::memcpy(buffer.data() + header.DataOffset, data.data(), data.size());
+
+	const std::string blob_path = GetBlobPath(path);
+	std::ofstream file(blob_path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+	if (!file)
+		throw std::runtime_error(std::format("Failed to write '{}'.", blob_path));
+
+	return entries.size();
+}
+
+size_t GameDataBlob::GetType(std::string_view type) noexcept
+{
+	return std::find(Types.begin(), Types.end(), type) - Types.begin();
+}
+
+
+auto GameDataBlob::find(size_t type, std::string_view key_path) const noexcept -> const Entry*
+{
+	const std::span<const Entry> type_entries = entries(type);
+	const auto iter = std::lower_bound(
+		type_entries.begin(),
+		type_entries.end(),
+		key_path,
+		[this] (const Entry& entry, std::string_view value) { return key(entry) < value; }
+	);
+
+	return iter != type_entries.end() && key(*iter) == key_path ? &*iter : nullptr;
+}
+
+auto GameDataBlob::entries(size_t type) const noexcept -> std::span<const Entry>
+{
+	if (type >= Types.size())
+		return { };
+
+	const Header& hdr = header();
+	return m_Entries.subspan(hdr.TypeRanges[type], hdr.TypeRanges[type + 1] - hdr.TypeRanges[type]);
+}
+
+nlohmann::json GameDataBlob::value(const Entry& entry) const
+{
+	const auto decode = [this] (const Entry& leaf)
+	{
+		const uint8_t* cbor = reinterpret_cast<const uint8_t*>(m_Data.data() + leaf.Value);
+		return nlohmann::json::from_cbor(cbor, cbor + leaf.ValueSize, true, false);
+	};
+
+	if (!entry.IsObject)
+		return decode(entry);
+
+	nlohmann::json object = nlohmann::json::object();
+	const size_t prefix_size = entry.KeySize ? entry.KeySize + 1 : 0;
+
+	// parents are sorted before their children, every node is created before its members are inserted in it
+	for (const Entry& descendant : m_Entries.subspan(entry.Value, entry.ValueSize))
+	{
+		std::string_view path = key(descendant).substr(prefix_size);
+
+		nlohmann::json* node = &object;
+		for (size_t pos; (pos = path.find(GameDataFile::KeySeparator)) != path.npos; path.remove_prefix(pos + 1))
+			node = &(*node)[std::string(path.substr(0, pos))];
+
+		nlohmann::json& member = (*node)[std::string(path)];
+		member = descendant.IsObject ? nlohmann::json::object() : decode(descendant);
+	}
+
+	return object;
+}
+
+bool GameDataBlob::signature(const Entry& entry, Signature& signature) const noexcept
+{
+	if (entry.Signature == NoSignature)
+		return false;
+
+	const SignatureInfo& info = *reinterpret_cast<const SignatureInfo*>(m_Data.data() + entry.Signature);
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&info + 1);
+
+	signature = {
+		.Library = string(info.Library, info.LibrarySize),
+		.Pattern = string(info.Pattern, info.PatternSize),
+		.Section = string(info.Section, info.SectionSize),
+		.View = {
+			.Bytes = { bytes, info.Size },
+			.Mask = { bytes + info.Size, info.Size },
+			.Anchor = info.Anchor
+		}
+	};
+	return true;
+}
+
+
+bool GameDataBlob::Validate() noexcept
+{
+	const uint64_t size = m_Buffer.size();
+	const auto in_range = [] (uint64_t offset, uint64_t count, uint64_t size)
+	{
+		return offset <= size && count <= size - offset;
+	};
+
+	if (size < sizeof(Header))
+		return false;
+
+	const Header& hdr = header();
+	if (hdr.Magic != Magic || hdr.Version != Version || hdr.TypeRanges[0] != 0)
+		return false;
+
+	for (size_t type = 0; type < Types.size(); type++)
+	{
+		if (hdr.TypeRanges[type] > hdr.TypeRanges[type + 1])
+			return false;
+	}
+
+	const uint64_t entry_count = hdr.TypeRanges[Types.size()];
+	if (hdr.EntriesOffset % alignof(Entry) || hdr.DataOffset % alignof(SignatureInfo) ||
+		!in_range(hdr.EntriesOffset, entry_count * sizeof(Entry), size) ||
+		!in_range(hdr.StringsOffset, hdr.StringsSize, size) ||
+		!in_range(hdr.DataOffset, hdr.DataSize, size))
+		return false;
+
+	m_Entries = { reinterpret_cast<const Entry*>(m_Buffer.data() + hdr.EntriesOffset), static_cast<size_t>(entry_count) };
+	m_Strings = { m_Buffer.data() + hdr.StringsOffset, hdr.StringsSize };
+	m_Data = { m_Buffer.data() + hdr.DataOffset, hdr.DataSize };
+
+	for (const Entry& entry : m_Entries)
+	{
+		if (!in_range(entry.Key, entry.KeySize, m_Strings.size()) ||
+			!in_range(entry.Value, entry.ValueSize, entry.IsObject ? m_Entries.size() : m_Data.size()))
+			return false;
+
+		if (entry.Signature == NoSignature)
+			continue;
+
+		if (entry.Signature % alignof(SignatureInfo) || !in_range(entry.Signature, sizeof(SignatureInfo), m_Data.size()))
+			return false;
+
+		const SignatureInfo& info = *reinterpret_cast<const SignatureInfo*>(m_Data.data() + entry.Signature);
+		if (!in_range(info.Library, info.LibrarySize, m_Strings.size()) ||
+			!in_range(info.Pattern, info.PatternSize, m_Strings.size()) ||
+			!in_range(info.Section, info.SectionSize, m_Strings.size()) ||
+			!in_range(entry.Signature + sizeof(SignatureInfo), uint64_t(info.Size) * 2, m_Data.size()) ||
+			info.Anchor > info.Size)
+			return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include <nlohmann/Json.hpp>
+
+#include "Library/Scanner.hpp"
+
+/// <summary>
+/// Every gamedata file compiled into a single binary blob, eg: 'Pleiades.<host_name>.gamedata'
+/// the blob only holds offsets and is read as is without parsing, it can be memory mapped
+/// entries are sorted by key path in each gamedata type, leaf values are stored as cbor, objects only refer to their descendants' entries
+/// and signatures have their patterns pre-compiled
+/// </summary>
+class GameDataBlob
+{
+public:
+	static constexpr uint32_t Magic = 0x44475850;	// 'PXGD'
+	// 2: key paths are joined with 'GameDataFile::KeySeparator' instead of '/'
+	// 3: objects refer to their descendants instead of holding their whole subtree
+	static constexpr uint32_t Version = 3;
+	static constexpr uint32_t NoSignature = 0xFFFFFFFF;
+
+	static constexpr std::array<std::string_view, 5> Types{ "signatures", "addresses", "offsets", "virtuals", "detours" };
+
+	struct Header
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		// last write time of each type's json file when the blob was compiled, -1 if the file didn't exist
+		int64_t SourceTimes[Types.size()];
+		// index of the first entry of each type, entries of type 'i' are in [TypeRanges[i], TypeRanges[i + 1])
+		uint32_t TypeRanges[Types.size() + 1];
+		uint32_t EntriesOffset;
+		uint32_t StringsOffset, StringsSize;
+		uint32_t DataOffset, DataSize;
+	};
+
+	struct Entry
+	{
+		// key path in the string table
+		uint32_t Key, KeySize;
+		// for leaves, cbor encoded value in the data
+		// for objects, range of the descendants' entries, their keys start with the object's key path and the separator
+		uint32_t Value, ValueSize;
+		// offset of a 'SignatureInfo' in the data, 'NoSignature' if the entry isn't a signature
+		uint32_t Signature;
+		uint32_t IsObject;
+	};
+
+	struct SignatureInfo
+	{
+		// strings in the string table
+		uint32_t Library, LibrarySize;
+		uint32_t Pattern, PatternSize;
+		uint32_t Section, SectionSize;
+		uint32_t Anchor;
+		// followed by 'Size' bytes then 'Size' mask bytes
+		uint32_t Size;
+	};
+
+	struct Signature
+	{
+		std::string_view Library;
+		std::string_view Pattern;
+		std::string_view Section;
+		library_detail::PatternView View;
+	};
+
+public:
+	/// <summary>
+	/// Get a compiled blob from the process-wide cache
+	/// </summary>
+	/// <param name="path">gamedata path without the type and extension, eg: 'Pleiades/Pleiades.<host_name>'</param>
+	/// <returns>the blob, null if it doesn't exists, is invalid or any of its json files changed since it was compiled</returns>
+	[[nodiscard]] static std::shared_ptr<const GameDataBlob> Open(const std::string& path);
+
+	/// <summary>
+	/// Compile every json file of a gamedata path into a blob
+	/// </summary>
+	/// <param name="path">gamedata path without the type and extension, eg: 'Pleiades/Pleiades.<host_name>'</param>
+	/// <returns>number of entries written</returns>
+	/// <exception cref="std::runtime_error">if none of the json files exists, or the blob couldn't be written</exception>
+	static size_t Compile(const std::string& path);
+
+	/// <summary>
+	/// Get the index of a gamedata type in 'Types'
+	/// </summary>
+	/// <returns>the type's index, 'Types.size()' if it doesn't exists</returns>
+	[[nodiscard]] static size_t GetType(std::string_view type) noexcept;
+
+	/// <summary>
+	/// Find an entry by its key path, the root is at ""
+	/// </summary>
+	/// <returns>the entry, null if it doesn't exists</returns>
+	[[nodiscard]] const Entry* find(size_t type, std::string_view key_path) const noexcept;
+
+	[[nodiscard]] std::span<const Entry> entries(size_t type) const noexcept;
+
+	[[nodiscard]] std::string_view key(const Entry& entry) const noexcept
+	{
+		return string(entry.Key, entry.KeySize);
+	}
+
+	/// <summary>
+	/// Decode an entry's value, an object is rebuilt from the leaves of its descendants
+	/// </summary>
+	[[nodiscard]] nlohmann::json value(const Entry& entry) const;
+
+	/// <summary>
+	/// Get an entry's signature and its pre-compiled pattern
+	/// </summary>
+	/// <returns>false if the entry isn't a signature</returns>
+	[[nodiscard]] bool signature(const Entry& entry, Signature& signature) const noexcept;
+
+private:
+	[[nodiscard]] const Header& header() const noexcept
+	{
+		return *reinterpret_cast<const Header*>(m_Buffer.data());
+	}
+
+	[[nodiscard]] std::string_view string(uint32_t offset, uint32_t size) const noexcept
+	{
+		return { reinterpret_cast<const char*>(m_Strings.data() + offset), size };
+	}
+
+	/// <summary>
+	/// Check that the header, and every entry and signature point inside the blob, then set the views over each region
+	/// </summary>
+	[[nodiscard]] bool Validate() noexcept;
+
+private:
+	std::vector<std::byte> m_Buffer;
+	std::span<const Entry> m_Entries;
+	std::span<const std::byte> m_Strings;
+	std::span<const std::byte> m_Data;
+	int64_t m_LastWriteTime{ };
+};
@@ -0,0 +1,73 @@
+#include <format>
+#include <fstream>
+#include <mutex>
+
+#include "Logs/Logger.hpp"
+#include "GameDataFile.hpp"
+
+
+std::shared_ptr<const GameDataFile> GameDataFile::Open(const std::string& path)
+{
+	namespace fs = std::filesystem;
+
+	static std::mutex files_lock;
+	static std::unordered_map<std::string, std::shared_ptr<const GameDataFile>> files;
+
+	std::error_code ec;
+	const fs::file_time_type last_write_time = fs::last_write_time(path, ec);
+
+	std::scoped_lock lock(files_lock);
+	if (ec)
+	{
+		files.erase(path);
+		return nullptr;
+	}
+
+	if (const auto iter = files.find(path); iter != files.end() && iter->second->last_write_time() == last_write_time)
+		return iter->second;
+
+	std::ifstream file(path);
+	if (!file)
+		return nullptr;
+
+	auto gamedata = std::make_shared<GameDataFile>();
+	gamedata->m_Root = nlohmann::json::parse(file, nullptr, false, true);
+	gamedata->m_LastWriteTime = last_write_time;
+
+	if (gamedata->m_Root.is_discarded())
+	{
+		PX_LOG_ERROR(
+			PX_MESSAGE("Failed to parse gamedata file."),
+			PX_LOGARG("Path", path)
+		);
+		files.erase(path);
+		return nullptr;
+	}
+
+	gamedata->BuildIndex();
+	files.insert_or_assign(path, gamedata);
+	return gamedata;
+}
+
+void GameDataFile::BuildIndex()
+{
+	m_Index.emplace(std::string{ }, &m_Root);
+
+	std::vector<std::pair<std::string, const nlohmann::json*>> nodes{ { std::string{ }, &m_Root } };
+	while (!nodes.empty())
+	{
+		auto [path, node] = std::move(nodes.back());
+		nodes.pop_back();
+
+		if (!node->is_object())
+			continue;
+
+		for (const auto& item : node->items())
+		{
+			std::string key_path = path.empty() ? item.key() : std::format("{}{}{}", path, KeySeparator, item.key());
+			m_Index.emplace(key_path, &item.value());
+			if (item.value().is_object())
+				nodes.emplace_back(std::move(key_path), &item.value());
+		}
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <nlohmann/Json.hpp>
+
+/// <summary>
+/// A gamedata file parsed once, with every object member indexed by its joined key path, eg: "CBaseEntity\x1fm_iHealth"
+/// files are shared between every GameData, and are only parsed again once their last write time changes
+/// </summary>
+class GameDataFile
+{
+public:
+	/// <summary>
+	/// Separator of the keys in a key path, a control character so it can't collide with the keys themselves, eg: "a/b" and "a" -> "b"
+	/// </summary>
+	static constexpr char KeySeparator = '\x1f';
+
+	GameDataFile() = default;
+	GameDataFile(const GameDataFile&) = delete;
+	GameDataFile& operator=(const GameDataFile&) = delete;
+
+	/// <summary>
+	/// Get a parsed file from the process-wide cache, the file is parsed again if it was modified since
+	/// </summary>
+	/// <returns>the parsed file, null if the file doesn't exists or isn't a valid json</returns>
+	[[nodiscard]] static std::shared_ptr<const GameDataFile> Open(const std::string& path);
+
+	/// <summary>
+	/// Find a value by its key path, the root is at ""
+	/// </summary>
+	/// <returns>the value, null if it doesn't exists</returns>
+	[[nodiscard]] const nlohmann::json* find(const std::string& key_path) const noexcept
+	{
+		const auto iter = m_Index.find(key_path);
+		return iter != m_Index.end() ? iter->second : nullptr;
+	}
+
+	[[nodiscard]] const nlohmann::json& root() const noexcept { return m_Root; }
+
+	[[nodiscard]] std::filesystem::file_time_type last_write_time() const noexcept { return m_LastWriteTime; }
+
+private:
+	/// <summary>
+	/// Index every object member in the file, nested members are joined with 'KeySeparator'
+	/// </summary>
+	void BuildIndex();
+
+private:
+	nlohmann::json m_Root;
+	std::unordered_map<std::string, const nlohmann::json*> m_Index;
+	std::filesystem::file_time_type m_LastWriteTime;
+};
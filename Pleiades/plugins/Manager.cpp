@@ -52,6 +52,11 @@ bool DLLManager::BasicInit()
 		px::lib_manager.SetHostName(name.is_string() ? name : "any");
 	}
 
+	{
+		auto& workers = maincfg["scan workers"];
+		px::lib_manager.SetScanWorkers(workers.is_number_unsigned() ? workers.get<size_t>() : 0);
+	}
+
 	if (!px::imgui_iface.LoadImGui(maincfg))
 		return false;
 
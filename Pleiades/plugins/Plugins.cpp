@@ -5,6 +5,8 @@
 
 #include "Manager.hpp"
 #include "library/Manager.hpp"
+#include "library/SignatureCache.hpp"
+#include "detours/HooksManager.hpp"
 #include "Logs/Logger.hpp"
 //#include "/imgui_iface.hpp"
 //#include "Console/config.hpp"
@@ -27,6 +29,7 @@ void DLLManager::LoadAllDLLs(const nlohmann::json& plugins)
 	for (auto& ctx : m_Plugins)
 		ctx->GetPlugin()->OnPluginPreLoad(this);
 
+	// no batch around the plugins, they may call a hook's original function right after loading it, before a batch would be committed
 	std::erase_if(
 		m_Plugins,
 		[this] (auto& ctx)
@@ -64,6 +67,9 @@ void DLLManager::LoadAllDLLs(const nlohmann::json& plugins)
 			}
 		}
 	}
+
+	// the signatures the plugins looked up while loading are written once
+	px::sig_cache.Save();
 }
 
 px::IPlugin* DLLManager::LoadPlugin(const std::string& name)
@@ -126,6 +132,7 @@ px::IPlugin* DLLManager::LoadPlugin(const std::string& name)
 	for (auto& ctx : m_Plugins)
 		ctx->OnPluginFullLoaded();
 
+	px::sig_cache.Save();
 	return pl;
 }
 
@@ -236,7 +243,11 @@ void DLLManager::UnloadAllDLLs()
 	);
 
 	//px::console_manager.RemoveCommands();
-	m_Plugins.clear();
+	{
+		// detach every plugin's hooks in a single transaction
+		DetoursBatch batch;
+		m_Plugins.clear();
+	}
 
 	px::logger.EndLogs();
 }
@@ -0,0 +1,104 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Patcher.hpp"
+
+static size_t PageSize() noexcept
+{
+	static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	return page_size;
+}
+
+
+Patcher::Patcher(void* target, void* detour, std::string& out_err) :
+	m_Target(static_cast<std::byte*>(target))
+{
+	m_RelaySize = PageSize();
+	std::byte* relay = AllocRelay(m_Target, m_RelaySize);
+	if (!relay)
+	{
+		out_err = "Failed to allocate a relay page near the target.";
+		return;
+	}
+
+	// jmp qword ptr [rip + 0], followed by the detour's address
+	constexpr std::byte jmp_abs[]{ std::byte{ 0xFF }, std::byte{ 0x25 }, std::byte{ }, std::byte{ }, std::byte{ }, std::byte{ } };
+	std::memcpy(relay, jmp_abs, sizeof(jmp_abs));
+	std::memcpy(relay + sizeof(jmp_abs), &detour, sizeof(detour));
+	if (mprotect(relay, m_RelaySize, PROT_READ | PROT_EXEC))
+	{
+		out_err = "Failed to protect the relay page (Code: " + std::to_string(errno) + ")";
+		munmap(relay, m_RelaySize);
+		return;
+	}
+
+	std::array<std::byte, JmpSize> jmp_rel{ std::byte{ 0xE9 } };
+	const int32_t rel = static_cast<int32_t>(relay - (m_Target + JmpSize));
+	std::memcpy(jmp_rel.data() + 1, &rel, sizeof(rel));
+
+	std::memcpy(m_Saved.data(), m_Target, JmpSize);
+	if (!WriteCode(m_Target, jmp_rel.data(), JmpSize))
+	{
+		out_err = "Failed to patch the target (Code: " + std::to_string(errno) + ")";
+		munmap(relay, m_RelaySize);
+		return;
+	}
+
+	m_Relay = relay;
+}
+
+Patcher::~Patcher() noexcept
+{
+	if (!m_Relay)
+		return;
+
+	static_cast<void>(WriteCode(m_Target, m_Saved.data(), JmpSize));
+	munmap(m_Relay, m_RelaySize);
+}
+
+std::byte* Patcher::AllocRelay(const std::byte* target, size_t size) noexcept
+{
+	// 'jmp rel32' reaches +-2GB, leave some room for the distance from the page to the end of the jmp
+	constexpr uintptr_t max_distance = 0x7FF0'0000;
+	constexpr uintptr_t step = 0x10'0000;
+
+	const uintptr_t origin = reinterpret_cast<uintptr_t>(target) & ~(PageSize() - 1);
+	for (uintptr_t distance = step; distance < max_distance; distance += step)
+	{
+		for (const uintptr_t hint : { origin - distance, origin + distance })
+		{
+			// MAP_FIXED_NOREPLACE fails instead of replacing or moving the mapping if the range is in use
+			void* page = mmap(reinterpret_cast<void*>(hint), size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+			if (page == MAP_FAILED)
+				continue;
+
+			// older kernels ignore the flag and treat the address as a hint
+			if (reinterpret_cast<uintptr_t>(page) != hint)
+			{
+				munmap(page, size);
+				continue;
+			}
+			return static_cast<std::byte*>(page);
+		}
+	}
+	return nullptr;
+}
+
+bool Patcher::WriteCode(std::byte* target, const std::byte* bytes, size_t size) noexcept
+{
+	// the bytes may cross a page boundary
+	const uintptr_t begin = reinterpret_cast<uintptr_t>(target) & ~(PageSize() - 1);
+	const size_t length = reinterpret_cast<uintptr_t>(target) + size - begin;
+
+	if (mprotect(reinterpret_cast<void*>(begin), length, PROT_READ | PROT_WRITE | PROT_EXEC))
+		return false;
+
+	std::memcpy(target, bytes, size);
+	__builtin___clear_cache(reinterpret_cast<char*>(target), reinterpret_cast<char*>(target + size));
+
+	return !mprotect(reinterpret_cast<void*>(begin), length, PROT_READ | PROT_EXEC);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string>
+
+/// <summary>
+/// Redirect a local function to another one by patching its entry, the portable stand in for ms detours in the tests
+/// the entry is overwritten with a 5 bytes 'jmp rel32' to a relay page allocated within 2GB of it, which jumps to the detour
+/// the original function can't be called while it's patched, the tests call a copy of it instead
+/// </summary>
+class Patcher
+{
+public:
+	Patcher(void* target, void* detour, std::string& out_err);
+	~Patcher() noexcept;
+
+	Patcher(const Patcher&) = delete;
+	Patcher& operator=(const Patcher&) = delete;
+
+	[[nodiscard]] bool is_set() const noexcept { return m_Relay != nullptr; }
+
+private:
+	/// <summary>
+	/// Map a page within 2GB of 'target', so a 'jmp rel32' at 'target' can reach it
+	/// </summary>
+	/// <returns>the page, null if no free page was found</returns>
+	[[nodiscard]] static std::byte* AllocRelay(const std::byte* target, size_t size) noexcept;
+
+	/// <summary>
+	/// Copy 'bytes' to the code at 'target', the pages are made writable for the copy only
+	/// </summary>
+	[[nodiscard]] static bool WriteCode(std::byte* target, const std::byte* bytes, size_t size) noexcept;
+
+	static constexpr size_t JmpSize = 5;
+
+	std::byte* m_Target;
+	std::byte* m_Relay{ };
+	size_t m_RelaySize{ };
+	std::array<std::byte, JmpSize> m_Saved{ };
+};
@@ -0,0 +1,92 @@
+#include <cstddef>
+
+#include "StubBuilder.hpp"
+#include "detours/SigBuilder.hpp"
+
+/// <summary>
+/// Same as 'HookInstance::RunHandler' without callbacks to run, the frame's args and return value are still loaded and stored
+/// </summary>
+static uint8_t InvokeHandler(void* instance, bool is_post, std::byte* frame_data)
+{
+	TestDetour& detour = *static_cast<TestDetour*>(instance);
+	DetourCallContext& context = *detour.Context;
+	if (is_post)
+	{
+		DetourCallContext::CallFrame& frame = *context.TopFrame();
+		DetourCallContext::ResetState(frame);
+
+		context.LoadReturn(frame, frame_data);
+		++detour.PostCalls;
+		context.StoreReturn(frame, frame_data);
+
+		context.PopFrame();
+		return detour_detail::RunPost;
+	}
+	else
+	{
+		DetourCallContext::CallFrame& frame = context.PushFrame(frame_data);
+		DetourCallContext::ResetState(frame);
+
+		context.LoadArgs(frame, frame_data);
+		++detour.PreCalls;
+		context.StoreArgs(frame, frame_data);
+		context.StoreReturn(frame, frame_data);
+
+		// post hooks always run, so the return value goes through the frame as well
+		return detour_detail::CallOriginal | detour_detail::RunPost;
+	}
+}
+
+
+bool BuildStub(asmjit::JitRuntime& runtime, TestDetour& detour, const nlohmann::json& signature, std::string& out_err)
+{
+	using namespace asmjit;
+
+	detour_detail::SigBuilder sigbuilder(signature, out_err);
+	if (!out_err.empty())
+		return false;
+
+	const detour_detail::StubCompiler compiler(
+		runtime,
+		{
+			.Flags = offsetof(TestDetour, Flags),
+			.ActualFunc = offsetof(TestDetour, Original),
+			.CallsInFlight = offsetof(TestDetour, CallsInFlight),
+			.StatsIndex = offsetof(TestDetour, StatsIndex),
+			.Handler = &InvokeHandler
+		}
+	);
+
+	const StubCode stub = compiler.Compile(sigbuilder, detour.Context, { }, nullptr, out_err);
+	if (!stub.Code)
+		return false;
+	detour.Stub = stub.Code;
+
+	// same as 'HookInstance::AllocThunk', without the dispatch entry
+	CodeHolder code;
+	code.init(runtime.environment());
+
+	x86::Assembler assembler(&code);
+	const x86::Gp& instance = detour_detail::StubCompiler::InstanceRegister(assembler.is32Bit());
+
+	assembler.mov(instance, reinterpret_cast<uintptr_t>(&detour));
+	assembler.jmp(x86::ptr(instance, offsetof(TestDetour, Stub), assembler.registerSize()));
+
+	if (const Error err = runtime.add(&detour.Thunk, &code))
+	{
+		out_err = "Failed to add the thunk to JIT runtime (Code: " + std::to_string(err) + ")";
+		runtime.release(detour.Stub);
+		detour.Stub = nullptr;
+		return false;
+	}
+	return true;
+}
+
+void ReleaseStub(asmjit::JitRuntime& runtime, TestDetour& detour) noexcept
+{
+	if (detour.Thunk)
+		runtime.release(detour.Thunk);
+	if (detour.Stub)
+		runtime.release(detour.Stub);
+	detour.Thunk = detour.Stub = nullptr;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <asmjit/asmjit.h>
+#include <nlohmann/json.hpp>
+
+#include "detours/StubCompiler.hpp"
+#include "detours/HookStats.hpp"
+
+/// <summary>
+/// A detour of the tests, its stub is compiled by 'detour_detail::StubCompiler', the same as 'HookInstance::AllocCallbackHandler'
+/// the fields the stub reads stand in for the hook instance's, see 'detour_detail::StubLayout'
+/// there is no callbacks to run, the handler only loads and stores the call's frame and counts the calls
+/// </summary>
+struct TestDetour
+{
+	// copy of the patched function, called by the stub as the original function
+	void* Original{ };
+	// the stub jumps straight to 'Original' while it's empty
+	std::atomic<uint8_t> Flags{ detour_detail::HasPreCallbacks | detour_detail::HasPostCallbacks };
+	std::atomic<uint32_t> CallsInFlight{ };
+	uint32_t StatsIndex{ detour_detail::HookStats::InvalidIndex };
+
+	// loads the detour in the instance register then jumps to 'Stub', same as the hook's thunk
+	void* Thunk{ };
+	void* Stub{ };
+	std::shared_ptr<DetourCallContext> Context;
+
+	uint64_t PreCalls{ };
+	uint64_t PostCalls{ };
+};
+
+/// <summary>
+/// Compile the stub and the thunk of a detour, the signature is a detour's entry, eg: { "callConv": "x64SysV", "return": "int", "Arguments": [ ... ] }
+/// </summary>
+/// <returns>false if the signature is invalid or the stub failed to compile</returns>
+[[nodiscard]] bool BuildStub(asmjit::JitRuntime& runtime, TestDetour& detour, const nlohmann::json& signature, std::string& out_err);
+
+/// <summary>
+/// Release the stub and the thunk of a detour, the function must not be patched anymore
+/// </summary>
+void ReleaseStub(asmjit::JitRuntime& runtime, TestDetour& detour) noexcept;
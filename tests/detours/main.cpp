@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <string>
+
+#include "library/Manager.hpp"
+#include "Patcher.hpp"
+#include "StubBuilder.hpp"
+
+/*
+Hooks local functions through the detours' stubs and measures the time each call spends in them
+every target is compiled as its own function, and calls a copy of itself that the stub calls as the original function
+'Idle' is a hook without callbacks, its stub jumps straight to the original function
+
+-------------------------------------------------------------------------------------
+Signature       |   Direct (ns)   |   Idle (ns)     |   Hooked (ns)   |   Overhead  |
+-------------------------------------------------------------------------------------
+int             |   X.XX          |   Y.YY          |   Z.ZZ          |   W.WW      |
+-------------------------------------------------------------------------------------
+
+the test fails if a hooked call's overhead is above the limit, the second arg in nanoseconds
+*/
+
+// targets are called through pointers so they are never inlined, and must not be merged with their identical copy either
+#ifdef __clang__
+#define PX_TEST_NOINLINE __attribute__((noinline))
+#else
+#define PX_TEST_NOINLINE __attribute__((noipa))
+#endif
+
+struct BigStruct
+{
+	int64_t Values[4];
+};
+
+struct Counter
+{
+	int Value;
+};
+
+static volatile int s_Sink;
+
+PX_TEST_NOINLINE static void VoidOriginal(int value) { s_Sink = value; }
+PX_TEST_NOINLINE static void VoidTarget(int value) { VoidOriginal(value); }
+
+PX_TEST_NOINLINE static int IntOriginal(int a, int b) { return a * 3 + b; }
+PX_TEST_NOINLINE static int IntTarget(int a, int b) { return IntOriginal(a, b); }
+
+PX_TEST_NOINLINE static float FloatOriginal(float a, float b) { return a * .5f + b; }
+PX_TEST_NOINLINE static float FloatTarget(float a, float b) { return FloatOriginal(a, b); }
+
+// larger than 16 bytes, returned in memory on x64 System V
+PX_TEST_NOINLINE static BigStruct StructOriginal(int64_t value) { return { value, value + 1, value * 2, value * 3 }; }
+PX_TEST_NOINLINE static BigStruct StructTarget(int64_t value) { return StructOriginal(value); }
+
+// the object is passed first, like a member function
+PX_TEST_NOINLINE static int ThisOriginal(Counter* self, int value) { return self->Value += value; }
+PX_TEST_NOINLINE static int ThisTarget(Counter* self, int value) { return ThisOriginal(self, value); }
+
+PX_TEST_NOINLINE static int SumArgs(int count, va_list args)
+{
+	int sum = 0;
+	for (int i = 0; i < count; i++)
+		sum += va_arg(args, int);
+	return sum;
+}
+
+// variadic functions can't forward their args, both are implemented the same way
+PX_TEST_NOINLINE static int VarOriginal(int count, ...)
+{
+	va_list args;
+	va_start(args, count);
+	const int sum = SumArgs(count, args);
+	va_end(args);
+	return sum;
+}
+
+PX_TEST_NOINLINE static int VarTarget(int count, ...)
+{
+	va_list args;
+	va_start(args, count);
+	const int sum = SumArgs(count, args);
+	va_end(args);
+	return sum;
+}
+
+
+/// <summary>
+/// Write the types the signatures use to 'Pleiades.jit_types.json', 'TypeTable' loads it on first use
+/// </summary>
+static void WriteTypes()
+{
+	using asmjit::TypeId;
+
+	const nlohmann::json types{
+		{ "Defaults", {
+			{ "void", static_cast<int>(TypeId::kVoid) },
+			{ "int", static_cast<int>(TypeId::kInt32) },
+			{ "int64", static_cast<int>(TypeId::kInt64) },
+			{ "float", static_cast<int>(TypeId::kFloat32) },
+			{ "ptr", static_cast<int>(TypeId::kUIntPtr) }
+		} },
+		{ "Custom", {
+			{ "BigStruct", nlohmann::json::array({ { { "type", "int64" }, { "repeat", 4 } } }) }
+		} }
+	};
+
+	std::ofstream(std::string(LibraryManager::CommonTag) + ".jit_types.json") << types.dump(4);
+}
+
+static nlohmann::json MakeSignature(const char* callconv, const char* ret, std::initializer_list<const char*> args)
+{
+	nlohmann::json signature{
+		{ "callConv", callconv },
+		{ "return", ret },
+		{ "Arguments", nlohmann::json::array() }
+	};
+
+	for (const char* arg : args)
+		signature["Arguments"].push_back({ { "type", arg } });
+	return signature;
+}
+
+// each call is measured a few times, and the fastest round is kept so a preempted round doesn't fail the test
+static constexpr size_t MeasureRounds = 5;
+
+/// <summary>
+/// Number of calls made by 'MeasureCall'
+/// </summary>
+static constexpr size_t GetMeasuredCalls(size_t iterations) noexcept
+{
+	return iterations / 10 + iterations * MeasureRounds;
+}
+
+/// <summary>
+/// Average time of a call in the fastest round, in nanoseconds
+/// </summary>
+static double MeasureCall(size_t iterations, const std::function<void()>& call)
+{
+	using clock_type = std::chrono::steady_clock;
+
+	// warm up the caches and the branch predictors
+	for (size_t i = 0; i < iterations / 10; i++)
+		call();
+
+	double best = std::numeric_limits<double>::max();
+	for (size_t round = 0; round < MeasureRounds; round++)
+	{
+		const auto begin = clock_type::now();
+		for (size_t i = 0; i < iterations; i++)
+			call();
+		const auto end = clock_type::now();
+
+		best = std::min(best, std::chrono::duration<double, std::nano>(end - begin).count() / iterations);
+	}
+	return best;
+}
+
+
+struct TestCase
+{
+	const char* Name;
+	void* Target;
+	void* Original;
+	nlohmann::json Signature;
+	// calls the target, returns false if the result is wrong
+	std::function<bool()> Call;
+};
+
+/// <summary>
+/// Measure the target's calls, then hook it and measure them again, without and with callbacks
+/// </summary>
+/// <returns>false if the target couldn't be hooked, returned a wrong result or if the hook's overhead is above 'max_overhead'</returns>
+static bool RunTestCase(asmjit::JitRuntime& runtime, TestCase& test, size_t iterations, double max_overhead)
+{
+	const auto check = [&test]
+	{
+		if (!test.Call())
+		{
+			std::fprintf(stderr, "%s: wrong result\n", test.Name);
+			std::exit(EXIT_FAILURE);
+		}
+	};
+
+	const double direct = MeasureCall(iterations, check);
+
+	TestDetour detour{ .Original = test.Original };
+	if (std::string err; !BuildStub(runtime, detour, test.Signature, err))
+	{
+		std::fprintf(stderr, "%s: %s\n", test.Name, err.c_str());
+		return false;
+	}
+
+	double idle, hooked;
+	{
+		std::string err;
+		Patcher patcher(test.Target, detour.Thunk, err);
+		if (!patcher.is_set())
+		{
+			std::fprintf(stderr, "%s: %s\n", test.Name, err.c_str());
+			ReleaseStub(runtime, detour);
+			return false;
+		}
+
+		const uint8_t flags = detour.Flags.exchange(0);
+		idle = MeasureCall(iterations, check);
+		detour.Flags.store(flags);
+
+		hooked = MeasureCall(iterations, check);
+	}
+
+	ReleaseStub(runtime, detour);
+
+	// the warm up calls are counted as well, the idle calls never reach the handler
+	const uint64_t expected = GetMeasuredCalls(iterations);
+	if (detour.PreCalls != expected || detour.PostCalls != expected)
+	{
+		std::fprintf(stderr, "%s: the stub ran %llu pre and %llu post handlers, expected %llu\n",
+			test.Name,
+			static_cast<unsigned long long>(detour.PreCalls),
+			static_cast<unsigned long long>(detour.PostCalls),
+			static_cast<unsigned long long>(expected)
+		);
+		return false;
+	}
+
+	if (detour.CallsInFlight.load() != 0)
+	{
+		std::fprintf(stderr, "%s: %u calls are still counted in the stub\n", test.Name, detour.CallsInFlight.load());
+		return false;
+	}
+
+	std::printf("%-16s|   %-14.2f|   %-14.2f|   %-14.2f|   %-10.2f|\n", test.Name, direct, idle, hooked, hooked - direct);
+
+	if (hooked - direct > max_overhead)
+	{
+		std::fprintf(stderr, "%s: the hook's overhead (%.2fns) is above the limit (%.2fns)\n", test.Name, hooked - direct, max_overhead);
+		return false;
+	}
+	return true;
+}
+
+
+int main(int argc, char** argv)
+{
+	const size_t iterations = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+	const double max_overhead = argc > 2 ? std::strtod(argv[2], nullptr) : 1000.;
+
+	WriteTypes();
+
+	asmjit::JitRuntime runtime;
+
+	// the targets are called through pointers the compiler can't see through
+	static void (*volatile void_fn)(int) = &VoidTarget;
+	static int (*volatile int_fn)(int, int) = &IntTarget;
+	static float (*volatile float_fn)(float, float) = &FloatTarget;
+	static BigStruct (*volatile struct_fn)(int64_t) = &StructTarget;
+	static int (*volatile this_fn)(Counter*, int) = &ThisTarget;
+	static int (*volatile var_fn)(int, ...) = &VarTarget;
+
+	static Counter counter{ };
+
+	nlohmann::json var_signature = MakeSignature("x64SysV", "int", { "int", "int", "int" });
+	var_signature["va index"] = 1;
+
+	TestCase tests[]{
+		{
+			"void", reinterpret_cast<void*>(&VoidTarget), reinterpret_cast<void*>(&VoidOriginal),
+			MakeSignature("x64SysV", "void", { "int" }),
+			[] { void_fn(7); return s_Sink == 7; }
+		},
+		{
+			"int", reinterpret_cast<void*>(&IntTarget), reinterpret_cast<void*>(&IntOriginal),
+			MakeSignature("x64SysV", "int", { "int", "int" }),
+			[] { return int_fn(5, 2) == 17; }
+		},
+		{
+			"float", reinterpret_cast<void*>(&FloatTarget), reinterpret_cast<void*>(&FloatOriginal),
+			MakeSignature("x64SysV", "float", { "float", "float" }),
+			[] { return float_fn(3.f, 1.f) == 2.5f; }
+		},
+		{
+			"struct-return", reinterpret_cast<void*>(&StructTarget), reinterpret_cast<void*>(&StructOriginal),
+			MakeSignature("x64SysV", "BigStruct", { "int64" }),
+			[]
+			{
+				const BigStruct res = struct_fn(10);
+				return res.Values[0] == 10 && res.Values[1] == 11 && res.Values[2] == 20 && res.Values[3] == 30;
+			}
+		},
+		{
+			// 'ThisCall' is the host's convention on x64, with the |this| pointer as first arg
+			"thiscall", reinterpret_cast<void*>(&ThisTarget), reinterpret_cast<void*>(&ThisOriginal),
+			MakeSignature("ThisCall", "int", { "int" }),
+			[]
+			{
+				const int expected = counter.Value + 3;
+				return this_fn(&counter, 3) == expected;
+			}
+		},
+		{
+			"vararg", reinterpret_cast<void*>(&VarTarget), reinterpret_cast<void*>(&VarOriginal),
+			std::move(var_signature),
+			[] { return var_fn(2, 20, 22) == 42; }
+		}
+	};
+
+	std::printf("%-16s|   %-14s|   %-14s|   %-14s|   %-10s|\n", "Signature", "Direct (ns)", "Idle (ns)", "Hooked (ns)", "Overhead");
+
+	bool passed = true;
+	for (TestCase& test : tests)
+		passed &= RunTestCase(runtime, test, iterations, max_overhead);
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
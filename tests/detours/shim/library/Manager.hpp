@@ -0,0 +1,10 @@
+#pragma once
+
+/// <summary>
+/// Stands in for Pleiades' library manager, the detours' code generation only reads the files' common tag
+/// </summary>
+class LibraryManager
+{
+public:
+	static constexpr const char* CommonTag = "Pleiades";
+};
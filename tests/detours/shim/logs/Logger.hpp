@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdio>
+
+// errors are printed to stderr, the args' names are dropped
+#ifndef PX_LOG_ERROR
+#define PX_MESSAGE(msg)				msg
+#define PX_LOGARG(name, value)		value
+#define PX_LOG_ERROR(msg, ...)		std::fprintf(stderr, "%s\n", msg)
+#endif
@@ -0,0 +1,4 @@
+#pragma once
+
+// the detours include nlohmann's header with msvc's case insensitive paths
+#include <nlohmann/json.hpp>
@@ -0,0 +1,550 @@
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "library/PEImage.hpp"
+#include "library/Scanner.hpp"
+#include "library/Signature.hpp"
+
+/*
+Checks the signature scanner's kernels against a naive scan, and the PE parser against synthetic images
+every buffer is allocated with its exact size, so a kernel reading past its end shows up under a sanitizer
+*/
+
+using namespace library_detail;
+
+static int s_Failures;
+
+#define PX_TEST_CHECK(expr, ...)												\
+	do																			\
+	{																			\
+		if (!(expr))															\
+		{																		\
+			std::fprintf(stderr, "%s:%d: '%s' failed: ", __FILE__, __LINE__, #expr);	\
+			std::fprintf(stderr, __VA_ARGS__);									\
+			std::fputc('\n', stderr);											\
+			++s_Failures;														\
+		}																		\
+	} while (false)
+
+
+/// <summary>
+/// A pattern with its own storage, same as 'CompiledSignature' without the parser
+/// </summary>
+struct TestPattern
+{
+	std::vector<uint8_t> Bytes;
+	std::vector<uint8_t> Mask;
+	std::array<uint32_t, 256> Skip{ };
+	size_t Anchor{ };
+
+	void compile()
+	{
+		Anchor = SelectAnchor(Bytes, Mask);
+		BuildSkipTable(Bytes, Mask, Skip);
+	}
+
+	[[nodiscard]] PatternView view(bool use_skip) const noexcept
+	{
+		return {
+			.Bytes = Bytes,
+			.Mask = Mask,
+			.Anchor = Anchor,
+			.Skip = use_skip ? std::span<const uint32_t>(Skip) : std::span<const uint32_t>{ }
+		};
+	}
+};
+
+/// <summary>
+/// Instruction sets the host can run, from the slowest to the fastest
+/// </summary>
+static std::vector<ScanIsa> GetTestedIsas()
+{
+	std::vector<ScanIsa> isas{ ScanIsa::Scalar };
+	if (GetHostIsa() >= ScanIsa::SSE2)
+		isas.push_back(ScanIsa::SSE2);
+	if (GetHostIsa() >= ScanIsa::AVX2)
+		isas.push_back(ScanIsa::AVX2);
+	return isas;
+}
+
+static const char* GetIsaName(ScanIsa isa)
+{
+	switch (isa)
+	{
+	case ScanIsa::AVX2:	return "avx2";
+	case ScanIsa::SSE2:	return "sse2";
+	default:			return "scalar";
+	}
+}
+
+static std::span<const std::byte> AsBytes(const std::vector<uint8_t>& buffer)
+{
+	return { reinterpret_cast<const std::byte*>(buffer.data()), buffer.size() };
+}
+
+/// <summary>
+/// Reference scan, checks every position of the image
+/// </summary>
+/// <returns>offset of the first match, or 'image.size()' if there is none</returns>
+static size_t NaiveFind(const std::vector<uint8_t>& image, const std::vector<uint8_t>& bytes, const std::vector<uint8_t>& mask)
+{
+	for (size_t pos = 0; pos + bytes.size() <= image.size(); pos++)
+	{
+		bool matched = true;
+		for (size_t i = 0; i < bytes.size() && matched; i++)
+			matched = !mask[i] || image[pos + i] == bytes[i];
+		if (matched)
+			return pos;
+	}
+	return image.size();
+}
+
+static size_t ToOffset(const std::vector<uint8_t>& image, const std::byte* res)
+{
+	return res ? static_cast<size_t>(res - reinterpret_cast<const std::byte*>(image.data())) : image.size();
+}
+
+
+// a small alphabet of common bytes, so the anchor byte shows up often and most candidates fail late
+static constexpr uint8_t Alphabet[]{ 0x00, 0x8B, 0x48, 0xE8 };
+
+static uint8_t RandomByte(std::mt19937& rng)
+{
+	return Alphabet[rng() % std::size(Alphabet)];
+}
+
+
+/// <summary>
+/// Match patterns whose last byte is the image's last byte, for every image size around the SSE2 and AVX2 block sizes
+/// the pattern is also placed at random positions, so the kernels' block loop, their tail and the skip table all run
+/// </summary>
+static void TestKernelTails()
+{
+	std::mt19937 rng(0x5EED);
+	const std::vector<ScanIsa> isas = GetTestedIsas();
+
+	for (size_t size : { 1, 2, 3, 7, 15, 16, 17, 31, 32, 33, 40 })
+	{
+		for (size_t image_size = size; image_size <= 100; image_size++)
+		{
+			TestPattern pattern;
+			for (size_t i = 0; i < size; i++)
+			{
+				pattern.Bytes.push_back(RandomByte(rng));
+				pattern.Mask.push_back(rng() % 4 ? 0xFF : 0x00);
+			}
+			pattern.Mask[rng() % size] = 0xFF;
+			pattern.compile();
+
+			std::vector<uint8_t> image(image_size);
+			for (uint8_t& byte : image)
+				byte = RandomByte(rng);
+
+			// place the pattern at the very end half of the time, somewhere random otherwise
+			const size_t offset = rng() % 2 ? image_size - size : rng() % (image_size - size + 1);
+			for (size_t i = 0; i < size; i++)
+			{
+				if (pattern.Mask[i])
+					image[offset + i] = pattern.Bytes[i];
+			}
+
+			const size_t expected = NaiveFind(image, pattern.Bytes, pattern.Mask);
+			for (ScanIsa isa : isas)
+			{
+				for (bool use_skip : { false, true })
+				{
+					const size_t res = ToOffset(image, FindPattern(AsBytes(image), pattern.view(use_skip), isa));
+					PX_TEST_CHECK(
+						res == expected,
+						"FindPattern(%s, skip: %d), pattern size: %zu, image size: %zu, got %zu instead of %zu",
+						GetIsaName(isa), use_skip, size, image_size, res, expected
+					);
+				}
+			}
+
+			// same search without any wildcard
+			const std::vector<uint8_t> needle(image.begin() + offset, image.begin() + offset + size);
+			const size_t expected_bytes = NaiveFind(image, needle, std::vector<uint8_t>(size, 0xFF));
+			for (ScanIsa isa : isas)
+			{
+				const size_t res = ToOffset(image, FindBytes(AsBytes(image), AsBytes(needle), isa));
+				PX_TEST_CHECK(
+					res == expected_bytes,
+					"FindBytes(%s), needle size: %zu, image size: %zu, got %zu instead of %zu",
+					GetIsaName(isa), size, image_size, res, expected_bytes
+				);
+			}
+		}
+	}
+}
+
+
+/// <summary>
+/// The anchor is the rarest exact byte of the pattern, and never a wildcard
+/// </summary>
+static void TestAnchorSelection()
+{
+	// 0xC3 is rarer than 0x8B, and the leading wildcards are skipped
+	static constexpr StaticSignature static_sig{ "? ? 8B C3 ?" };
+	static_assert(static_sig.view().Anchor == 3);
+
+	static constexpr StaticSignature wildcard_sig{ "? ? ?" };
+	static_assert(wildcard_sig.view().Anchor == 3);
+
+	std::mt19937 rng(0xA4C402);
+	for (size_t n = 0; n < 1000; n++)
+	{
+		const size_t size = 1 + rng() % 24;
+		std::vector<uint8_t> bytes(size), mask(size);
+		for (size_t i = 0; i < size; i++)
+		{
+			bytes[i] = static_cast<uint8_t>(rng());
+			mask[i] = rng() % 3 ? 0xFF : 0x00;
+		}
+
+		const size_t anchor = SelectAnchor(bytes, mask);
+		const bool has_exact = std::ranges::find(mask, 0xFF) != mask.end();
+		if (!has_exact)
+		{
+			PX_TEST_CHECK(anchor == size, "pattern of wildcards got anchor %zu", anchor);
+			continue;
+		}
+
+		PX_TEST_CHECK(anchor < size && mask[anchor], "anchor %zu of a %zu bytes pattern is a wildcard", anchor, size);
+		if (anchor >= size)
+			continue;
+
+		for (size_t i = 0; i < size; i++)
+		{
+			PX_TEST_CHECK(
+				!mask[i] || ByteFrequencies[bytes[i]] >= ByteFrequencies[bytes[anchor]],
+				"byte %zu (%02X) is rarer than the anchor (%02X)", i, bytes[i], bytes[anchor]
+			);
+		}
+	}
+
+	// a pattern of wildcards matches at the start of the image
+	const CompiledSignature wildcards("?? ? *");
+	const std::vector<uint8_t> image(8, 0xCC);
+	PX_TEST_CHECK(wildcards.anchor() == wildcards.size(), "anchor: %zu", wildcards.anchor());
+	PX_TEST_CHECK(ToOffset(image, wildcards.find(AsBytes(image))) == 0, "pattern of wildcards didn't match the start of the image");
+}
+
+
+/// <summary>
+/// Parse patterns with wildcards and the accepted separators, then match them
+/// </summary>
+static void TestWildcards()
+{
+	const CompiledSignature sig("55 8B EC ? ?? * 8B 0D 2A");
+	constexpr uint8_t expected_bytes[]{ 0x55, 0x8B, 0xEC, 0, 0, 0, 0, 0x8B, 0x0D, 0x2A };
+	constexpr uint8_t expected_mask[]{ 0xFF, 0xFF, 0xFF, 0, 0, 0, 0, 0xFF, 0xFF, 0xFF };
+
+	PX_TEST_CHECK(sig.size() == std::size(expected_bytes), "size: %zu", sig.size());
+	PX_TEST_CHECK(std::ranges::equal(sig.bytes(), expected_bytes), "bytes don't match");
+	PX_TEST_CHECK(std::ranges::equal(sig.mask(), expected_mask), "mask doesn't match");
+
+	// separators are optional, and the escapes' prefixes are skipped
+	for (const char* same : { "558BEC???*8B0D2A", "\\x55\\x8B\\xEC ? ? ? ? \\x8B\\x0D\\x2A", "0x55 0x8B 0xEC ?? ?? 0x8B 0x0D 0x2A" })
+	{
+		const CompiledSignature other(same);
+		PX_TEST_CHECK(
+			std::ranges::equal(other.bytes(), sig.bytes()) && std::ranges::equal(other.mask(), sig.mask()),
+			"'%s' isn't parsed the same", same
+		);
+	}
+
+	bool thrown = false;
+	try
+	{
+		const CompiledSignature empty(" \\x xyz ");
+	}
+	catch (const std::invalid_argument&)
+	{
+		thrown = true;
+	}
+	PX_TEST_CHECK(thrown, "a pattern without any byte was compiled");
+
+	// any value is accepted in place of the wildcards, a different exact byte isn't
+	std::mt19937 rng(0x3C0DE);
+	std::vector<uint8_t> image(64, 0xCC);
+	for (size_t n = 0; n < 256; n++)
+	{
+		const size_t offset = rng() % (image.size() - sig.size() + 1);
+		std::ranges::fill(image, 0xCC);
+		for (size_t i = 0; i < sig.size(); i++)
+			image[offset + i] = expected_mask[i] ? expected_bytes[i] : static_cast<uint8_t>(rng());
+
+		PX_TEST_CHECK(ToOffset(image, sig.find(AsBytes(image))) == offset, "wildcards at %zu didn't match", offset);
+
+		const size_t exact = std::array{ 0, 1, 2, 7, 8, 9 }[n % 6];
+		image[offset + exact] ^= 0x01;
+		PX_TEST_CHECK(!sig.find(AsBytes(image)), "pattern matched with byte %zu changed", exact);
+	}
+}
+
+
+/// <summary>
+/// Match patterns crossing the boundaries between the chunks of the parallel scans
+/// the chunks are 1mb long for an image of a few mbs, see 'GetChunkSize' in Scanner.cpp
+/// </summary>
+static void TestChunkBoundaries()
+{
+	constexpr size_t ChunkSize = 1 << 20;
+	constexpr size_t Workers = 4;
+
+	const CompiledSignature sig("E8 ? ? ? ? 48 8B 05 ? C3");
+	const CompiledSignature other("48 89 5C 24 ? 57");
+
+	std::vector<uint8_t> image(ChunkSize * 4 + 123);
+	const auto place = [&image] (const CompiledSignature& signature, size_t offset)
+	{
+		for (size_t i = 0; i < signature.size(); i++)
+			image[offset + i] = signature.mask()[i] ? signature.bytes()[i] : 0x90;
+	};
+	const auto erase = [&image] (const CompiledSignature& signature, size_t offset)
+	{
+		std::fill_n(image.begin() + offset, signature.size(), 0);
+	};
+
+	// every position where the pattern crosses the boundary, plus the ones right before and after it
+	for (size_t boundary : { ChunkSize, ChunkSize * 3 })
+	{
+		for (size_t offset = boundary - sig.size(); offset <= boundary; offset++)
+		{
+			place(sig, offset);
+			const size_t res = ToOffset(image, FindPatternParallel(AsBytes(image), sig.view(), Workers));
+			PX_TEST_CHECK(res == offset, "FindPatternParallel, pattern at %zu got %zu", offset, res);
+			erase(sig, offset);
+		}
+	}
+
+	// the last bytes of the image are only scanned by the last chunk
+	place(sig, image.size() - sig.size());
+	PX_TEST_CHECK(
+		ToOffset(image, FindPatternParallel(AsBytes(image), sig.view(), Workers)) == image.size() - sig.size(),
+		"FindPatternParallel didn't match the end of the image"
+	);
+	erase(sig, image.size() - sig.size());
+
+	// the lowest match wins, whichever chunk finishes first
+	place(sig, ChunkSize * 3 + 5);
+	place(sig, ChunkSize * 2 - 3);
+	place(other, ChunkSize - 2);
+	PX_TEST_CHECK(
+		ToOffset(image, FindPatternParallel(AsBytes(image), sig.view(), Workers)) == ChunkSize * 2 - 3,
+		"FindPatternParallel didn't return the lowest match"
+	);
+
+	const PatternView views[]{ sig.view(), other.view(), CompiledSignature::Get("DE AD BE EF").view() };
+	const std::vector<const std::byte*> expected = FindPatterns(AsBytes(image), views);
+	const std::vector<const std::byte*> results = FindPatternsParallel(AsBytes(image), views, Workers);
+
+	PX_TEST_CHECK(ToOffset(image, expected[0]) == ChunkSize * 2 - 3, "FindPatterns, got %zu", ToOffset(image, expected[0]));
+	PX_TEST_CHECK(ToOffset(image, expected[1]) == ChunkSize - 2, "FindPatterns, got %zu", ToOffset(image, expected[1]));
+	PX_TEST_CHECK(!expected[2], "FindPatterns matched a missing pattern");
+	PX_TEST_CHECK(results == expected, "FindPatternsParallel's results differ from FindPatterns'");
+
+	ShutdownScanPool();
+}
+
+
+/// <summary>
+/// Write a little endian value at 'offset'
+/// </summary>
+template<typename _Ty>
+static void WriteAt(std::vector<uint8_t>& buffer, size_t offset, _Ty value)
+{
+	std::memcpy(buffer.data() + offset, &value, sizeof(value));
+}
+
+struct TestSection
+{
+	const char* Name;
+	uint32_t VirtualAddress, VirtualSize;
+	uint32_t RawOffset, RawSize;
+	uint32_t Characteristics;
+};
+
+/// <summary>
+/// Build the headers of a PE image, with its section table right after the optional header
+/// </summary>
+static std::vector<uint8_t> MakePEHeaders(size_t buffer_size, bool is_64bit, std::span<const TestSection> sections)
+{
+	constexpr size_t NtOffset = 0x80;
+	constexpr size_t OptHeader = NtOffset + 4 + 20;
+
+	std::vector<uint8_t> buffer(buffer_size);
+	WriteAt<uint16_t>(buffer, 0, 0x5A4D);
+	WriteAt<int32_t>(buffer, 0x3C, NtOffset);
+	WriteAt<uint32_t>(buffer, NtOffset, 0x00004550);
+
+	const uint16_t opt_size = is_64bit ? 0xF0 : 0xE0;
+	WriteAt<uint16_t>(buffer, NtOffset + 4, is_64bit ? 0x8664 : 0x014C);
+	WriteAt<uint16_t>(buffer, NtOffset + 6, static_cast<uint16_t>(sections.size()));
+	WriteAt<uint32_t>(buffer, NtOffset + 8, 0x5F3759DF);
+	WriteAt<uint16_t>(buffer, NtOffset + 20, opt_size);
+
+	WriteAt<uint16_t>(buffer, OptHeader, is_64bit ? 0x20B : 0x10B);
+	WriteAt<uint32_t>(buffer, OptHeader + 56, 0x3000);
+	WriteAt<uint32_t>(buffer, OptHeader + 64, 0xC0FFEE);
+
+	for (size_t i = 0; i < sections.size(); i++)
+	{
+		const size_t header = OptHeader + opt_size + i * 40;
+		std::memcpy(buffer.data() + header, sections[i].Name, std::min<size_t>(std::strlen(sections[i].Name), 8));
+		WriteAt(buffer, header + 8, sections[i].VirtualSize);
+		WriteAt(buffer, header + 12, sections[i].VirtualAddress);
+		WriteAt(buffer, header + 16, sections[i].RawSize);
+		WriteAt(buffer, header + 20, sections[i].RawOffset);
+		WriteAt(buffer, header + 36, sections[i].Characteristics);
+	}
+
+	return buffer;
+}
+
+static constexpr TestSection SampleSections[]{
+	{ ".text", 0x1000, 0x180, 0x400, 0x200, PESection::CntCode | PESection::MemExecute | PESection::MemRead },
+	// no virtual size, the raw size is used instead
+	{ ".rdata", 0x2000, 0, 0x600, 0x200, PESection::CntInitializedData | PESection::MemRead },
+	// runs past the end of the buffer in both layouts
+	{ ".big", 0x2800, 0x1000, 0x800, 0x1000, PESection::CntInitializedData | PESection::MemRead | PESection::MemWrite },
+	// the name fills the 8 bytes without a terminator
+	{ ".textbss", 0x4000, 0x100, 0, 0, PESection::MemExecute | PESection::MemRead | PESection::MemWrite }
+};
+
+static bool IsSameSpan(std::span<const std::byte> span, const std::vector<uint8_t>& buffer, size_t offset, size_t size)
+{
+	return span.data() == reinterpret_cast<const std::byte*>(buffer.data()) + offset && span.size() == size;
+}
+
+/// <summary>
+/// Parse the same sample image in both layouts, then malformed headers
+/// </summary>
+static void TestPEImage()
+{
+	for (bool is_64bit : { false, true })
+	{
+		// file layout, sections are at their raw offset
+		{
+			const std::vector<uint8_t> buffer = MakePEHeaders(0x900, is_64bit, SampleSections);
+			const auto image = PEImage::Parse(AsBytes(buffer), PEImage::Layout::File);
+			PX_TEST_CHECK(image.has_value(), "file image (64 bits: %d) wasn't parsed", is_64bit);
+			if (!image)
+				continue;
+
+			PX_TEST_CHECK(image->is_64bit() == is_64bit, "is_64bit: %d", image->is_64bit());
+			PX_TEST_CHECK(image->machine() == (is_64bit ? 0x8664 : 0x014C), "machine: %04X", image->machine());
+			PX_TEST_CHECK(image->timestamp() == 0x5F3759DF, "timestamp: %08X", image->timestamp());
+			PX_TEST_CHECK(image->size_of_image() == 0x3000, "size of image: %X", image->size_of_image());
+			PX_TEST_CHECK(image->checksum() == 0xC0FFEE, "checksum: %X", image->checksum());
+			PX_TEST_CHECK(image->sections().size() == std::size(SampleSections), "sections: %zu", image->sections().size());
+
+			const PESection* text = image->find_section(".text");
+			const PESection* textbss = image->find_section(".textbss");
+			PX_TEST_CHECK(text && text->is_executable() && !text->is_data(), ".text isn't an executable section");
+			PX_TEST_CHECK(textbss && textbss->name() == ".textbss", ".textbss wasn't found by its full name");
+			PX_TEST_CHECK(!image->find_section(".tex"), "a section was found by its prefix");
+
+			const auto code = image->code_sections();
+			const auto data = image->data_sections();
+			PX_TEST_CHECK(code.size() == 2 && data.size() == 2, "code sections: %zu, data sections: %zu", code.size(), data.size());
+			if (code.size() == 2 && data.size() == 2)
+			{
+				PX_TEST_CHECK(IsSameSpan(code[0], buffer, 0x400, 0x200), ".text's raw data is wrong");
+				PX_TEST_CHECK(code[1].empty(), ".textbss has no raw data");
+				PX_TEST_CHECK(IsSameSpan(data[0], buffer, 0x600, 0x200), ".rdata's raw data is wrong");
+				PX_TEST_CHECK(IsSameSpan(data[1], buffer, 0x800, 0x100), ".big isn't clamped to the buffer");
+			}
+		}
+
+		// mapped layout, sections are at their virtual address
+		{
+			std::vector<uint8_t> buffer = MakePEHeaders(0x3000, is_64bit, SampleSections);
+			const CompiledSignature sig("48 8B 05 ? ? ? ? C3");
+			for (size_t i = 0; i < sig.size(); i++)
+				buffer[0x1000 + 0x100 + i] = sig.bytes()[i];
+
+			const auto image = PEImage::Parse(AsBytes(buffer), PEImage::Layout::Mapped);
+			PX_TEST_CHECK(image.has_value(), "mapped image (64 bits: %d) wasn't parsed", is_64bit);
+			if (!image)
+				continue;
+
+			const auto code = image->code_sections();
+			const auto data = image->data_sections();
+			PX_TEST_CHECK(code.size() == 2 && data.size() == 2, "code sections: %zu, data sections: %zu", code.size(), data.size());
+			if (code.size() == 2 && data.size() == 2)
+			{
+				PX_TEST_CHECK(IsSameSpan(code[0], buffer, 0x1000, 0x180), ".text's virtual data is wrong");
+				PX_TEST_CHECK(code[1].empty(), ".textbss is past the end of the buffer");
+				PX_TEST_CHECK(IsSameSpan(data[0], buffer, 0x2000, 0x200), ".rdata didn't fall back to its raw size");
+				PX_TEST_CHECK(IsSameSpan(data[1], buffer, 0x2800, 0x800), ".big isn't clamped to the buffer");
+
+				// signatures are only looked up in the code sections
+				const std::byte* res = sig.find(code[0]);
+				PX_TEST_CHECK(res && ToOffset(buffer, res) == 0x1100, "signature wasn't found in .text");
+			}
+		}
+	}
+
+	const std::vector<uint8_t> valid = MakePEHeaders(0x900, true, SampleSections);
+	const auto expect_invalid = [] (const std::vector<uint8_t>& buffer, const char* what)
+	{
+		PX_TEST_CHECK(!PEImage::Parse(AsBytes(buffer), PEImage::Layout::File), "%s was parsed", what);
+	};
+
+	expect_invalid({ }, "an empty buffer");
+	{
+		std::vector<uint8_t> buffer = valid;
+		WriteAt<uint16_t>(buffer, 0, 0x4D5A);
+		expect_invalid(buffer, "a wrong dos magic");
+	}
+	{
+		std::vector<uint8_t> buffer = valid;
+		WriteAt<int32_t>(buffer, 0x3C, -4);
+		expect_invalid(buffer, "a negative nt headers offset");
+	}
+	{
+		std::vector<uint8_t> buffer = valid;
+		WriteAt<int32_t>(buffer, 0x3C, 0x8FE);
+		expect_invalid(buffer, "a nt headers offset past the end");
+	}
+	{
+		std::vector<uint8_t> buffer = valid;
+		WriteAt<uint16_t>(buffer, 0x80 + 4 + 20, 0x107);
+		expect_invalid(buffer, "a wrong optional header magic");
+	}
+	{
+		// cut the last section header in half
+		std::vector<uint8_t> buffer(valid.begin(), valid.begin() + 0x80 + 4 + 20 + 0xF0 + 40 * 3 + 20);
+		expect_invalid(buffer, "a truncated section table");
+	}
+}
+
+
+int main()
+{
+	std::printf("scanning with %s\n", GetIsaName(GetHostIsa()));
+
+	TestKernelTails();
+	TestAnchorSelection();
+	TestWildcards();
+	TestChunkBoundaries();
+	TestPEImage();
+
+	if (s_Failures)
+	{
+		std::fprintf(stderr, "%d checks failed\n", s_Failures);
+		return EXIT_FAILURE;
+	}
+
+	std::printf("all checks passed\n");
+	return EXIT_SUCCESS;
+}